@@ -0,0 +1,77 @@
+#ifndef INDEX_PARTITIONING_QUERY_ARENA_HPP
+#define INDEX_PARTITIONING_QUERY_ARENA_HPP
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+
+namespace query {
+    /**
+     * Per-request storage of the lexemes that are not a contiguous part of the parsed string, e.g., the phrases whose
+     * words are separated by more than one space.
+     * The memory is allocated in blocks and released all together, by clear() or by the destruction of the arena.
+     */
+    class QueryArena {
+    public:
+        /**
+         * @param block_size The size of the blocks, a larger lexeme takes a block of its own
+         */
+        QueryArena(std::size_t block_size = 1024)
+                : block_size(block_size),
+                  free_ptr(nullptr),
+                  free_size(0) {}
+
+        QueryArena(const QueryArena &) = delete;
+        QueryArena & operator=(const QueryArena &) = delete;
+
+        /**
+         * @return size bytes valid until the arena is cleared
+         */
+        char *
+        allocate(std::size_t size) {
+            if (size > this->free_size) {
+                const std::size_t new_block_size = std::max(size, this->block_size);
+                this->blocks.emplace_back(new char[new_block_size]);
+                this->free_ptr = this->blocks.back().get();
+                this->free_size = new_block_size;
+            }
+            char * result = this->free_ptr;
+            this->free_ptr += size;
+            this->free_size -= size;
+            return result;
+        }
+
+        /**
+         * @return A copy of the size bytes at data, valid until the arena is cleared
+         */
+        const char *
+        store(const char * data, std::size_t size) {
+            char * result = this->allocate(size);
+            std::memcpy(result, data, size);
+            return result;
+        }
+
+        /**
+         * Releases all the allocated memory but the first block, which is reused by the following request
+         */
+        void
+        clear() {
+            if (this->blocks.empty()) {
+                return;
+            }
+            this->blocks.resize(1);
+            this->free_ptr = this->blocks.front().get();
+            this->free_size = this->block_size;
+        }
+
+    private:
+        std::size_t block_size;
+        std::vector<std::unique_ptr<char[]>> blocks;
+        char * free_ptr;
+        std::size_t free_size;
+    };
+}
+
+#endif //INDEX_PARTITIONING_QUERY_ARENA_HPP
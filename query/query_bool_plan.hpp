@@ -0,0 +1,59 @@
+#ifndef INDEX_PARTITIONING_QUERY_BOOL_PLAN_HPP
+#define INDEX_PARTITIONING_QUERY_BOOL_PLAN_HPP
+
+#include <cstdint>
+#include <vector>
+
+
+namespace query {
+    /**
+     * A boolean query translated into term ids, the input of bool_query, which evaluates every node with a cursor.
+     * The nodes are stored in post-order, every node after its sub-expressions, thus the root is the last one. The
+     * children of a node are a range of children, the positions of their nodes: the excluded ones of an AND, i.e., its
+     * negated operands, are the last num_excluded.
+     * A plan has no nested operators of the same kind, no NOT outside of an AND and no excluded operand of an AND
+     * without positive operands: see query_server::translate_bool_string.
+     */
+    struct BoolPlan {
+        enum Operator : uint8_t {
+            PLAN_TERM,
+            PLAN_AND,
+            PLAN_OR
+        };
+
+        struct node {
+            Operator op;
+            uint32_t term_id; // PLAN_TERM only
+            uint32_t first_child;
+            uint32_t num_children;
+            uint32_t num_excluded; // PLAN_AND only
+        };
+
+        std::vector<node> nodes;
+        std::vector<uint32_t> children;
+
+        /**
+         * @return True if the query matches no documents
+         */
+        bool
+        empty() const {
+            return this->nodes.empty();
+        }
+
+        /**
+         * @return The terms of the query, the excluded ones included since their lists are read too
+         */
+        std::vector<uint32_t>
+        terms() const {
+            std::vector<uint32_t> result;
+            for (const node &n: this->nodes) {
+                if (n.op == PLAN_TERM) {
+                    result.push_back(n.term_id);
+                }
+            }
+            return result;
+        }
+    };
+}
+
+#endif //INDEX_PARTITIONING_QUERY_BOOL_PLAN_HPP
@@ -2,6 +2,9 @@
 #define INDEX_PARTITIONING_QUERY_EVALUATION_HPP
 
 #include "../ds2i/index_types.hpp"
+#include "query_bool_plan.hpp"
+#include <chrono>
+#include <functional>
 #include <iostream>
 #include <unordered_set>
 
@@ -72,6 +75,18 @@ namespace query {
             return this->heap;
         }
 
+        /**
+         * @return The elements of the finalized queue, sorted by decreasing score and then by increasing docid
+         */
+        std::vector<docid_score> get_sorted_list() const {
+            std::vector<docid_score> sorted(this->heap);
+            std::sort(sorted.begin(), sorted.end(),
+                      [](docid_score const& lhs, docid_score const& rhs) {
+                          return lhs.score > rhs.score || (lhs.score == rhs.score && lhs.docid < rhs.docid);
+                      });
+            return sorted;
+        }
+
     private:
         inline unsigned int
         left(unsigned int i) {
@@ -118,6 +133,65 @@ namespace query {
     };
 
 
+    /**
+     * Deadline of a query, checked by the operators while they move on the candidates.
+     * The clock is read once every check_interval calls of expired, so that the check is cheap enough to be done
+     * for every candidate. Once expired, the deadline stays expired.
+     */
+    class QueryDeadline {
+    public:
+        typedef std::chrono::steady_clock clock;
+
+        static const unsigned int check_interval = 1024;
+
+        QueryDeadline(clock::time_point deadline)
+                : deadline(deadline),
+                  countdown(check_interval),
+                  timed_out(false) {
+        }
+
+        inline bool
+        expired() {
+            if (--this->countdown > 0) {
+                return this->timed_out;
+            }
+            this->countdown = check_interval;
+            if (!this->timed_out && clock::now() >= this->deadline) {
+                this->timed_out = true;
+            }
+            return this->timed_out;
+        }
+
+        bool
+        is_timed_out() const {
+            return this->timed_out;
+        }
+
+    private:
+        clock::time_point deadline;
+        unsigned int countdown;
+        bool timed_out;
+    };
+
+
+    /**
+     * Output of a ranked evaluation: the top-k documents and the number of matching documents, counted during the
+     * same traversal. The docids are the ones of the index.
+     * When num_hits_exact is false, num_hits is only a lower bound, because the operator skipped some documents
+     * without evaluating them (maxscore).
+     */
+    struct RankedResults {
+        std::vector<docid_score> top_k; // sorted by decreasing score
+        uint64_t num_hits;
+        bool num_hits_exact;
+
+        RankedResults()
+                : num_hits(0),
+                  num_hits_exact(true) {
+        }
+    };
+
+
     template <typename T>
     void
     remove_vector_duplicates_and_sort(
@@ -128,9 +202,130 @@ namespace query {
     }
 
 
+    /**
+     * Normalizes a flat query as and_query (conjunctive) or or_query with normalize=true do before their evaluation,
+     * i.e., removes the duplicate terms and sorts the ones of an AND by increasing list size, so that the query can be
+     * stored once and evaluated by the operators with normalize=false
+     */
+    template <typename Index>
+    void
+    normalize_flat_query(
+            Index const & index,
+            term_id_vec & terms,
+            bool conjunctive
+    ) {
+        remove_vector_duplicates_and_sort(terms);
+        if (conjunctive) {
+            std::vector<std::pair<uint64_t, uint32_t>> by_size;
+            by_size.reserve(terms.size());
+            for (auto term: terms) {
+                by_size.emplace_back(index[term].size(), term);
+            }
+            std::sort(by_size.begin(), by_size.end());
+            for (std::size_t i = 0; i < by_size.size(); ++i) {
+                terms[i] = by_size[i].second;
+            }
+        }
+    }
+
+
+    /**
+     * Normalizes a cnf query as and_or_query (sum_sizes=false) or opt_and_or_query (sum_sizes=true) with normalize=true
+     * do before their evaluation: removes the duplicates, sorts the terms of every OR group by decreasing list size
+     * and the groups by increasing size of their largest list, or of the sum of their lists
+     */
+    template <typename Index>
+    void
+    normalize_cnf_query(
+            Index const & index,
+            std::vector<term_id_vec> & and_or_terms,
+            bool sum_sizes
+    ) {
+        for (const auto & or_terms: and_or_terms) {
+            if (or_terms.empty()) {
+                return;
+            }
+        }
+        for (auto & or_terms: and_or_terms) {
+            remove_vector_duplicates_and_sort(or_terms);
+        }
+        remove_vector_duplicates_and_sort(and_or_terms);
+
+        std::vector<std::pair<uint64_t, std::size_t>> group_sizes;
+        group_sizes.reserve(and_or_terms.size());
+        std::vector<std::pair<uint64_t, uint32_t>> by_size;
+        for (std::size_t g = 0; g < and_or_terms.size(); ++g) {
+            term_id_vec & or_terms = and_or_terms[g];
+            by_size.clear();
+            uint64_t sum = 0;
+            for (auto term: or_terms) {
+                by_size.emplace_back(index[term].size(), term);
+                sum += by_size.back().first;
+            }
+            std::sort(by_size.begin(), by_size.end(), std::greater<std::pair<uint64_t, uint32_t>>());
+            for (std::size_t i = 0; i < by_size.size(); ++i) {
+                or_terms[i] = by_size[i].second;
+            }
+            group_sizes.emplace_back(sum_sizes ? sum : by_size[0].first, g);
+        }
+        std::sort(group_sizes.begin(), group_sizes.end());
+
+        std::vector<term_id_vec> sorted_terms;
+        sorted_terms.reserve(and_or_terms.size());
+        for (const auto & group_size: group_sizes) {
+            sorted_terms.push_back(std::move(and_or_terms[group_size.second]));
+        }
+        and_or_terms.swap(sorted_terms);
+    }
+
+
+    /**
+     * Normalizes a BoolPlan as bool_query with normalize=true does before its evaluation: sorts the operands of every
+     * AND, and its excluded operands too, by increasing estimated number of documents, i.e., the list size of a term,
+     * the sum of the ones of the operands of an OR and the least one of the operands of an AND
+     */
+    template <typename Index>
+    void
+    normalize_bool_plan(
+            Index const & index,
+            BoolPlan & plan
+    ) {
+        std::vector<uint64_t> costs;
+        costs.reserve(plan.nodes.size());
+        const auto by_cost = [&costs](uint32_t lhs, uint32_t rhs) {
+            return costs[lhs] < costs[rhs];
+        };
+        for (const BoolPlan::node & n: plan.nodes) {
+            uint32_t * operands = plan.children.data() + n.first_child;
+            uint64_t cost = 0;
+            switch (n.op) {
+                case BoolPlan::PLAN_TERM:
+                    cost = index[n.term_id].size();
+                    break;
+                case BoolPlan::PLAN_OR:
+                    for (uint32_t i = 0; i < n.num_children; ++i) {
+                        cost += costs[operands[i]];
+                    }
+                    break;
+                default:
+                    // the excluded operands too, which are the most selective when they skip the most candidates
+                    std::sort(operands, operands + n.num_children - n.num_excluded, by_cost);
+                    std::sort(operands + n.num_children - n.num_excluded, operands + n.num_children, by_cost);
+                    cost = costs[operands[0]];
+                    break;
+            }
+            costs.push_back(cost);
+        }
+    }
+
+
     template <bool normalize=true, bool with_freqs=true>
     struct and_or_query {
     public:
+        and_or_query(QueryDeadline * deadline = nullptr, RankedResults * ranked_results = nullptr)
+                : deadline(deadline),
+                  ranked_results(ranked_results) {
+        }
         template<typename Index, typename ScorerType=ds2i::bm25>
         uint64_t operator()(Index const &index, std::vector<term_id_vec> & and_or_terms) const {
             return this->get<Index, ScorerType, false, false>(index, and_or_terms);
@@ -183,7 +378,7 @@ namespace query {
             // handle empty query
             if (and_or_terms.empty())
                 return 0;
-            for (auto or_term: and_or_terms) {
+            for (const auto & or_term: and_or_terms) {
                 if (or_term.size() == 0)
                     return 0;
             }
@@ -217,7 +412,7 @@ namespace query {
             std::vector<std::vector<enum_type>> and_or_enums(num_groups);
 
             for (std::size_t g = 0; g < num_groups; ++g) {
-                and_or_enums.reserve(and_or_terms[g].size());
+                and_or_enums[g].reserve(and_or_terms[g].size());
                 for (auto term: and_or_terms[g])
                     and_or_enums[g].push_back(index[term]);
             }
@@ -301,6 +496,10 @@ namespace query {
 
             // loop over documents to move on the cursor
             while (cur_docid < num_docs) {
+                // cooperative cancellation
+                if (this->deadline != nullptr && this->deadline->expired()) {
+                    break;
+                }
                 groups_min_docid[0] = num_docs;
                 for (std::size_t k = 0, last_group = 0; k < num_terms; ++k) {
                     // group setting
@@ -340,6 +539,7 @@ namespace query {
                         }
 
                         top_k.insert(cur_docid, score);
+                        ++results;
                     } else {
                         ++results;
                         // check_rel INTEGRATION
@@ -398,6 +598,11 @@ namespace query {
             if (rank_docs) {
                 top_k.finalize();
                 const std::vector<docid_score> & top_k_list = top_k.get_list();
+                if (this->ranked_results != nullptr) {
+                    this->ranked_results->top_k = top_k.get_sorted_list();
+                    this->ranked_results->num_hits = results;
+                    this->ranked_results->num_hits_exact = true;
+                }
                 results = top_k_list.size();
 
                 if (check_rel) {
@@ -413,12 +618,20 @@ namespace query {
 
             return results;
         }
+
+    private:
+        QueryDeadline * deadline;
+        RankedResults * ranked_results; // optional, filled by the ranked evaluations
     };
 
 
     template <bool normalize=true, bool with_freqs=true>
     struct opt_and_or_query {
     public:
+        opt_and_or_query(QueryDeadline * deadline = nullptr, RankedResults * ranked_results = nullptr)
+                : deadline(deadline),
+                  ranked_results(ranked_results) {
+        }
         template<typename Index, typename ScorerType=ds2i::bm25>
         uint64_t operator()(Index const &index, std::vector<term_id_vec> & and_or_terms) const {
             return this->get<Index, ScorerType, false, false>(index, and_or_terms);
@@ -590,6 +803,10 @@ namespace query {
             std::size_t k = 0; // term index
             // loop over documents to move on the cursor
             while (cur_docid < num_docs) {
+                // cooperative cancellation
+                if (this->deadline != nullptr && this->deadline->expired()) {
+                    break;
+                }
                 std::size_t k_end = group_to_start_pos[num_groups_matched+1];
                 while (k < k_end) {
                     // move on the cursor
@@ -624,6 +841,7 @@ namespace query {
                         }
 
                         top_k.insert(cur_docid, score);
+                        ++results;
                     } else {
                         ++results;
                         // check_rel INTEGRATION
@@ -686,6 +904,11 @@ namespace query {
             if (rank_docs) {
                 top_k.finalize();
                 const std::vector<docid_score> & top_k_list = top_k.get_list();
+                if (this->ranked_results != nullptr) {
+                    this->ranked_results->top_k = top_k.get_sorted_list();
+                    this->ranked_results->num_hits = results;
+                    this->ranked_results->num_hits_exact = true;
+                }
                 results = top_k_list.size();
 
                 if (check_rel) {
@@ -701,12 +924,20 @@ namespace query {
 
             return results;
         }
+
+    private:
+        QueryDeadline * deadline;
+        RankedResults * ranked_results; // optional, filled by the ranked evaluations
     };
 
 
     template <bool normalize=true, bool with_freqs=true>
     struct and_query {
     public:
+        and_query(QueryDeadline * deadline = nullptr, RankedResults * ranked_results = nullptr)
+                : deadline(deadline),
+                  ranked_results(ranked_results) {
+        }
         template<typename Index, typename ScorerType=ds2i::bm25>
         uint64_t operator()(Index const &index, term_id_vec & terms) const {
             return this->get<Index, ScorerType, false, false>(index, terms);
@@ -811,6 +1042,10 @@ namespace query {
 
             size_t i = 1; // term index
             while (candidate < num_docs) {
+                // cooperative cancellation
+                if (this->deadline != nullptr && this->deadline->expired()) {
+                    break;
+                }
                 // compute next candidate docid and update score
                 for (; i < enums.size(); ++i) {
                     enums[i].next_geq(candidate);
@@ -832,6 +1067,7 @@ namespace query {
                         }
 
                         top_k.insert(candidate, score);
+                        ++results;
                     } else {
                         ++results;
                         // check_rel INTEGRATION
@@ -858,6 +1094,11 @@ namespace query {
             if (rank_docs) {
                 top_k.finalize();
                 const std::vector<docid_score> & top_k_list = top_k.get_list();
+                if (this->ranked_results != nullptr) {
+                    this->ranked_results->top_k = top_k.get_sorted_list();
+                    this->ranked_results->num_hits = results;
+                    this->ranked_results->num_hits_exact = true;
+                }
                 results = top_k_list.size();
 
                 if (check_rel) {
@@ -873,12 +1114,20 @@ namespace query {
 
             return results;
         }
+
+    private:
+        QueryDeadline * deadline;
+        RankedResults * ranked_results; // optional, filled by the ranked evaluations
     };
 
 
     template <bool normalize=true, bool with_freqs=true>
     struct or_query {
     public:
+        or_query(QueryDeadline * deadline = nullptr, RankedResults * ranked_results = nullptr)
+                : deadline(deadline),
+                  ranked_results(ranked_results) {
+        }
         template<typename Index, typename ScorerType=ds2i::bm25>
         uint64_t operator()(Index const &index, term_id_vec & terms) const {
             return this->get<Index, ScorerType, false, false>(index, terms);
@@ -977,6 +1226,10 @@ namespace query {
             // end
 
             while (cur_doc < num_docs) {
+                // cooperative cancellation
+                if (this->deadline != nullptr && this->deadline->expired()) {
+                    break;
+                }
                 // init the variables used by the scorer
                 if (rank_docs) {
                     score = 0;
@@ -1004,6 +1257,7 @@ namespace query {
                 // update the score
                 if (rank_docs) {
                     top_k.insert(cur_doc, score);
+                    ++results;
                 } else {
                     ++results;
                     // check_rel INTEGRATION
@@ -1023,6 +1277,11 @@ namespace query {
             if (rank_docs) {
                 top_k.finalize();
                 const std::vector<docid_score> & top_k_list = top_k.get_list();
+                if (this->ranked_results != nullptr) {
+                    this->ranked_results->top_k = top_k.get_sorted_list();
+                    this->ranked_results->num_hits = results;
+                    this->ranked_results->num_hits_exact = true;
+                }
                 results = top_k_list.size();
 
                 if (check_rel) {
@@ -1038,11 +1297,19 @@ namespace query {
 
             return results;
         }
+
+    private:
+        QueryDeadline * deadline;
+        RankedResults * ranked_results; // optional, filled by the ranked evaluations
     };
 
 
     struct maxscore_query {
     public:
+        maxscore_query(QueryDeadline * deadline = nullptr, RankedResults * ranked_results = nullptr)
+                : deadline(deadline),
+                  ranked_results(ranked_results) {
+        }
         template<typename Index, typename ScorerType=ds2i::bm25>
         uint64_t operator()(Index const &index, term_id_vec & terms) const {
             throw std::runtime_error("this constructor cannot be implemented");
@@ -1127,11 +1394,17 @@ namespace query {
                             ->docs_enum.docid();
 
             TopK_Queue top_k(K);
+            uint64_t num_hits = 0; // only the evaluated candidates, a lower bound of the matching documents
             while (non_essential_lists < ordered_enums.size() &&
                    cur_doc < num_docs) {
+                // cooperative cancellation
+                if (this->deadline != nullptr && this->deadline->expired()) {
+                    break;
+                }
                 float score = 0;
                 float norm_len = wdata->norm_len(cur_doc);
                 uint64_t next_doc = num_docs;
+                ++num_hits;
                 for (size_t i = non_essential_lists; i < ordered_enums.size(); ++i) {
                     if (ordered_enums[i]->docs_enum.docid() == cur_doc) {
                         score += ordered_enums[i]->q_weight * ScorerType::doc_term_weight
@@ -1169,6 +1442,11 @@ namespace query {
             top_k.finalize();
 
             const std::vector<docid_score> & top_k_list = top_k.get_list();
+            if (this->ranked_results != nullptr) {
+                this->ranked_results->top_k = top_k.get_sorted_list();
+                this->ranked_results->num_hits = num_hits;
+                this->ranked_results->num_hits_exact = false;
+            }
             if (check_rel) {
                 *num_rel_ret = 0;
                 std::unordered_set<uint64_t> rel_set(rel->begin(), rel->end());
@@ -1181,6 +1459,378 @@ namespace query {
 
             return top_k_list.size();
         }
+
+    private:
+        QueryDeadline * deadline;
+        RankedResults * ranked_results; // optional, filled by the ranked evaluations
+    };
+
+    /**
+     * The cursors of a BoolPlan on an index, one for every node, moving with next_geq on the documents matched by
+     * their sub-expressions: an OR on the least docid of its operands, an AND on the docids where its operands align,
+     * starting from the first one, then skipping the docids contained by one of its excluded operands, whose cursors
+     * are moved only up to the candidates, without enumerating the excluded documents.
+     * A cursor is moved only by the one of its parent, thus the cursors are positioned once, in the post-order of the
+     * plan, and then they only move forward.
+     */
+    template <typename Index>
+    class bool_cursors {
+    public:
+        typedef typename Index::document_enumerator enum_type;
+
+        /**
+         * @param plan The plan, referenced by the cursors, whose AND operands are aligned in their order: see
+         * normalize_bool_plan
+         * @param deadline Optional, a cursor moving while it is expired ends its documents
+         */
+        bool_cursors(Index const& index, const BoolPlan & plan, QueryDeadline * deadline)
+                : children(plan.children),
+                  num_docs(index.num_docs()),
+                  deadline(deadline) {
+            this->cursors.reserve(plan.nodes.size());
+            for (const BoolPlan::node & n: plan.nodes) {
+                cursor c {n.op, n.first_child, n.num_children, n.num_excluded, 0, 0};
+                if (n.op == BoolPlan::PLAN_TERM) {
+                    c.term = static_cast<uint32_t>(this->enums.size());
+                    this->enums.push_back(index[n.term_id]);
+                }
+                this->cursors.push_back(c);
+            }
+
+            // the children are positioned before their parent
+            for (cursor & c: this->cursors) {
+                switch (c.op) {
+                    case BoolPlan::PLAN_TERM:
+                        c.docid = this->enums[c.term].docid();
+                        break;
+                    case BoolPlan::PLAN_OR:
+                        c.docid = this->num_docs;
+                        for (uint32_t i = 0; i < c.num_children; ++i) {
+                            c.docid = std::min(c.docid, this->cursors[this->children[c.first_child + i]].docid);
+                        }
+                        break;
+                    default:
+                        c.docid = this->align(c, 0);
+                        break;
+                }
+            }
+        }
+
+        /**
+         * @return The current document of the query, num_docs when there are no more
+         */
+        uint64_t docid() const {
+            return this->cursors.back().docid;
+        }
+
+        /**
+         * Moves on the next document of the query
+         */
+        void next() {
+            const uint32_t root = static_cast<uint32_t>(this->cursors.size() - 1);
+            this->advance(root, this->cursors[root].docid + 1);
+        }
+
+        /**
+         * @return The number of term cursors
+         */
+        std::size_t size() const {
+            return this->enums.size();
+        }
+
+        enum_type & term(std::size_t k) {
+            return this->enums[k];
+        }
+
+        /**
+         * Calls fn with the positions of the terms, not excluded, containing the current document
+         */
+        template <typename Function>
+        void for_each_match(Function fn) const {
+            this->for_each_match(static_cast<uint32_t>(this->cursors.size() - 1), fn);
+        }
+
+    private:
+        struct cursor {
+            BoolPlan::Operator op;
+            uint32_t first_child;
+            uint32_t num_children;
+            uint32_t num_excluded;
+            uint32_t term; // position in enums, PLAN_TERM only
+            uint64_t docid;
+        };
+
+        /**
+         * Moves the cursor n to its first docid not lower than target, the term cursors are moved here without
+         * calling the recursive next_geq
+         */
+        inline uint64_t advance(uint32_t n, uint64_t target) {
+            cursor & c = this->cursors[n];
+            if (c.docid >= target) {
+                return c.docid;
+            }
+            if (c.op == BoolPlan::PLAN_TERM && target < this->num_docs) {
+                enum_type & e = this->enums[c.term];
+                e.next_geq(target);
+                return c.docid = e.docid();
+            }
+            return this->next_geq(n, target);
+        }
+
+        uint64_t next_geq(uint32_t n, uint64_t target) {
+            cursor & c = this->cursors[n];
+            if (c.docid >= target) {
+                return c.docid;
+            }
+            if (target >= this->num_docs) {
+                return c.docid = this->num_docs;
+            }
+            switch (c.op) {
+                case BoolPlan::PLAN_TERM: {
+                    enum_type & e = this->enums[c.term];
+                    e.next_geq(target);
+                    return c.docid = e.docid();
+                }
+                case BoolPlan::PLAN_OR: {
+                    uint64_t docid = this->num_docs;
+                    for (uint32_t i = 0; i < c.num_children; ++i) {
+                        docid = std::min(docid, this->advance(this->children[c.first_child + i], target));
+                    }
+                    return c.docid = docid;
+                }
+                default:
+                    return c.docid = this->align(c, target);
+            }
+        }
+
+        /**
+         * @return The first docid, from candidate, contained by all the operands of the AND c and by none of its
+         * excluded operands
+         */
+        uint64_t align(const cursor & c, uint64_t candidate) {
+            const uint32_t * operands = this->children.data() + c.first_child;
+            const uint32_t num_operands = c.num_children - c.num_excluded;
+            while (true) {
+                // cooperative cancellation
+                if (this->deadline != nullptr && this->deadline->expired()) {
+                    return this->num_docs;
+                }
+
+                // a mismatch restarts from the first operand
+                candidate = this->advance(operands[0], candidate);
+                for (uint32_t i = 1; i < num_operands && candidate < this->num_docs;) {
+                    const uint64_t docid = this->advance(operands[i], candidate);
+                    if (docid == candidate) {
+                        ++i;
+                    } else {
+                        candidate = this->advance(operands[0], docid);
+                        i = 1;
+                    }
+                }
+                if (candidate >= this->num_docs) {
+                    return this->num_docs;
+                }
+
+                uint32_t i = num_operands;
+                while (i < c.num_children && this->advance(operands[i], candidate) != candidate) {
+                    ++i;
+                }
+                if (i == c.num_children) {
+                    return candidate;
+                }
+                ++candidate;
+            }
+        }
+
+        template <typename Function>
+        void for_each_match(uint32_t n, Function & fn) const {
+            const cursor & c = this->cursors[n];
+            switch (c.op) {
+                case BoolPlan::PLAN_TERM:
+                    fn(c.term);
+                    break;
+                case BoolPlan::PLAN_OR:
+                    for (uint32_t i = 0; i < c.num_children; ++i) {
+                        const uint32_t child = this->children[c.first_child + i];
+                        if (this->cursors[child].docid == c.docid) {
+                            this->for_each_match(child, fn);
+                        }
+                    }
+                    break;
+                default:
+                    for (uint32_t i = 0, num_operands = c.num_children - c.num_excluded; i < num_operands; ++i) {
+                        this->for_each_match(this->children[c.first_child + i], fn);
+                    }
+                    break;
+            }
+        }
+
+    private:
+        std::vector<cursor> cursors; // in the order of the plan nodes, the root is the last one
+        const std::vector<uint32_t> & children;
+        std::vector<enum_type> enums;
+        const uint64_t num_docs;
+        QueryDeadline * deadline;
+    };
+
+
+    /**
+     * Evaluates a BoolPlan, i.e., a boolean query with nested AND, OR and excluded operands, with bool_cursors.
+     * The score of a document is the sum of the scores of the terms containing it, the excluded ones aside.
+     */
+    template <bool normalize=true, bool with_freqs=true>
+    struct bool_query {
+    public:
+        bool_query(QueryDeadline * deadline = nullptr, RankedResults * ranked_results = nullptr)
+                : deadline(deadline),
+                  ranked_results(ranked_results) {
+        }
+        template<typename Index, typename ScorerType=ds2i::bm25>
+        uint64_t operator()(Index const &index, const BoolPlan & plan) const {
+            return this->get<Index, ScorerType, false, false>(index, plan);
+        }
+
+        template<typename Index, typename ScorerType=ds2i::bm25>
+        uint64_t operator()(Index const &index, const BoolPlan & plan, std::vector<uint64_t> & rel, uint64_t * num_rel_ret) const {
+            return this->get<Index, ScorerType, true, false>(index, plan, &rel, num_rel_ret);
+        }
+
+        template<typename Index, typename ScorerType=ds2i::bm25>
+        uint64_t operator()(Index const &index, wand_data<ScorerType> const& wdata, const BoolPlan & plan, unsigned int K) const {
+            return this->get<Index, ScorerType, false, true>(index, plan, nullptr, nullptr, &wdata, K);
+        }
+
+        template<typename Index, typename ScorerType=ds2i::bm25>
+        uint64_t operator()(Index const &index, wand_data<ScorerType> const& wdata, const BoolPlan & plan, std::vector<uint64_t> & rel, uint64_t * num_rel_ret, unsigned int K) const {
+            return this->get<Index, ScorerType, true, true>(index, plan, &rel, num_rel_ret, &wdata, K);
+        }
+
+    private:
+        template <typename Index, typename ScorerType, bool check_rel, bool rank_docs>
+        uint64_t get(Index const& index, const BoolPlan & plan, std::vector<uint64_t> * rel=nullptr, uint64_t * num_rel_ret=nullptr, wand_data<ScorerType> const* wdata=nullptr, unsigned int K=0) const
+        {
+            // check parameters
+            if (rel != nullptr) {
+                if (!check_rel) {
+                    throw std::runtime_error("The template parameter check_rel must be true when rel is specified");
+                }
+                if (num_rel_ret == nullptr) {
+                    throw std::runtime_error("The parameter num_rel_ret must be specified");
+                }
+            }
+            if (wdata != nullptr) {
+                if (!rank_docs) {
+                    throw std::runtime_error("The template parameter rank_docs must be true when wdata is specified");
+                }
+                if (!with_freqs) {
+                    throw std::runtime_error("The template parameter with_freqs must be true when wdata is specified");
+                }
+                if (K == 0) {
+                    throw std::runtime_error("The parameter K must be greater than zero");
+                }
+            }
+
+            if (check_rel) {
+                *num_rel_ret = 0;
+            }
+
+            // handle empty query
+            if (plan.empty()) {
+                return 0;
+            }
+
+            BoolPlan normalized_plan;
+            if (normalize) {
+                normalized_plan = plan;
+                normalize_bool_plan(index, normalized_plan);
+            }
+            typedef bool_cursors<Index> cursors_type;
+            cursors_type cursors(index, normalize ? normalized_plan : plan, this->deadline);
+            const uint64_t num_docs = index.num_docs();
+
+            // term weights
+            std::vector<float> enums_weights;
+            if (rank_docs) {
+                enums_weights.reserve(cursors.size());
+                for (std::size_t k = 0; k < cursors.size(); ++k) {
+                    enums_weights.push_back(
+                            ScorerType::query_term_weight(1ul, cursors.term(k).size(), num_docs)
+                    );
+                }
+            }
+            TopK_Queue top_k(K);
+            float score = 0;
+            float norm_len = 0;
+
+            // check_rel INTEGRATION
+            const uint64_t * rel_it = nullptr;
+            const uint64_t * rel_it_end = nullptr;
+            if (check_rel) {
+                remove_vector_duplicates_and_sort(*rel);
+                rel_it_end = (rel_it = rel->data()) + rel->size();
+            }
+            // end
+
+            uint64_t results = 0;
+            for (uint64_t cur_docid = cursors.docid(); cur_docid < num_docs; cursors.next(), cur_docid = cursors.docid()) {
+                // cooperative cancellation
+                if (this->deadline != nullptr && this->deadline->expired()) {
+                    break;
+                }
+                ++results;
+
+                if (rank_docs) {
+                    score = 0;
+                    norm_len = wdata->norm_len(cur_docid);
+                    cursors.for_each_match([&](std::size_t k) {
+                        score += enums_weights[k] * ScorerType::doc_term_weight(cursors.term(k).freq(), norm_len);
+                    });
+                    top_k.insert(cur_docid, score);
+                } else {
+                    // check_rel INTEGRATION
+                    if (check_rel) {
+                        while (rel_it != rel_it_end && *rel_it < cur_docid) {
+                            ++rel_it;
+                        }
+                        if (rel_it != rel_it_end && *rel_it == cur_docid) {
+                            ++(*num_rel_ret);
+                        }
+                    }
+                    if (with_freqs) { // freqs INTEGRATION
+                        cursors.for_each_match([&cursors](std::size_t k) {
+                            do_not_optimize_away(cursors.term(k).freq());
+                        });
+                    }
+                }
+            }
+
+            if (rank_docs) {
+                top_k.finalize();
+                const std::vector<docid_score> & top_k_list = top_k.get_list();
+                if (this->ranked_results != nullptr) {
+                    this->ranked_results->top_k = top_k.get_sorted_list();
+                    this->ranked_results->num_hits = results;
+                    this->ranked_results->num_hits_exact = true;
+                }
+                results = top_k_list.size();
+
+                if (check_rel) {
+                    *num_rel_ret = 0;
+                    std::unordered_set<uint64_t> rel_set(rel->begin(), rel->end());
+                    for (unsigned int i=0, i_end=static_cast<unsigned int>(top_k_list.size()); i < i_end; ++i) {
+                        if (rel_set.find(top_k_list[i].docid) != rel_set.end()) {
+                            ++(*num_rel_ret);
+                        }
+                    }
+                }
+            }
+
+            return results;
+        }
+
+    private:
+        QueryDeadline * deadline;
+        RankedResults * ranked_results; // optional, filled by the ranked evaluations
     };
 }
 
@@ -0,0 +1,137 @@
+#ifndef INDEX_PARTITIONING_QUERY_EXPR_BOOL_HPP
+#define INDEX_PARTITIONING_QUERY_EXPR_BOOL_HPP
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "query_expr_term_view.hpp"
+
+
+namespace query {
+    /**
+     * Query boolean expression: terms combined by AND, OR and NOT at any depth, e.g., (a (b | c d) -(e | f)).
+     * The nodes are stored in a single vector in pre-order, every node followed by its sub-expressions, so that the
+     * expression is allocated once. The root is the node 0, the first sub-expression of the node i is the node i+1
+     * and the next sibling of the node i is the node i + size.
+     */
+    class QueryExprBool {
+    public:
+        enum Operator : uint8_t {
+            EXPR_TERM,
+            EXPR_AND,
+            EXPR_OR,
+            EXPR_NOT
+        };
+
+        struct node {
+            Operator op;
+            uint32_t size; // the number of nodes of the sub-expression rooted here, itself included
+            uint32_t num_children;
+            QueryExprTermView term; // EXPR_TERM only
+        };
+
+    public:
+        const node &
+        operator[](std::size_t idx) const {
+            return this->nodes[idx];
+        }
+
+        /**
+         * @return The number of nodes of the expression, 0 if it is empty
+         */
+        std::size_t
+        size() const {
+            return this->nodes.size();
+        }
+
+        /**
+         * @return The number of terms in the expression
+         */
+        std::size_t
+        getTermsNumber() const {
+            std::size_t iTermsNumber = 0;
+            for (const node &n: this->nodes) {
+                iTermsNumber += n.op == EXPR_TERM ? 1 : 0;
+            }
+            return iTermsNumber;
+        }
+
+        /**
+         * Appends a term, as the last sub-expression of the open operators
+         */
+        void
+        push_term(const QueryExprTermView &term) {
+            this->nodes.push_back(node {EXPR_TERM, 1, 0, term});
+        }
+
+        /**
+         * Opens an operator at position pos, whose sub-expressions are the nodes from pos to the end, and the ones
+         * appended until it is closed
+         */
+        void
+        open(std::size_t pos, Operator op) {
+            this->nodes.insert(this->nodes.begin() + pos, node {op, 0, 0, QueryExprTermView()});
+        }
+
+        void
+        close(std::size_t pos, uint32_t num_children) {
+            this->nodes[pos].size = static_cast<uint32_t>(this->nodes.size() - pos);
+            this->nodes[pos].num_children = num_children;
+        }
+
+        /**
+         * Removes all the nodes from the expression, leaving it empty
+         */
+        void
+        clear() {
+            this->nodes.clear();
+        }
+
+    private:
+        std::vector<node> nodes;
+    };
+}
+
+/**
+ * Write on the output stream os the sub-expression of ref rooted in the node pos
+ */
+void
+write_bool_expression(std::ostream &os, const query::QueryExprBool &ref, std::size_t pos) {
+    const query::QueryExprBool::node &n = ref[pos];
+    switch (n.op) {
+        case query::QueryExprBool::EXPR_TERM:
+            os << n.term;
+            break;
+        case query::QueryExprBool::EXPR_NOT:
+            os << '-';
+            write_bool_expression(os, ref, pos + 1);
+            break;
+        default:
+            os << '(';
+            for (std::size_t i = 0, child = pos + 1; i < n.num_children; ++i, child += ref[child].size) {
+                if (i > 0) {
+                    os << (n.op == query::QueryExprBool::EXPR_OR ? " | " : " ");
+                }
+                write_bool_expression(os, ref, child);
+            }
+            os << ')';
+            break;
+    }
+}
+
+/**
+ * Write on the output stream os the boolean expression ref
+ * @param os The std::ostream to use
+ * @param ref The QueryExprBool to write
+ * @return The input std::ostream
+ */
+std::ostream &
+operator<<(std::ostream &os, const query::QueryExprBool &ref) {
+    if (ref.size() > 0) {
+        write_bool_expression(os, ref, 0);
+    }
+    return os;
+}
+
+#endif //INDEX_PARTITIONING_QUERY_EXPR_BOOL_HPP
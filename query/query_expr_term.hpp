@@ -3,6 +3,7 @@
 
 #include <ostream>
 #include <string>
+#include <utility>
 
 
 namespace query {
@@ -11,6 +12,8 @@ namespace query {
      */
     class QueryExprTerm {
     public:
+        typedef std::string lexeme_type;
+
         /**
          * The term lexeme
          */
@@ -39,9 +42,9 @@ namespace query {
          * Create a new QETerm_c moving the given one inside it
          * @param other The term to move inside the built one
          */
-        QueryExprTerm(QueryExprTerm &&other) {
-            this->operator=(std::move(other));
-        }
+        QueryExprTerm(QueryExprTerm &&other) noexcept
+                : lexeme(std::move(other.lexeme)),
+                  queryPos(other.queryPos) {}
 
         /**
          * Create a new QETerm_c with the specified weight and representing the given query position
@@ -60,7 +63,7 @@ namespace query {
          * @param queryPos The position of the term inside the query
          */
         QueryExprTerm(std::string &&lexeme, unsigned short queryPos)
-                : lexeme(lexeme),
+                : lexeme(std::move(lexeme)),
                   queryPos(queryPos) {}
 
         /**
@@ -81,8 +84,18 @@ namespace query {
          * @return The current term
          */
         QueryExprTerm &
-        operator=(QueryExprTerm &&other) {
-            return *this = other;
+        operator=(QueryExprTerm &&other) noexcept {
+            this->lexeme = std::move(other.lexeme);
+            this->queryPos = other.queryPos;
+            return *this;
+        }
+
+        /**
+         * @return The number of terms of the expression, used by the enclosing ones
+         */
+        std::size_t
+        getTermsNumber() const {
+            return 1;
         }
     };
 }
@@ -0,0 +1,112 @@
+#ifndef INDEX_PARTITIONING_QUERY_EXPR_TERM_VIEW_HPP
+#define INDEX_PARTITIONING_QUERY_EXPR_TERM_VIEW_HPP
+
+#include <cstring>
+#include <ostream>
+#include <string>
+
+
+namespace query {
+    /**
+     * A lexeme referencing the characters of the parsed string, or of a QueryArena, without owning them
+     */
+    class QueryLexeme {
+    public:
+        QueryLexeme()
+                : ptr(nullptr),
+                  length(0) {}
+
+        QueryLexeme(const char *ptr, std::size_t length)
+                : ptr(ptr),
+                  length(length) {}
+
+        const char *
+        data() const {
+            return this->ptr;
+        }
+
+        std::size_t
+        size() const {
+            return this->length;
+        }
+
+        /**
+         * @return A copy of the lexeme
+         */
+        std::string
+        str() const {
+            return std::string(this->ptr, this->length);
+        }
+
+        bool
+        operator==(const QueryLexeme &other) const {
+            return this->length == other.length && std::memcmp(this->ptr, other.ptr, this->length) == 0;
+        }
+
+    private:
+        const char *ptr;
+        std::size_t length;
+    };
+
+
+    /**
+     * Query Term whose lexeme is a view of the parsed string, built by QueryStaticParser::parse with a QueryArena.
+     * It is valid as long as the parsed string and the arena are.
+     */
+    class QueryExprTermView {
+    public:
+        typedef QueryLexeme lexeme_type;
+
+        /**
+         * The term lexeme
+         */
+        QueryLexeme lexeme;
+
+        /**
+         * The position of the term inside the query
+         */
+        unsigned short queryPos;
+
+    public:
+        QueryExprTermView()
+                : queryPos(0) {}
+
+        QueryExprTermView(QueryLexeme lexeme, unsigned short queryPos)
+                : lexeme(lexeme),
+                  queryPos(queryPos) {}
+
+        /**
+         * @return The number of terms of the expression, used by the enclosing ones
+         */
+        std::size_t
+        getTermsNumber() const {
+            return 1;
+        }
+    };
+}
+
+/**
+ * Write on the output stream os the lexeme ref
+ */
+std::ostream &
+operator<<(std::ostream &os, const query::QueryLexeme &ref) {
+    return os.write(ref.data(), static_cast<std::streamsize>(ref.size()));
+}
+
+/**
+ * Write on the output stream os the term ref
+ * @param os The std::ostream to use
+ * @param ref The QueryExprTermView to write
+ * @return The input std::ostream
+ */
+std::ostream &
+operator<<(std::ostream &os, const query::QueryExprTermView &ref) {
+    if (std::memchr(ref.lexeme.data(), ' ', ref.lexeme.size()) != nullptr) {
+        return os << '"' << ref.lexeme << '"';
+    } else {
+        return os << ref.lexeme;
+    }
+}
+
+
+#endif //INDEX_PARTITIONING_QUERY_EXPR_TERM_VIEW_HPP
@@ -109,6 +109,8 @@ namespace query {
                     return this->eCurToken = TOK_SPACE;
                 case '"':
                     return this->eCurToken = TOK_DOUBLE_QUOTE;
+                case '-':
+                    return this->eCurToken = TOK_NOT;
                 default:
                     break;
             }
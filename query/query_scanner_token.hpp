@@ -13,6 +13,7 @@ namespace query {
         TOK_SPACE,
         TOK_OR,
         TOK_DOUBLE_QUOTE,
+        TOK_NOT,
         TOK_UNDEFINED,
         TOK_END
     };
@@ -37,6 +38,8 @@ namespace query {
                 return "OR";
             case TOK_DOUBLE_QUOTE:
                 return "DOUBLE_QUOTE";
+            case TOK_NOT:
+                return "NOT";
             case TOK_UNDEFINED:
                 return "UNDEFINED";
             case TOK_END:
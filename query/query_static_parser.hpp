@@ -1,12 +1,17 @@
 #ifndef INDEX_PARTITIONING_QUERY_STATIC_PARSER_HPP
 #define INDEX_PARTITIONING_QUERY_STATIC_PARSER_HPP
 
+#include <cstring>
 #include <sstream>
 #include <string>
+#include <vector>
 
+#include "query_arena.hpp"
 #include "query_expr_and.hpp"
+#include "query_expr_bool.hpp"
 #include "query_expr_or.hpp"
 #include "query_expr_term.hpp"
+#include "query_expr_term_view.hpp"
 #include "query_parser_exception.hpp"
 #include "query_scanner.hpp"
 #include "query_scanner_token.hpp"
@@ -38,15 +43,74 @@ namespace query {
         static
         T
         parse(const char *str) {
+            return QueryStaticParser::parse_with<T>(str, nullptr);
+        }
+
+        /**
+         * Parses the given string into an expression of QueryExprTermView, whose lexemes reference str without copying
+         * it. The phrases that are not a contiguous part of str are stored in arena.
+         * @param str The string to parse, it must outlive the returned expression
+         * @param arena The storage of the phrases, it must outlive the returned expression
+         * @throws QueryParserException If the string cannot be generated by the grammar used by this parser
+         */
+        template<typename T>
+        static
+        T
+        parse(const std::string &str, QueryArena &arena) {
+            return QueryStaticParser::parse_with<T>(str.c_str(), &arena);
+        }
+
+        template<typename T>
+        static
+        T
+        parse(const char *str, QueryArena &arena) {
+            return QueryStaticParser::parse_with<T>(str, &arena);
+        }
+
+        /**
+         * Scans the given string with the grammar of the expression T, e.g., QueryExprAND<QueryExprOR<QueryExprTermView>>,
+         * without building the expression: handler.term(const QueryLexeme &) is called for every term, in order, and
+         * handler.end_group() at the end of every expression made of terms, i.e., of a flat query or of every OR group
+         * of a cnf query. The lexemes are valid as long as str and arena are.
+         * @throws QueryParserException If the string cannot be generated by the grammar used by this parser
+         */
+        template<typename T, typename Handler>
+        static
+        void
+        scan(const char *str, QueryArena &arena, Handler &handler) {
+            QueryScanner scanner = QueryScanner(str);
+            unsigned short number_tokens = 0;
+            QueryStaticParser::run(scanner, [&scanner, &number_tokens, &arena, &handler]() {
+                QueryStaticParser::scan_impl(scanner, &number_tokens, arena, handler, static_cast<const T *>(nullptr));
+            });
+        }
+
+    private:
+        template<typename T>
+        static
+        T
+        parse_with(const char *str, QueryArena *arena) {
             QueryScanner scanner = QueryScanner(str);
             unsigned short number_tokens = 0;
+            T result;
+            QueryStaticParser::run(scanner, [&scanner, &number_tokens, arena, &result]() {
+                QueryStaticParser::parse_impl(scanner, &number_tokens, arena, result);
+            });
+            return result;
+        }
 
+        /**
+         * Runs the production fn on the whole string, reporting the position of its errors
+         * @throws QueryParserException If the string cannot be generated by the grammar used by this parser
+         */
+        template<typename Function>
+        static
+        void
+        run(QueryScanner &scanner, Function fn) {
             try {
                 scanner.getNextToken();
-                T result;
-                QueryStaticParser::parse_impl(scanner, &number_tokens, result);
+                fn();
                 QueryStaticParser::checkCurrentToken(scanner, {TOK_END});
-                return std::move(result);
             } catch (const QueryParserException &e) {
                 throw e;
             } catch (const std::exception &e) {
@@ -58,7 +122,6 @@ namespace query {
             }
         }
 
-    private:
         /*
         template<typename T>
         static
@@ -74,25 +137,32 @@ namespace query {
         template<typename T>
         static
         void
-        parse_impl(QueryScanner &scanner, unsigned short *number_tokens, QueryExprAND<T> & result) {
+        parse_impl(QueryScanner &scanner, unsigned short *number_tokens, QueryArena *arena, QueryExprAND<T> & result) {
             /// QueryExprAND ::= TOK_L_BRACKET T ( T )* TOK_R_BRACKET
 
             T sub_result;
-            result.clear();
+            std::vector<T> &sub_results = QueryStaticParser::scratch<T>();
+            sub_results.clear();
 
             QueryStaticParser::checkCurrentToken(scanner, {TOK_L_BRACKET});
             scanner.getNextToken();
-            QueryStaticParser::parse_impl(scanner, number_tokens, sub_result);
-            result &= sub_result;
+            QueryStaticParser::parse_impl(scanner, number_tokens, arena, sub_result);
+            sub_results.push_back(std::move(sub_result));
 
             // I try to extend this production on the right with other AndExpr(s)
             while (scanner.getCurrentToken() != TOK_R_BRACKET) {
-                QueryStaticParser::parse_impl(scanner, number_tokens, sub_result);
-                result &= sub_result;
+                QueryStaticParser::parse_impl(scanner, number_tokens, arena, sub_result);
+                sub_results.push_back(std::move(sub_result));
             }
 
             QueryStaticParser::checkCurrentToken(scanner, {TOK_R_BRACKET});
             scanner.getNextToken();
+
+            result.clear();
+            result.reserve(sub_results.size());
+            for (T &value: sub_results) {
+                result &= std::move(value);
+            }
         }
 
         /**
@@ -103,29 +173,36 @@ namespace query {
         template<typename T>
         static
         void
-        parse_impl(QueryScanner &scanner, unsigned short *number_tokens, QueryExprOR<T> & result) {
+        parse_impl(QueryScanner &scanner, unsigned short *number_tokens, QueryArena *arena, QueryExprOR<T> & result) {
             /// QueryExprOR ::= TOK_L_BRACKET T ( TOK_OR T )* TOK_R_BRACKET
 
             T sub_result;
-            result.clear();
+            std::vector<T> &sub_results = QueryStaticParser::scratch<T>();
+            sub_results.clear();
 
             QueryStaticParser::checkCurrentToken(scanner, {TOK_L_BRACKET});
             scanner.getNextToken();
 
-            QueryStaticParser::parse_impl(scanner, number_tokens, sub_result);
-            result |= sub_result;
+            QueryStaticParser::parse_impl(scanner, number_tokens, arena, sub_result);
+            sub_results.push_back(std::move(sub_result));
 
             // I try to extend this production on the right with other AndExpr(s)
             while (scanner.getCurrentToken() != TOK_R_BRACKET) {
                 QueryStaticParser::checkCurrentToken(scanner, {TOK_OR});
                 scanner.getNextToken();
 
-                QueryStaticParser::parse_impl(scanner, number_tokens, sub_result);
-                result |= sub_result;
+                QueryStaticParser::parse_impl(scanner, number_tokens, arena, sub_result);
+                sub_results.push_back(std::move(sub_result));
             }
 
             QueryStaticParser::checkCurrentToken(scanner, {TOK_R_BRACKET});
             scanner.getNextToken();
+
+            result.clear();
+            result.reserve(sub_results.size());
+            for (T &value: sub_results) {
+                result |= std::move(value);
+            }
         }
 
         /**
@@ -135,32 +212,101 @@ namespace query {
          */
         static
         void
-        parse_impl(QueryScanner &scanner, unsigned short *number_tokens, QueryExprTerm & result) {
+        parse_impl(QueryScanner &scanner, unsigned short *number_tokens, QueryArena *, QueryExprTerm & result) {
             /// QueryExprTerm ::= TOK_TERM | TOK_DOUBLE_QUOTE ( TOK_TERM )* TOK_DOUBLE_QUOTE
 
             switch (scanner.getCurrentToken()) {
                 case TOK_DOUBLE_QUOTE:
                     scanner.getNextToken();
                     {
-                        std::stringstream ss;
-                        bool add_space = false;
+                        std::string phrase;
                         while (scanner.getCurrentToken() != TOK_DOUBLE_QUOTE) {
                             QueryStaticParser::checkCurrentToken(scanner, {TOK_TERM});
-                            if (add_space)
-                                ss << " ";
-                            ss << std::string(scanner.uLexVal.str_ptr, scanner.uLexVal.str_size);
+                            if (!phrase.empty())
+                                phrase += ' ';
+                            phrase.append(scanner.uLexVal.str_ptr, scanner.uLexVal.str_size);
                             scanner.getNextToken();
-                            add_space = true;
                         }
                         QueryStaticParser::checkCurrentToken(scanner, {TOK_DOUBLE_QUOTE});
                         scanner.getNextToken();
 
-                        result = QueryExprTerm(ss.str(), (*number_tokens)++);
+                        result = QueryExprTerm(std::move(phrase), (*number_tokens)++);
+                    }
+                break;
+
+                case TOK_TERM:
+                    result.lexeme.assign(scanner.uLexVal.str_ptr, scanner.uLexVal.str_size);
+                    result.queryPos = (*number_tokens)++;
+                    scanner.getNextToken();
+                break;
+
+                default:
+                    throw QueryStaticParser::getCustomError(scanner, {TOK_DOUBLE_QUOTE, TOK_TERM});
+            }
+        }
+
+        /**
+         * Parses the production: QueryExprTerm ::= TOK_TERM | TOK_DOUBLE_QUOTE TOK_TERM ( TOK_TERM )* TOK_DOUBLE_QUOTE
+         * without copying the lexeme: a term, or a phrase whose words are separated by single spaces, references the
+         * parsed string, any other phrase is stored in the arena
+         * @throws QueryParserException If the production cannot be applied
+         */
+        static
+        void
+        parse_impl(QueryScanner &scanner, unsigned short *number_tokens, QueryArena *arena, QueryExprTermView & result) {
+            /// QueryExprTerm ::= TOK_TERM | TOK_DOUBLE_QUOTE ( TOK_TERM )* TOK_DOUBLE_QUOTE
+
+            switch (scanner.getCurrentToken()) {
+                case TOK_DOUBLE_QUOTE:
+                    scanner.getNextToken();
+                    {
+                        const char *begin = nullptr;
+                        const char *end = nullptr;
+                        std::size_t num_words = 0;
+                        std::size_t words_size = 0;
+                        bool contiguous = true;
+                        QueryScanner words_scanner = scanner; // scans the words again when they are copied
+                        while (scanner.getCurrentToken() != TOK_DOUBLE_QUOTE) {
+                            QueryStaticParser::checkCurrentToken(scanner, {TOK_TERM});
+                            if (num_words == 0) {
+                                begin = scanner.uLexVal.str_ptr;
+                            } else if (scanner.uLexVal.str_ptr != end + 1) {
+                                contiguous = false;
+                            }
+                            end = scanner.uLexVal.str_ptr + scanner.uLexVal.str_size;
+                            words_size += scanner.uLexVal.str_size;
+                            ++num_words;
+                            scanner.getNextToken();
+                        }
+                        QueryStaticParser::checkCurrentToken(scanner, {TOK_DOUBLE_QUOTE});
+
+                        if (num_words == 0) {
+                            result = QueryExprTermView(QueryLexeme("", 0), (*number_tokens)++);
+                        } else if (contiguous) {
+                            result = QueryExprTermView(QueryLexeme(begin, static_cast<std::size_t>(end - begin)), (*number_tokens)++);
+                        } else {
+                            if (arena == nullptr) {
+                                throw QueryParserException("The phrase in position " + std::to_string(scanner.getCurrentPosition())
+                                                           + " cannot be referenced, a QueryArena is required");
+                            }
+                            const std::size_t size = words_size + num_words - 1;
+                            char *phrase = arena->allocate(size);
+                            char *out = phrase;
+                            for (std::size_t i = 0; i < num_words; ++i) {
+                                if (i > 0)
+                                    *out++ = ' ';
+                                std::memcpy(out, words_scanner.uLexVal.str_ptr, words_scanner.uLexVal.str_size);
+                                out += words_scanner.uLexVal.str_size;
+                                words_scanner.getNextToken();
+                            }
+                            result = QueryExprTermView(QueryLexeme(phrase, size), (*number_tokens)++);
+                        }
+                        scanner.getNextToken();
                     }
                 break;
 
                 case TOK_TERM:
-                    result = QueryExprTerm(std::string(scanner.uLexVal.str_ptr, scanner.uLexVal.str_size), (*number_tokens)++);
+                    result = QueryExprTermView(QueryLexeme(scanner.uLexVal.str_ptr, scanner.uLexVal.str_size), (*number_tokens)++);
                     scanner.getNextToken();
                 break;
 
@@ -169,7 +315,216 @@ namespace query {
             }
         }
 
+        /**
+         * Parses the production of the boolean expressions, where the AND binds tighter than the OR:
+         *   QueryExprBool ::= Or
+         *   Or ::= And ( TOK_OR And )*
+         *   And ::= Unary ( Unary )*
+         *   Unary ::= TOK_NOT Unary | TOK_L_BRACKET Or TOK_R_BRACKET | QueryExprTerm
+         * A negated expression must be an operand of an AND having a non-negated one, since the documents not
+         * matching an expression cannot be enumerated
+         * @throws QueryParserException If the production cannot be applied
+         */
+        static
+        void
+        parse_impl(QueryScanner &scanner, unsigned short *number_tokens, QueryArena *arena, QueryExprBool & result) {
+            result.clear();
+            if (QueryStaticParser::parse_bool_or(scanner, number_tokens, arena, result, 0)) {
+                throw QueryStaticParser::getNegationError(scanner);
+            }
+        }
+
+        /**
+         * Parses the production: Or ::= And ( TOK_OR And )*
+         * @return True if the parsed expression is negated
+         */
+        static
+        bool
+        parse_bool_or(QueryScanner &scanner, unsigned short *number_tokens, QueryArena *arena, QueryExprBool & result, unsigned int depth) {
+            const std::size_t pos = result.size();
+            bool negated = QueryStaticParser::parse_bool_and(scanner, number_tokens, arena, result, depth);
+            uint32_t num_children = 1;
+
+            while (scanner.getCurrentToken() == TOK_OR) {
+                if (num_children == 1) {
+                    result.open(pos, QueryExprBool::EXPR_OR);
+                }
+                scanner.getNextToken();
+                negated |= QueryStaticParser::parse_bool_and(scanner, number_tokens, arena, result, depth);
+                ++num_children;
+            }
+
+            if (num_children == 1) {
+                return negated;
+            }
+            if (negated) {
+                throw QueryStaticParser::getNegationError(scanner);
+            }
+            result.close(pos, num_children);
+            return false;
+        }
+
+        /**
+         * Parses the production: And ::= Unary ( Unary )*
+         * @return True if the parsed expression is negated
+         */
+        static
+        bool
+        parse_bool_and(QueryScanner &scanner, unsigned short *number_tokens, QueryArena *arena, QueryExprBool & result, unsigned int depth) {
+            const std::size_t pos = result.size();
+            const bool negated = QueryStaticParser::parse_bool_unary(scanner, number_tokens, arena, result, depth);
+            bool has_positive = !negated;
+            uint32_t num_children = 1;
+
+            for (QueryScannerToken token = scanner.getCurrentToken();
+                 token == TOK_NOT || token == TOK_L_BRACKET || token == TOK_TERM || token == TOK_DOUBLE_QUOTE;
+                 token = scanner.getCurrentToken()) {
+                if (num_children == 1) {
+                    result.open(pos, QueryExprBool::EXPR_AND);
+                }
+                has_positive |= !QueryStaticParser::parse_bool_unary(scanner, number_tokens, arena, result, depth);
+                ++num_children;
+            }
+
+            if (num_children == 1) {
+                return negated;
+            }
+            if (!has_positive) {
+                throw QueryStaticParser::getNegationError(scanner);
+            }
+            result.close(pos, num_children);
+            return false;
+        }
+
+        /**
+         * Parses the production: Unary ::= TOK_NOT Unary | TOK_L_BRACKET Or TOK_R_BRACKET | QueryExprTerm
+         * @return True if the parsed expression is negated, i.e., it has an odd number of TOK_NOT
+         */
+        static
+        bool
+        parse_bool_unary(QueryScanner &scanner, unsigned short *number_tokens, QueryArena *arena, QueryExprBool & result, unsigned int depth) {
+            if (depth >= QueryStaticParser::max_bool_depth) {
+                throw QueryParserException("The expression in position " + std::to_string(scanner.getCurrentPosition())
+                                           + " is nested too deeply");
+            }
+
+            switch (scanner.getCurrentToken()) {
+                case TOK_NOT: {
+                    const std::size_t pos = result.size();
+                    scanner.getNextToken();
+                    const bool negated = QueryStaticParser::parse_bool_unary(scanner, number_tokens, arena, result, depth + 1);
+                    result.open(pos, QueryExprBool::EXPR_NOT);
+                    result.close(pos, 1);
+                    return !negated;
+                }
+
+                case TOK_L_BRACKET: {
+                    scanner.getNextToken();
+                    const bool negated = QueryStaticParser::parse_bool_or(scanner, number_tokens, arena, result, depth + 1);
+                    QueryStaticParser::checkCurrentToken(scanner, {TOK_R_BRACKET});
+                    scanner.getNextToken();
+                    return negated;
+                }
+
+                default: {
+                    QueryStaticParser::checkCurrentToken(scanner, {TOK_NOT, TOK_L_BRACKET, TOK_DOUBLE_QUOTE, TOK_TERM});
+                    QueryExprTermView term;
+                    QueryStaticParser::parse_impl(scanner, number_tokens, arena, term);
+                    result.push_term(term);
+                    return false;
+                }
+            }
+        }
+
+        /**
+         * Scans the production: QueryExprAND ::= TOK_L_BRACKET T ( T )* TOK_R_BRACKET, see parse_impl
+         */
+        template<typename T, typename Handler>
+        static
+        void
+        scan_impl(QueryScanner &scanner, unsigned short *number_tokens, QueryArena &arena, Handler &handler, const QueryExprAND<T> *) {
+            QueryStaticParser::checkCurrentToken(scanner, {TOK_L_BRACKET});
+            scanner.getNextToken();
+            QueryStaticParser::scan_impl(scanner, number_tokens, arena, handler, static_cast<const T *>(nullptr));
+
+            while (scanner.getCurrentToken() != TOK_R_BRACKET) {
+                QueryStaticParser::scan_impl(scanner, number_tokens, arena, handler, static_cast<const T *>(nullptr));
+            }
+
+            QueryStaticParser::checkCurrentToken(scanner, {TOK_R_BRACKET});
+            scanner.getNextToken();
+            QueryStaticParser::end_sub_expressions(handler, static_cast<const T *>(nullptr));
+        }
+
+        /**
+         * Scans the production: QueryExprOR ::= TOK_L_BRACKET T ( TOK_OR T )* TOK_R_BRACKET, see parse_impl
+         */
+        template<typename T, typename Handler>
+        static
+        void
+        scan_impl(QueryScanner &scanner, unsigned short *number_tokens, QueryArena &arena, Handler &handler, const QueryExprOR<T> *) {
+            QueryStaticParser::checkCurrentToken(scanner, {TOK_L_BRACKET});
+            scanner.getNextToken();
+            QueryStaticParser::scan_impl(scanner, number_tokens, arena, handler, static_cast<const T *>(nullptr));
+
+            while (scanner.getCurrentToken() != TOK_R_BRACKET) {
+                QueryStaticParser::checkCurrentToken(scanner, {TOK_OR});
+                scanner.getNextToken();
+                QueryStaticParser::scan_impl(scanner, number_tokens, arena, handler, static_cast<const T *>(nullptr));
+            }
+
+            QueryStaticParser::checkCurrentToken(scanner, {TOK_R_BRACKET});
+            scanner.getNextToken();
+            QueryStaticParser::end_sub_expressions(handler, static_cast<const T *>(nullptr));
+        }
+
+        /**
+         * Scans the production: QueryExprTerm ::= TOK_TERM | TOK_DOUBLE_QUOTE TOK_TERM ( TOK_TERM )* TOK_DOUBLE_QUOTE
+         */
+        template<typename Handler>
+        static
+        void
+        scan_impl(QueryScanner &scanner, unsigned short *number_tokens, QueryArena &arena, Handler &handler, const QueryExprTermView *) {
+            QueryExprTermView term;
+            QueryStaticParser::parse_impl(scanner, number_tokens, &arena, term);
+            handler.term(term.lexeme);
+        }
+
+        /**
+         * Ends a group, when the sub-expressions of the scanned expression are terms
+         */
+        template<typename Handler>
+        static
+        void
+        end_sub_expressions(Handler &handler, const QueryExprTermView *) {
+            handler.end_group();
+        }
+
+        template<typename T, typename Handler>
+        static
+        void
+        end_sub_expressions(Handler &, const T *) {}
+
     private:
+        /**
+         * The sub-expressions of type T parsed so far, reused by the following queries of the thread so that the
+         * parsed expressions are allocated once, with their final size. The grammar does not nest an expression into
+         * another one of the same type, thus a type has one list being filled at a time.
+         */
+        template<typename T>
+        static
+        std::vector<T> &
+        scratch() {
+            static thread_local std::vector<T> sub_results;
+            return sub_results;
+        }
+
+        /**
+         * The maximum nesting of the brackets and of the TOK_NOT of a boolean expression, which are parsed, and then
+         * evaluated, recursively
+         */
+        static const unsigned int max_bool_depth = 64;
+
         /**
          * Check if the current token is among the expected ones and if it isn't throws an exception.
          * @throws QueryParserException If the current token is not among the expected ones
@@ -195,6 +550,16 @@ namespace query {
             return std::move(getCustomError(scanner, {}));
         }
 
+        /**
+         * Gets the error of a negated expression that is not an operand of an AND having a non-negated one
+         */
+        static
+        QueryParserException
+        getNegationError(QueryScanner &scanner) {
+            return QueryParserException("The negated expression before position " + std::to_string(scanner.getCurrentPosition())
+                                        + " must be an operand of an AND having a non-negated one");
+        }
+
         /**
          * Gets an error message with informations about the context and including what token we expected
          */
@@ -1,9 +1,17 @@
 #include <iostream>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
 #include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/iostreams/stream.hpp>
 
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
+#include <boost/asio/signal_set.hpp>
 #include <boost/thread/thread.hpp>
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -13,8 +21,25 @@
 #include "../ds2i/bm25.hpp"
 //#include "../queries.hpp"
 
+#include "query_server/admission_control.hpp"
+#include "query_server/async_server.hpp"
+#include "query_server/binary_protocol.hpp"
+#include "query_server/docid_map.hpp"
+#include "query_server/json_protocol.hpp"
+#include "query_server/hot_lists.hpp"
+#include "query_server/list_prefetcher.hpp"
+#include "query_server/load_progress.hpp"
+#include "query_server/memory_placement.hpp"
+#include "query_server/plan_cache.hpp"
 #include "query_server/socket.hpp"
+#include "query_server/query_server_options.hpp"
+#include "query_server/query_request.hpp"
 #include "query_server/query_server_utils.hpp"
+#include "query_server/reply_merge.hpp"
+#include "query_server/result_cache.hpp"
+#include "query_server/segment_filter.hpp"
+#include "query_server/snapshot_registry.hpp"
+#include "query_server/thread_pool.hpp"
 #include "query/query_static_parser.hpp"
 #include "query/query_evaluation.hpp"
 
@@ -24,18 +49,27 @@
 namespace pt = boost::property_tree;
 
 
+/**
+ * Evaluates a query twice: the first run fills the results, the second one, without rel, measures exe_time.
+ * The second run may be stopped by the deadline too, but it does not change the results of the first one.
+ * @param ranked_results Optional, the one filled by query_op
+ * @param timed_out Filled with true if the first run has been stopped by the deadline
+ */
 template <typename QueryOperator, typename IndexType, typename ScorerType, typename QueryType>
 void
 op_perf_evaluation(
         IndexType const& index,
-        ds2i::wand_data<ScorerType> * wdata,
+        const ds2i::wand_data<ScorerType> * wdata,
         QueryOperator&& query_op, // XXX!!!
         QueryType & query,
         std::vector<uint64_t> &rel,
         uint64_t * num_ret,
         uint64_t * num_rel_ret,
         unsigned int ranked_at,
-        double * exe_time
+        double * exe_time,
+        const query::QueryDeadline * deadline, // optional, the one used by query_op
+        query::RankedResults * ranked_results,
+        bool * timed_out
 ) {
     uint64_t results;
     if (ranked_at > 0 && wdata == nullptr) {
@@ -43,199 +77,1204 @@ op_perf_evaluation(
     }
 
     // warm up
+    auto tick = ds2i::get_time_usecs();
     if (ranked_at > 0) {
         results = query_op(index, *wdata, query, rel, num_rel_ret, ranked_at);
     } else {
         results = query_op(index, query, rel, num_rel_ret);
     }
+    double elapsed = double(ds2i::get_time_usecs() - tick);
+    *timed_out = deadline != nullptr && deadline->is_timed_out();
 
-    // second run without rel
-    auto tick = ds2i::get_time_usecs();
-    if (ranked_at > 0) {
-        query_op(index, *wdata, query, ranked_at);
-    } else {
-        query_op(index, query);
+    // second run without rel, skipped when the first one has been stopped by the deadline
+    if (!*timed_out) {
+        // the ranked results of the first run are kept aside, the second one overwrites them
+        query::RankedResults first_results;
+        if (ranked_results != nullptr) {
+            std::swap(first_results, *ranked_results);
+        }
+        tick = ds2i::get_time_usecs();
+        if (ranked_at > 0) {
+            query_op(index, *wdata, query, ranked_at);
+        } else {
+            query_op(index, query);
+        }
+        // a second run stopped by the deadline is shorter than the evaluation, the first run is timed instead
+        if (deadline == nullptr || !deadline->is_timed_out()) {
+            elapsed = double(ds2i::get_time_usecs() - tick);
+        }
+        if (ranked_results != nullptr) {
+            *ranked_results = std::move(first_results);
+        }
     }
-    double elapsed = double(ds2i::get_time_usecs() - tick);
 
     *num_ret = results;
     *exe_time = elapsed/1000.0;
 }
 
 
+/**
+ * The index and its wand data read by the workers of one NUMA node, either mapped from their files or copied to the
+ * memory of the node (see MemoryPlacement)
+ */
 template <typename IndexType, typename ScorerType>
-void handle_request(
-        const pt::ptree &request,
-        pt::ptree &reply,
-        const std::unordered_map<std::string, unsigned int> * segment_to_termid_map,
-        const std::unordered_map<std::size_t, uint64_t> * docid_to_new_docid,
-        IndexType * index,
-        ds2i::wand_data<ScorerType> * wdata // optional
+struct index_replica {
+    std::unique_ptr<query_server::PlacedBuffer> index_copy; // nullptr when the index is mapped from its file
+    IndexType index;
+    std::unique_ptr<query_server::PlacedBuffer> wand_data_copy;
+    ds2i::wand_data<ScorerType> wand_data;
+    const ds2i::wand_data<ScorerType> * wdata; // optional, points to wand_data when the file exists
+
+    index_replica()
+            : wdata(nullptr) {}
+    index_replica(const index_replica &) = delete;
+    index_replica & operator=(const index_replica &) = delete;
+};
+
+
+/**
+ * The index with its maps, loaded from one basename and never modified.
+ * It is a shard of the served index, replaced as a whole by a reload, while the requests using it keep it alive.
+ */
+template <typename IndexType, typename ScorerType>
+struct index_snapshot {
+    typedef index_replica<IndexType, ScorerType> replica_type;
+
+    std::string basename;
+    query_server::Lexicon lexicon;
+    query_server::SegmentFilter missing_filter; // the segments left out of the index
+    query_server::DocidMap docid_map;
+    boost::iostreams::mapped_file_source index_file_source; // closed when the index is copied
+    boost::iostreams::mapped_file_source wand_data_source;
+    std::vector<std::unique_ptr<replica_type>> replicas; // one per NUMA node holding a copy, at least one
+    mutable query_server::ResidentLists resident_lists; // the lists read by the prefetches, out-of-core serving only
+    mutable query_server::TermCounters term_counters; // the uses of the terms, when the hot lists are locked
+    mutable query_server::HotListLock<IndexType> hot_lists; // the lists of the terms used most, locked in memory
+    mutable query_server::PlanCache plan_cache; // the plans of the last query strings, valid for this index only
+
+    index_snapshot() = default;
+    index_snapshot(const index_snapshot &) = delete;
+    index_snapshot & operator=(const index_snapshot &) = delete;
+
+    /**
+     * @return The replica with the given id, the first one if it does not exist
+     */
+    const replica_type & replica(std::size_t replica_id) const {
+        return *this->replicas[replica_id < this->replicas.size() ? replica_id : 0];
+    }
+};
+
+
+/**
+ * Loads a file of the index into every replica, mapping it when the placement does not copy the files, otherwise
+ * copying it on the node of each replica, e.g., to huge pages
+ * @param warmup False to leave the mapped file on disk, e.g., when it is larger than the memory
+ * @param map_replica Called with a replica, the copy of the file for it (nullptr if none) and the data to map
+ */
+template <typename Replica, typename MapReplica>
+void load_replicated_file(
+        const std::string & file_path,
+        boost::iostreams::mapped_file_source & file_source,
+        const std::vector<std::unique_ptr<Replica>> & replicas,
+        const query_server::MemoryPlacement & placement,
+        query_server::StagedLoader & loader,
+        std::size_t stage_id,
+        bool warmup,
+        MapReplica map_replica
+) {
+    file_source.open(file_path);
+    if (!placement.copies_files()) {
+        // the warmup of map_flags::warmup is replaced by the parallel one
+        map_replica(*replicas[0], std::unique_ptr<query_server::PlacedBuffer>(), file_source.data());
+        if (warmup) {
+            loader.warmup(stage_id, file_source.data(), file_source.size());
+        }
+        return;
+    }
+
+    // the copy warms up the pages, it is written by threads running on the node of the replica
+    loader.set_total(stage_id, file_source.size() * replicas.size());
+    for (std::size_t r = 0; r < replicas.size(); ++r) {
+        placement.run_on_replica_node(r, [&]() {
+            std::unique_ptr<query_server::PlacedBuffer> copy(new query_server::PlacedBuffer(file_source.size(), placement.huge_pages()));
+            loader.copy(stage_id, copy->data(), file_source.data(), file_source.size());
+            const char * data = copy->data();
+            map_replica(*replicas[r], std::move(copy), data);
+        });
+    }
+    file_source.close();
+}
+
+
+/**
+ * Adds to loader the stages loading the index and its maps into snapshot, which are independent of each other.
+ * The mapped files are warmed up by all the threads of the loader, unless the index is served out of core.
+ * @param count_terms True to count the uses of the terms in the queries, to lock the lists of the most used ones
+ * @param plan_cache_size The number of query plans cached by the snapshot, 0 disables the cache
+ */
+template <typename IndexType, typename ScorerType>
+void add_index_snapshot_stages(
+        const std::string & index_type,
+        index_snapshot<IndexType, ScorerType> * snapshot,
+        const query_server::MemoryPlacement & placement,
+        bool out_of_core,
+        bool count_terms,
+        std::size_t plan_cache_size,
+        query_server::StagedLoader & loader
+) {
+    typedef index_replica<IndexType, ScorerType> replica_type;
+    const std::string index_basename = snapshot->basename;
+    for (std::size_t r = 0; r < placement.num_replicas(); ++r) {
+        snapshot->replicas.emplace_back(new replica_type());
+    }
+    snapshot->plan_cache.reset(plan_cache_size);
+
+    // loading the term map, the maps are mapped from their snapshots unless their sources have changed
+    loader.add(index_basename, "lexicon", [snapshot, index_basename, &placement](std::size_t) {
+        std::cerr << "Loading the term map from " << index_basename << ".terms" << std::endl;
+        snapshot->lexicon.load(index_basename + ".terms");
+        if (placement.huge_pages() != query_server::HUGE_PAGES_NONE) {
+            snapshot->lexicon.relocate(placement.huge_pages());
+        }
+    });
+    loader.add(index_basename, "missing_segments", [snapshot, index_basename](std::size_t) {
+        std::cerr << "Loading the missing segments from " << index_basename << ".mterms" << std::endl;
+        snapshot->missing_filter.load(index_basename + ".mterms");
+    });
+
+    // loading the doc map
+    loader.add(index_basename, "docid_map", [snapshot, index_basename](std::size_t) {
+        std::cerr << "Loading the doc map from " << index_basename << ".docids.map" << std::endl;
+        snapshot->docid_map.open(index_basename + ".docids.map");
+    });
+
+    // loading the index
+    loader.add(index_basename, "index", [snapshot, index_basename, index_type, &placement, out_of_core, count_terms, &loader](std::size_t stage_id) {
+        std::cerr << "Loading the index (type " << index_type << ") from " << index_basename << "." << index_type << std::endl;
+        load_replicated_file(
+                index_basename + "." + index_type, snapshot->index_file_source, snapshot->replicas, placement, loader, stage_id, !out_of_core,
+                [](replica_type & replica, std::unique_ptr<query_server::PlacedBuffer> copy, const char * data) {
+                    replica.index_copy = std::move(copy);
+                    succinct::mapper::map(replica.index, data);
+                }
+        );
+        if (out_of_core) {
+            snapshot->resident_lists.reset(snapshot->replicas[0]->index.size());
+        }
+        if (count_terms) {
+            snapshot->term_counters.reset(snapshot->replicas[0]->index.size());
+        }
+    });
+
+    std::string wand_data_filename = index_basename + ".wand";
+    if ( access( wand_data_filename.c_str(), F_OK ) != -1 ) { // it can also not exist
+        loader.add(index_basename, "wand_data", [snapshot, wand_data_filename, &placement, &loader](std::size_t stage_id) {
+            std::cerr << "Loading wand data from " << wand_data_filename << std::endl;
+            // the wand data is read by every ranked query, it is warmed up also out of core
+            load_replicated_file(
+                    wand_data_filename, snapshot->wand_data_source, snapshot->replicas, placement, loader, stage_id, true,
+                    [](replica_type & replica, std::unique_ptr<query_server::PlacedBuffer> copy, const char * data) {
+                        replica.wand_data_copy = std::move(copy);
+                        succinct::mapper::map(replica.wand_data, data);
+                        replica.wdata = &replica.wand_data;
+                    }
+            );
+        });
+    }
+}
+
+
+/**
+ * The docid-partitioned shards of the served index, loaded and replaced together.
+ * A single index is served as a sharded index with one shard.
+ */
+template <typename IndexType, typename ScorerType>
+struct sharded_index {
+    typedef index_snapshot<IndexType, ScorerType> shard_type;
+
+    std::string basenames; // comma-separated, in the order of the shards
+    std::vector<std::shared_ptr<const shard_type>> shards;
+    mutable query_server::ResultCache result_cache; // the results of the repeated requests, valid for this index only
+};
+
+
+/**
+ * Loads the shards listed in basenames, a comma-separated list of index basenames.
+ * The stages of all the shards run concurrently on num_threads threads and report their progress.
+ * @param result_cache_budget The bytes of the results cached by the index, 0 disables the cache
+ */
+template <typename IndexType, typename ScorerType>
+std::shared_ptr<const sharded_index<IndexType, ScorerType>> load_sharded_index(
+        const std::string & index_type,
+        const std::string & basenames,
+        unsigned int num_threads,
+        const query_server::MemoryPlacement & placement,
+        bool out_of_core,
+        bool count_terms,
+        std::size_t plan_cache_size,
+        uint64_t result_cache_budget,
+        query_server::LoadProgress & progress
+) {
+    std::shared_ptr<sharded_index<IndexType, ScorerType>> index(new sharded_index<IndexType, ScorerType>());
+    index->basenames = basenames;
+    index->result_cache.reset(result_cache_budget);
+
+    const std::vector<std::string> shard_basenames = query_server::split_list(basenames, ',');
+    progress.reset();
+    query_server::StagedLoader loader(progress, num_threads);
+    std::vector<std::shared_ptr<index_snapshot<IndexType, ScorerType>>> shards;
+    for (const std::string & shard_basename: shard_basenames) {
+        shards.emplace_back(new index_snapshot<IndexType, ScorerType>());
+        shards.back()->basename = shard_basename;
+        add_index_snapshot_stages<IndexType, ScorerType>(index_type, shards.back().get(), placement, out_of_core, count_terms, plan_cache_size, loader);
+    }
+
+    std::cerr << "Loading " << shard_basenames.size() << " shard(s) in " << loader.num_stages() << " stages on "
+              << num_threads << " threads" << std::endl;
+    loader.run();
+    for (const auto & shard: shards) {
+        index->shards.push_back(shard);
+    }
+
+    return index;
+}
+
+
+/**
+ * Data shared by all the connections and needed to answer the requests
+ */
+template <typename IndexType, typename ScorerType>
+struct server_context {
+    typedef sharded_index<IndexType, ScorerType> snapshot_type;
+
+    std::string index_type;
+    query_server::SnapshotRegistry<snapshot_type> * snapshots; // the index currently served, nullptr until loaded
+    query_server::LoadProgress * progress; // the stages of the last load of the index
+    unsigned int load_threads; // threads loading the index
+    const query_server::MemoryPlacement * placement; // the pages and the NUMA nodes of the index
+    query_server::ListPrefetcher * prefetcher; // out-of-core serving only, nullptr otherwise
+    uint64_t lock_budget; // bytes of the posting lists locked in memory, 0 when they are not locked
+    std::size_t plan_cache_size; // query plans cached by every shard, 0 when they are not cached
+    uint64_t result_cache_budget; // bytes of the cached results, 0 when they are not cached
+    unsigned int batch_threads; // OpenMP threads evaluating the queries of a batch
+    unsigned int shard_threads; // OpenMP threads evaluating a query on the shards
+    unsigned int default_timeout_ms; // used by the requests without timeout_ms, 0 means no deadline
+    query_server::AdmissionController * admission; // optional
+};
+
+
+template <typename IndexType>
+void check_term_ids(
+        const IndexType & index,
+        const std::vector<query_server::term_id_vec> & term_ids
+) {
+    for (const auto & group: term_ids) {
+        for (auto term_id: group) {
+            if (term_id >= index.size()) {
+                throw std::runtime_error("Term id out of range");
+            }
+        }
+    }
+}
+
+
+/**
+ * @return The terms of a flat query, translated into term ids, none if the AND query is certainly empty
+ */
+template <typename FlatQueryExpr, typename IndexType, typename ScorerType>
+query_server::term_id_vec get_flat_query(
+        const query_server::query_request & request,
+        const index_snapshot<IndexType, ScorerType> & snapshot,
+        query_server::SegmentTranslator & translator
+) {
+    const bool conjunctive = std::is_same<FlatQueryExpr, query::QueryExprAND<query::QueryExprTermView>>::value;
+    switch (request.terms_format) {
+        case query_server::query_request::TERMS_QUERY_STRING: {
+            // transforms the terms into termids while parsing it
+            return query_server::translate_flat_string(request.query, translator, conjunctive, request.query_normalization);
+        }
+        case query_server::query_request::TERMS_LEXEMES:
+            return query_server::translate_lexemes(request.lexemes[0], translator, conjunctive);
+        default:
+            check_term_ids(snapshot.replica(0).index, request.term_ids);
+            return request.term_ids[0];
+    }
+}
+
+
+/**
+ * @return The OR groups of a cnf query, translated into term ids, none if the query is certainly empty
+ */
+template <typename IndexType, typename ScorerType>
+std::vector<query_server::term_id_vec> get_cnf_query(
+        const query_server::query_request & request,
+        const index_snapshot<IndexType, ScorerType> & snapshot,
+        query_server::SegmentTranslator & translator
 ) {
+    switch (request.terms_format) {
+        case query_server::query_request::TERMS_QUERY_STRING: {
+            // transforms the terms into termids while parsing it
+            return query_server::translate_cnf_string(request.query, translator, request.query_normalization);
+        }
+        case query_server::query_request::TERMS_LEXEMES:
+            return query_server::translate_lexeme_groups(request.lexemes, translator);
+        default:
+            check_term_ids(snapshot.replica(0).index, request.term_ids);
+            return request.term_ids;
+    }
+}
+
+
+/**
+ * @return The plan of a boolean query, empty if the query is certainly empty
+ */
+query::BoolPlan get_bool_query(
+        const query_server::query_request & request,
+        query_server::SegmentTranslator & translator
+) {
+    if (request.terms_format != query_server::query_request::TERMS_QUERY_STRING) {
+        throw std::runtime_error("The boolean queries are supported only as query strings");
+    }
+    return query_server::translate_bool_string(request.query, translator);
+}
+
+
+/**
+ * Collects the lexemes of a scanned query string, see query::QueryStaticParser::scan
+ */
+struct lexeme_collector {
+    std::vector<std::vector<std::string>> groups;
+    std::vector<std::string> group;
+
+    void term(const query::QueryLexeme & lexeme) {
+        this->group.push_back(lexeme.str());
+    }
+
+    void end_group() {
+        this->groups.push_back(std::move(this->group));
+        this->group.clear();
+    }
+};
+
+
+/**
+ * Parses the query string of a request into its lexeme groups, so that the shards translate it without parsing it
+ * again with their own lexicon
+ */
+std::vector<std::vector<std::string>> parse_query_lexemes(
+        const query_server::query_request & request
+) {
+    query::QueryArena arena;
+    lexeme_collector lexemes;
+
+    if (request.query_type == query_server::QUERY_TYPE_AND) {
+        query::QueryStaticParser::scan<query::QueryExprAND<query::QueryExprTermView>>(request.query.c_str(), arena, lexemes);
+    } else if (query_server::is_flat_query_type(request.query_type)) {
+        query::QueryStaticParser::scan<query::QueryExprOR<query::QueryExprTermView>>(request.query.c_str(), arena, lexemes);
+    } else {
+        query::QueryStaticParser::scan<query::QueryExprAND<query::QueryExprOR<query::QueryExprTermView>>>(request.query.c_str(), arena, lexemes);
+    }
+
+    return std::move(lexemes.groups);
+}
+
+
+/**
+ * Prepares the posting lists of a query before its evaluation: counts the uses of its terms, when the hot lists are
+ * locked, and reads the cold lists, when the index is served out of core
+ * @param query_vector The terms of a flat query or the groups of a cnf query
+ * @param lists Filled with the lists of the query, when the index is served out of core
+ */
+template <typename IndexType, typename ScorerType, typename QueryVector>
+void prepare_query_lists(
+        query_server::ListPrefetcher * prefetcher,
+        const index_snapshot<IndexType, ScorerType> & snapshot,
+        const QueryVector & query_vector,
+        std::vector<std::size_t> & lists,
+        query_server::query_reply & reply
+) {
+    if (snapshot.term_counters.enabled()) {
+        snapshot.term_counters.add(query_vector);
+    }
+    if (prefetcher == nullptr) {
+        return;
+    }
+    const query_server::prefetch_stats stats = prefetcher->prefetch(snapshot.replica(0).index, snapshot.resident_lists, query_vector, lists);
+    reply.has_prefetch = true;
+    reply.prefetched_lists += stats.num_lists;
+    reply.prefetch_faults += stats.num_faults;
+    reply.prefetch_wait += stats.wait;
+}
+
+
+/**
+ * Evaluates a decoded request on one shard, whatever its wire format
+ * @param replica_id The replica of the index read, the one local to the NUMA node of the calling thread
+ * @param prefetcher Optional, reads the cold lists of the query before its evaluation
+ * @param rel The relevant documents contained in the shard, translated into the docids of its index
+ * @param deadline_time The deadline of the evaluation, nullptr when there is none
+ * @param plan_key The key of the query string in the plan cache of the snapshot, nullptr if it is not cached
+ */
+template <typename IndexType, typename ScorerType>
+void evaluate_shard(
+        const query_server::query_request & request,
+        const index_snapshot<IndexType, ScorerType> & snapshot,
+        std::size_t replica_id,
+        query_server::ListPrefetcher * prefetcher,
+        std::vector<uint64_t> & rel,
+        const query::QueryDeadline::clock::time_point * deadline_time,
+        const std::string * plan_key,
+        query_server::query_reply & reply
+) {
+    const IndexType * index = &snapshot.replica(replica_id).index;
+    const ds2i::wand_data<ScorerType> * wdata = snapshot.replica(replica_id).wdata;
+
     uint64_t num_ret;
     uint64_t num_rel_ret;
     double exe_time;
+    bool timed_out;
+
+    const bool query_normalization = request.query_normalization;
+    const unsigned int ranked_at = request.ranked_at;
+
+    // every shard has its own deadline, since the operators update it while they move on the candidates
+    query::QueryDeadline deadline(deadline_time != nullptr ? *deadline_time : query::QueryDeadline::clock::time_point::max());
+    query::QueryDeadline * deadline_ptr = deadline_time != nullptr ? &deadline : nullptr;
+
+    // the ranked evaluations fill the top-k list and the number of hits
+    query::RankedResults ranked_results;
+
+    // the queries certainly empty because of an unknown segment are translated into no terms, which the operators
+    // reject without touching the index
+    query_server::SegmentTranslator translator(snapshot.lexicon, snapshot.missing_filter);
+
+    // a repeated query string finds its plan in the cache, translated and normalized, otherwise its plan is cached
+    // once normalized, which follows the prefetch since it opens the lists
+    query_server::PlanCache::plan_ptr cached_plan;
+    std::shared_ptr<query_server::query_plan> new_plan;
+    if (plan_key != nullptr && snapshot.plan_cache.enabled()) {
+        cached_plan = snapshot.plan_cache.find(*plan_key);
+        if (!cached_plan) {
+            new_plan.reset(new query_server::query_plan());
+        }
+    }
+    // the operators evaluate the plans normalized in advance as they are, the other queries are normalized by the
+    // operators, thus inside the timed evaluation; a new plan is normalized apart to be cached
+    const bool normalize = query_normalization && !cached_plan;
+
+    // the faults of the lists not prefetched, or evicted since their prefetch, stall the evaluation
+    const uint64_t major_faults = query_server::thread_major_faults();
+    std::vector<std::size_t> query_lists;
+
+    switch (request.query_type) {
+        case query_server::QUERY_TYPE_AND: {
+            auto query_vector = cached_plan ? cached_plan->terms : get_flat_query<query::QueryExprAND<query::QueryExprTermView>>(request, snapshot, translator);
+            prepare_query_lists(prefetcher, snapshot, query_vector, query_lists, reply);
+            if (new_plan) {
+                new_plan->terms = query_vector;
+                if (query_normalization) {
+                    query::normalize_flat_query(*index, new_plan->terms, true);
+                }
+            }
+
+            // perform the query
+            if (normalize) {
+                op_perf_evaluation(*index, wdata, query::and_query<true, true>(deadline_ptr, &ranked_results), query_vector, rel, &num_ret, &num_rel_ret, ranked_at, &exe_time, deadline_ptr, &ranked_results, &timed_out);
+            } else {
+                op_perf_evaluation(*index, wdata, query::and_query<false, true>(deadline_ptr, &ranked_results), query_vector, rel, &num_ret, &num_rel_ret, ranked_at, &exe_time, deadline_ptr, &ranked_results, &timed_out);
+            }
+        }
+        break;
+
+        case query_server::QUERY_TYPE_OR: {
+            auto query_vector = cached_plan ? cached_plan->terms : get_flat_query<query::QueryExprOR<query::QueryExprTermView>>(request, snapshot, translator);
+            prepare_query_lists(prefetcher, snapshot, query_vector, query_lists, reply);
+            if (new_plan) {
+                new_plan->terms = query_vector;
+                if (query_normalization) {
+                    query::normalize_flat_query(*index, new_plan->terms, false);
+                }
+            }
+
+            // perform the query
+            if (normalize) {
+                op_perf_evaluation(*index, wdata, query::or_query<true, true>(deadline_ptr, &ranked_results), query_vector, rel, &num_ret, &num_rel_ret, ranked_at, &exe_time, deadline_ptr, &ranked_results, &timed_out);
+            } else {
+                op_perf_evaluation(*index, wdata, query::or_query<false, true>(deadline_ptr, &ranked_results), query_vector, rel, &num_ret, &num_rel_ret, ranked_at, &exe_time, deadline_ptr, &ranked_results, &timed_out);
+            }
+        }
+        break;
+
+        case query_server::QUERY_TYPE_CNF: {
+            auto query_vector = cached_plan ? cached_plan->groups : get_cnf_query(request, snapshot, translator);
+            prepare_query_lists(prefetcher, snapshot, query_vector, query_lists, reply);
+            if (new_plan) {
+                new_plan->groups = query_vector;
+                if (query_normalization) {
+                    query::normalize_cnf_query(*index, new_plan->groups, false);
+                }
+            }
+
+            // perform the query
+            if (normalize) {
+                op_perf_evaluation(*index, wdata, query::and_or_query<true, true>(deadline_ptr, &ranked_results), query_vector, rel, &num_ret, &num_rel_ret, ranked_at, &exe_time, deadline_ptr, &ranked_results, &timed_out);
+            } else {
+                op_perf_evaluation(*index, wdata, query::and_or_query<false, true>(deadline_ptr, &ranked_results), query_vector, rel, &num_ret, &num_rel_ret, ranked_at, &exe_time, deadline_ptr, &ranked_results, &timed_out);
+            }
+        }
+        break;
+
+        case query_server::QUERY_TYPE_CNF_OPT: {
+            auto query_vector = cached_plan ? cached_plan->groups : get_cnf_query(request, snapshot, translator);
+            prepare_query_lists(prefetcher, snapshot, query_vector, query_lists, reply);
+            if (new_plan) {
+                new_plan->groups = query_vector;
+                if (query_normalization) {
+                    query::normalize_cnf_query(*index, new_plan->groups, true);
+                }
+            }
+
+            // perform the query
+            if (normalize) {
+                op_perf_evaluation(*index, wdata, query::opt_and_or_query<true, true>(deadline_ptr, &ranked_results), query_vector, rel, &num_ret, &num_rel_ret, ranked_at, &exe_time, deadline_ptr, &ranked_results, &timed_out);
+            } else {
+                op_perf_evaluation(*index, wdata, query::opt_and_or_query<false, true>(deadline_ptr, &ranked_results), query_vector, rel, &num_ret, &num_rel_ret, ranked_at, &exe_time, deadline_ptr, &ranked_results, &timed_out);
+            }
+        }
+        break;
+
+        case query_server::QUERY_TYPE_MAXSCORE: {
+            if (!query_normalization) {
+                throw std::runtime_error("normalization cannot be disabled for maxscore");
+            }
+            auto query_vector = cached_plan ? cached_plan->terms : get_flat_query<query::QueryExprOR<query::QueryExprTermView>>(request, snapshot, translator);
+            prepare_query_lists(prefetcher, snapshot, query_vector, query_lists, reply);
+            // maxscore sorts the terms by their weights, read from the wand data at every evaluation
+            if (new_plan) {
+                new_plan->terms = query_vector;
+            }
+
+            // perform the query
+            op_perf_evaluation(*index, wdata, query::maxscore_query(deadline_ptr, &ranked_results), query_vector, rel, &num_ret, &num_rel_ret, ranked_at, &exe_time, deadline_ptr, &ranked_results, &timed_out);
+        }
+        break;
+
+        case query_server::QUERY_TYPE_BOOLEAN: {
+            query::BoolPlan plan;
+            if (cached_plan) {
+                plan = cached_plan->bool_plan;
+            } else {
+                plan = get_bool_query(request, translator);
+            }
+            prepare_query_lists(prefetcher, snapshot, plan.terms(), query_lists, reply);
+            if (new_plan) {
+                new_plan->bool_plan = plan;
+                if (query_normalization) {
+                    query::normalize_bool_plan(*index, new_plan->bool_plan);
+                }
+            }
 
-    // identify the query inside the json
-    boost::optional<std::string> query_opt = request.get_optional<std::string>("query");
-    if (!query_opt) {
-        throw std::runtime_error("Missing query field");
+            // perform the query
+            if (normalize) {
+                op_perf_evaluation(*index, wdata, query::bool_query<true, true>(deadline_ptr, &ranked_results), plan, rel, &num_ret, &num_rel_ret, ranked_at, &exe_time, deadline_ptr, &ranked_results, &timed_out);
+            } else {
+                op_perf_evaluation(*index, wdata, query::bool_query<false, true>(deadline_ptr, &ranked_results), plan, rel, &num_ret, &num_rel_ret, ranked_at, &exe_time, deadline_ptr, &ranked_results, &timed_out);
+            }
+        }
+        break;
+
+        default:
+            throw std::runtime_error("Unrecognized query_type");
     }
 
-    std::vector<uint64_t> rel;
-    auto rel_opt = request.get_child_optional("rel");
-    if (rel_opt) {
-        for (const pt::ptree::value_type &docid_obj : rel_opt.get()) {
-            std::size_t docid = docid_obj.second.get_value<std::size_t>();
-            auto find_it = docid_to_new_docid->find(docid);
-            if (find_it == docid_to_new_docid->end()) {
+    reply.num_ret = num_ret;
+    reply.exe_time = exe_time;
+    if (cached_plan) {
+        reply.missing_segments = cached_plan->missing_segments;
+        reply.unknown_segments = cached_plan->unknown_segments;
+    } else {
+        reply.missing_segments = translator.missing();
+        reply.unknown_segments = translator.unknown();
+    }
+    if (new_plan) {
+        new_plan->missing_segments = reply.missing_segments;
+        new_plan->unknown_segments = reply.unknown_segments;
+        snapshot.plan_cache.insert(*plan_key, new_plan);
+    }
+    if (prefetcher != nullptr) {
+        reply.major_faults = query_server::thread_major_faults() - major_faults;
+        // some lists have been evicted since their prefetch, the next query reads them again
+        if (reply.major_faults > 0) {
+            snapshot.resident_lists.evict(query_lists);
+        }
+    }
+    reply.has_deadline = deadline_ptr != nullptr;
+    reply.timed_out = timed_out;
+    reply.has_rel = request.has_rel;
+    if (request.has_rel) {
+        reply.num_rel_ret = num_rel_ret;
+        reply.num_rel = rel.size();
+    }
+    if (ranked_at > 0) {
+        reply.has_results = true;
+        reply.num_hits = ranked_results.num_hits;
+        reply.num_hits_exact = ranked_results.num_hits_exact;
+        reply.results.reserve(ranked_results.top_k.size());
+        for (const auto & entry: ranked_results.top_k) {
+            const uint64_t docid = snapshot.docid_map.original(entry.docid);
+            if (docid == query_server::DocidMap::not_mapped) {
+                throw std::runtime_error("Unable to find the original docid of one of the results");
+            }
+            reply.results.push_back(query_server::result_document {docid, entry.score});
+        }
+    }
+}
+
+
+/**
+ * Evaluates a request on the shards of an index, in parallel when they are more than one, and merges their replies
+ * @param shards_rel The relevant documents contained in each shard, translated into the docids of its index
+ * @param plan_key The key of the query string in the plan caches of the shards, nullptr if it is not cached
+ */
+template <typename IndexType, typename ScorerType>
+void evaluate_shards(
+        const query_server::query_request & request,
+        const std::vector<std::shared_ptr<const index_snapshot<IndexType, ScorerType>>> & shards,
+        std::vector<std::vector<uint64_t>> & shards_rel,
+        const query::QueryDeadline::clock::time_point * deadline_time,
+        const std::string * plan_key,
+        query_server::query_reply & reply,
+        const server_context<IndexType, ScorerType> & context
+) {
+    const std::size_t num_shards = shards.size();
+    if (num_shards == 1) {
+        evaluate_shard(request, *shards[0], context.placement->local_replica(), context.prefetcher, shards_rel[0], deadline_time, plan_key, reply);
+        return;
+    }
+
+    // the term ids are local to each shard, while the query string is parsed once for all of them, but the one of a
+    // boolean query, which has no lexeme groups, and the cached one, parsed by every shard missing its plan
+    if (request.terms_format == query_server::query_request::TERMS_TERM_IDS) {
+        throw std::runtime_error("Term ids are not supported by a sharded index, use the lexemes");
+    }
+    query_server::query_request lexemes_request;
+    const query_server::query_request * shard_request = &request;
+    if (request.terms_format == query_server::query_request::TERMS_QUERY_STRING && request.query_type != query_server::QUERY_TYPE_BOOLEAN && plan_key == nullptr) {
+        lexemes_request = request;
+        lexemes_request.terms_format = query_server::query_request::TERMS_LEXEMES;
+        lexemes_request.lexemes = parse_query_lexemes(request);
+        shard_request = &lexemes_request;
+    }
+
+    // the exceptions cannot leave the parallel region, they are rethrown after it
+    std::vector<query_server::query_reply> shard_replies(num_shards);
+    std::vector<std::exception_ptr> shard_errors(num_shards);
+    const long num_shards_l = static_cast<long>(num_shards);
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(context.shard_threads)
+    for (long s = 0; s < num_shards_l; ++s) {
+        try {
+            evaluate_shard(*shard_request, *shards[s], context.placement->local_replica(), context.prefetcher, shards_rel[s], deadline_time, plan_key, shard_replies[s]);
+        } catch (...) {
+            shard_errors[s] = std::current_exception();
+        }
+    }
+    for (const auto & error: shard_errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    std::vector<const query_server::query_reply *> shard_reply_ptrs;
+    for (const auto & shard_reply: shard_replies) {
+        shard_reply_ptrs.push_back(&shard_reply);
+    }
+    query_server::merge_shard_replies(request, shard_reply_ptrs, reply);
+}
+
+
+/**
+ * Evaluates a decoded request, whatever its wire format.
+ * A sharded index evaluates the request on all its shards in parallel and merges their replies.
+ * The results of a repeated query string are answered from the result cache of the index, when it is enabled.
+ */
+template <typename IndexType, typename ScorerType>
+void evaluate_request(
+        const query_server::query_request & request,
+        query_server::query_reply & reply,
+        const server_context<IndexType, ScorerType> & context
+) {
+    // the index stays alive until the end of the evaluation, even if a reload replaces it
+    const auto index_ptr = context.snapshots->current();
+    if (!index_ptr) {
+        throw std::runtime_error("The index is still loading");
+    }
+    const std::vector<std::shared_ptr<const index_snapshot<IndexType, ScorerType>>> & shards = index_ptr->shards;
+    const std::size_t num_shards = shards.size();
+
+    if (request.ranked_at > 1000*1000) {
+        throw std::runtime_error("Ranked at must be greater than 0 and lower than 1M");
+    }
+
+    // every relevant document belongs to the shard containing its docid, if any
+    std::vector<std::vector<uint64_t>> shards_rel(num_shards);
+    if (request.has_rel) {
+        for (uint64_t docid: request.rel) {
+            bool found = false;
+            for (std::size_t s = 0; s < num_shards && !found; ++s) {
+                uint64_t new_docid;
+                if (shards[s]->docid_map.find(docid, new_docid)) {
+                    shards_rel[s].push_back(new_docid);
+                    found = true;
+                }
+            }
+            if (!found && !request.skip_unknown_rel) {
                 throw std::runtime_error("Unable to find one of the docids");
             }
-            rel.push_back(find_it->second);
         }
-        if (rel.size() == 0) {
+        if (request.rel.size() == 0) {
             throw std::runtime_error("Empty rel option");
         }
     }
 
-    // query normalization
-    bool query_normalization = true;
-    boost::optional<std::string> query_normalization_opt = request.get_optional<std::string>("query_normalization");
-    if (query_normalization_opt) {
-        if (query_normalization_opt.get() == "false") {
-            query_normalization = false;
-        } else if (query_normalization_opt.get() != "true") {
-            throw std::runtime_error("Unrecognized query_normalization");
+    // the deadline starts with the evaluation, the operators stop when it expires
+    const unsigned int timeout_ms = request.has_timeout ? request.timeout_ms : context.default_timeout_ms;
+    const query::QueryDeadline::clock::time_point deadline_time = query::QueryDeadline::clock::now() + std::chrono::milliseconds(timeout_ms);
+    const query::QueryDeadline::clock::time_point * deadline_time_ptr = timeout_ms > 0 ? &deadline_time : nullptr;
+
+    // the canonical form of a query string is the key of its plan in the shards and of its results in the index
+    std::string plan_key;
+    const bool cache_results = index_ptr->result_cache.enabled() && !request.has_rel;
+    if ((context.plan_cache_size > 0 || cache_results) && request.terms_format == query_server::query_request::TERMS_QUERY_STRING) {
+        plan_key = query_server::plan_cache_key(request.query_type, request.query_normalization, request.query);
+    }
+    const std::string * plan_key_ptr = plan_key.empty() || context.plan_cache_size == 0 ? nullptr : &plan_key;
+
+    // the results are cached without the relevant documents, which change their counts
+    std::string result_key;
+    if (cache_results && !plan_key.empty()) {
+        result_key = query_server::result_cache_key(plan_key, request.ranked_at);
+        const auto tick = ds2i::get_time_usecs();
+        const query_server::ResultCache::reply_ptr cached_reply = index_ptr->result_cache.find(result_key);
+        if (cached_reply) {
+            query_server::copy_cached_results(*cached_reply, reply);
+            // nothing has been evaluated on the shards
+            for (auto & shard: reply.shards) {
+                shard.exe_time = 0;
+            }
+            reply.exe_time = double(ds2i::get_time_usecs() - tick) / 1000.0;
+            reply.has_deadline = deadline_time_ptr != nullptr;
+            reply.cached = true;
+            return;
         }
     }
 
-    // ranked
-    unsigned int ranked_at = 0;
-    boost::optional<unsigned int> ranked_at_opt = request.get_optional<unsigned int>("ranked_at");
-    if (ranked_at_opt) {
-        ranked_at = ranked_at_opt.get();
-        if (ranked_at == 0 || ranked_at > 1000*1000) {
-            throw std::runtime_error("Ranked at must be greater than 0 and lower than 1M");
+    // the cost of the results is the whole evaluation, saved by every hit
+    const auto tick = ds2i::get_time_usecs();
+    evaluate_shards(request, shards, shards_rel, deadline_time_ptr, plan_key_ptr, reply, context);
+    // the partial results are not cached, they would be answered in place of the complete ones
+    if (!result_key.empty() && !reply.timed_out && !reply.partial) {
+        index_ptr->result_cache.insert(result_key, reply, double(ds2i::get_time_usecs() - tick) / 1000.0);
+    }
+}
+
+
+/**
+ * Replaces the served index with the one loaded from basenames, the comma-separated basenames of its shards, in a
+ * background thread. The requests arriving before the end of the reload use the current index.
+ * @return False if another reload is already in progress
+ */
+template <typename IndexType, typename ScorerType>
+bool start_reload(
+        const server_context<IndexType, ScorerType> & context,
+        const std::string & basenames
+) {
+    if (!context.snapshots->begin_reload()) {
+        return false;
+    }
+
+    query_server::SnapshotRegistry<sharded_index<IndexType, ScorerType>> * snapshots = context.snapshots;
+    query_server::LoadProgress * progress = context.progress;
+    const std::string index_type = context.index_type;
+    const unsigned int load_threads = context.load_threads;
+    const query_server::MemoryPlacement * placement = context.placement;
+    const bool out_of_core = context.prefetcher != nullptr;
+    const bool count_terms = context.lock_budget > 0;
+    const std::size_t plan_cache_size = context.plan_cache_size;
+    const uint64_t result_cache_budget = context.result_cache_budget;
+    boost::thread reload_thread([snapshots, progress, index_type, load_threads, placement, out_of_core, count_terms, plan_cache_size, result_cache_budget, basenames]() {
+        try {
+            std::cerr << "Reloading the index from " << basenames << std::endl;
+            auto index = load_sharded_index<IndexType, ScorerType>(index_type, basenames, load_threads, *placement, out_of_core, count_terms, plan_cache_size, result_cache_budget, *progress);
+            const uint64_t generation = snapshots->publish(index);
+            std::cerr << "Reload completed, serving " << basenames << " (generation " << generation << ")" << std::endl;
+        } catch (std::exception &e) {
+            std::cerr << "Reload failed, the current index is still served: " << e.what() << std::endl;
+        }
+        snapshots->end_reload();
+    });
+    reload_thread.detach();
+
+    return true;
+}
+
+
+/**
+ * Answers an administrative request, e.g., {"admin": "reload", "basename": "..."}.
+ * The basename of a sharded index is the comma-separated list of the basenames of its shards.
+ * The reload without basename reloads the files of the current index.
+ * The status request, {"admin": "status"}, is answered also during the startup, with the progress of the stages of
+ * the last load of the index.
+ */
+template <typename IndexType, typename ScorerType>
+void handle_admin_request(
+        const std::string & command,
+        const pt::ptree &request,
+        pt::ptree &reply,
+        const server_context<IndexType, ScorerType> & context
+) {
+    const auto index_ptr = context.snapshots->current();
+    if (command == "status") {
+        reply.put<bool>("ready", static_cast<bool>(index_ptr));
+        if (index_ptr) {
+            reply.put<std::string>("basename", index_ptr->basenames);
+        }
+        reply.put<uint64_t>("generation", context.snapshots->generation());
+        reply.put<bool>("reloading", context.snapshots->is_reloading() && index_ptr);
+        reply.put<std::string>("huge_pages", query_server::huge_pages_mode_to_string(context.placement->huge_pages()));
+        reply.put<std::size_t>("numa_replicas", context.placement->replicated() ? context.placement->num_replicas() : 0);
+        reply.put<std::size_t>("prefetch_threads", context.prefetcher != nullptr ? context.prefetcher->num_helpers() : 0);
+        reply.put<uint64_t>("lock_budget", context.lock_budget);
+        if (index_ptr && context.lock_budget > 0) {
+            pt::ptree locked_lists;
+            for (const auto & shard: index_ptr->shards) {
+                pt::ptree shard_json;
+                shard_json.put<std::string>("basename", shard->basename);
+                shard_json.put<std::size_t>("terms", shard->hot_lists.num_terms());
+                shard_json.put<uint64_t>("bytes", shard->hot_lists.locked_bytes());
+                locked_lists.push_back(std::make_pair("", shard_json));
+            }
+            reply.add_child("locked_lists", locked_lists);
+        }
+        reply.put<std::size_t>("plan_cache_size", context.plan_cache_size);
+        if (index_ptr && context.plan_cache_size > 0) {
+            pt::ptree plan_cache;
+            for (const auto & shard: index_ptr->shards) {
+                const uint64_t hits = shard->plan_cache.hits();
+                const uint64_t misses = shard->plan_cache.misses();
+                pt::ptree shard_json;
+                shard_json.put<std::string>("basename", shard->basename);
+                shard_json.put<std::size_t>("plans", shard->plan_cache.size());
+                shard_json.put<uint64_t>("hits", hits);
+                shard_json.put<uint64_t>("misses", misses);
+                shard_json.put<double>("hit_rate", hits + misses > 0 ? static_cast<double>(hits) / (hits + misses) : 0.0);
+                plan_cache.push_back(std::make_pair("", shard_json));
+            }
+            reply.add_child("plan_cache", plan_cache);
+        }
+        reply.put<uint64_t>("result_cache_budget", context.result_cache_budget);
+        if (index_ptr && index_ptr->result_cache.enabled()) {
+            const query_server::ResultCache & cache = index_ptr->result_cache;
+            const uint64_t hits = cache.hits();
+            const uint64_t misses = cache.misses();
+            pt::ptree result_cache;
+            result_cache.put<std::size_t>("results", cache.size());
+            result_cache.put<uint64_t>("bytes", cache.bytes());
+            result_cache.put<uint64_t>("hits", hits);
+            result_cache.put<uint64_t>("misses", misses);
+            result_cache.put<double>("hit_rate", hits + misses > 0 ? static_cast<double>(hits) / (hits + misses) : 0.0);
+            result_cache.put<uint64_t>("admissions", cache.admissions());
+            result_cache.put<uint64_t>("rejections", cache.rejections());
+            result_cache.put<uint64_t>("evictions", cache.evictions());
+            reply.add_child("result_cache", result_cache);
+        }
+        pt::ptree stages;
+        for (const auto & stage: context.progress->stages()) {
+            pt::ptree stage_json;
+            stage_json.put<std::string>("basename", stage.basename);
+            stage_json.put<std::string>("stage", stage.name);
+            stage_json.put<std::string>("state", query_server::stage_state_to_string(stage.state));
+            if (stage.total > 0) {
+                stage_json.put<uint64_t>("done", stage.done);
+                stage_json.put<uint64_t>("total", stage.total);
+            }
+            stage_json.put<double>("elapsed", stage.elapsed);
+            if (!stage.error.empty()) {
+                stage_json.put<std::string>("error", stage.error);
+            }
+            stages.push_back(std::make_pair("", stage_json));
         }
+        reply.add_child("stages", stages);
+    } else if (!index_ptr) {
+        throw std::runtime_error("The index is still loading");
+    } else if (command == "reload") {
+        const std::string basenames = request.get<std::string>("basename", index_ptr->basenames);
+        if (!start_reload(context, basenames)) {
+            throw std::runtime_error("A reload is already in progress");
+        }
+        reply.put<std::string>("reload", "started");
+        reply.put<std::string>("basename", basenames);
+        reply.put<uint64_t>("generation", context.snapshots->generation());
+    } else {
+        throw std::runtime_error("Unrecognized admin command");
     }
+}
 
-    // query type
-    boost::optional<std::string> query_type_opt = request.get_optional<std::string>("query_type");
-    if (query_type_opt && query_type_opt.get() == "and") {
-        // parse it and transforms the terms into termids
-        auto query_expression = query::QueryStaticParser::parse<query::QueryExprAND<query::QueryExprTerm>>(query_opt.get());
-        auto query_vector = query_server::translate_flat_expression(query_expression, *segment_to_termid_map);
 
-        // perform the query
-        if (query_normalization) {
-            op_perf_evaluation(*index, wdata, query::and_query<true, true>(), query_vector, rel, &num_ret, &num_rel_ret, ranked_at, &exe_time);
-        } else {
-            op_perf_evaluation(*index, wdata, query::and_query<false, true>(), query_vector, rel, &num_ret, &num_rel_ret, ranked_at, &exe_time);
+template <typename IndexType, typename ScorerType>
+void handle_request(
+        const pt::ptree &request,
+        pt::ptree &reply,
+        const server_context<IndexType, ScorerType> & context
+) {
+    boost::optional<std::string> admin_opt = request.get_optional<std::string>("admin");
+    if (admin_opt) {
+        handle_admin_request(admin_opt.get(), request, reply, context);
+        return;
+    }
+
+    query_server::query_request parsed_request;
+    query_server::query_reply query_reply;
+
+    query_server::json_protocol::decode_request(request, parsed_request);
+    evaluate_request(parsed_request, query_reply, context);
+
+    // compose the json
+    query_server::json_protocol::encode_reply(query_reply, reply);
+}
+
+
+/**
+ * Answers a single json request, echoing its optional id in the reply
+ * @param ticket The admission state of the request, nullptr when the admission control is disabled
+ * @return True if the request has an id
+ */
+template <typename IndexType, typename ScorerType>
+bool handle_single_request(
+        const pt::ptree &request,
+        pt::ptree &reply,
+        const server_context<IndexType, ScorerType> & context,
+        const query_server::admission_ticket * ticket
+) {
+    boost::optional<std::string> id_opt = request.get_optional<std::string>("id");
+
+    try {
+        if (ticket != nullptr && !ticket->admitted) {
+            throw std::runtime_error("overloaded");
         }
-    } else if (query_type_opt && query_type_opt.get() == "or") {
-        // parse it and transforms the terms into termids
-        auto query_expression = query::QueryStaticParser::parse<query::QueryExprOR<query::QueryExprTerm>>(query_opt.get());
-        auto query_vector = query_server::translate_flat_expression(query_expression, *segment_to_termid_map);
+        handle_request<IndexType, ScorerType>(request, reply, context);
+    } catch (std::exception &e) {
+        reply.clear();
+        reply.put<std::string>("error", e.what());
+    }
+    if (id_opt) {
+        reply.put<std::string>("id", id_opt.get());
+    }
+    if (ticket != nullptr) {
+        reply.put<std::size_t>("queue_depth", ticket->queue_depth);
+        reply.put<double>("queue_wait", ticket->queue_wait);
+        reply.put<uint64_t>("shed_count", context.admission->shed_count());
+    }
 
-        // perform the query
-        if (query_normalization) {
-            op_perf_evaluation(*index, wdata, query::or_query<true, true>(), query_vector, rel, &num_ret, &num_rel_ret, ranked_at, &exe_time);
-        } else {
-            op_perf_evaluation(*index, wdata, query::or_query<false, true>(), query_vector, rel, &num_ret, &num_rel_ret, ranked_at, &exe_time);
+    return static_cast<bool>(id_opt);
+}
+
+
+/**
+ * Answers an array of json requests, evaluating them in parallel.
+ * The replies are in the same order of the requests.
+ */
+template <typename IndexType, typename ScorerType>
+void handle_batch_request(
+        const pt::ptree &request,
+        std::vector<pt::ptree> &replies,
+        const server_context<IndexType, ScorerType> & context,
+        const query_server::admission_ticket * ticket
+) {
+    std::vector<const pt::ptree *> requests;
+    requests.reserve(request.size());
+    for (const pt::ptree::value_type &child: request) {
+        requests.push_back(&child.second);
+    }
+    replies.resize(requests.size());
+
+    // the exceptions are caught by handle_single_request, none of them leaves the parallel region
+    const long num_requests = static_cast<long>(requests.size());
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(context.batch_threads)
+    for (long i = 0; i < num_requests; ++i) {
+        handle_single_request<IndexType, ScorerType>(*requests[i], replies[i], context, ticket);
+    }
+}
+
+
+/**
+ * Answers a request in the binary protocol with a binary reply
+ * @return True if the request has an id
+ */
+template <typename IndexType, typename ScorerType>
+bool handle_binary_message(
+        const char * data,
+        std::size_t size,
+        std::string & reply_message,
+        const server_context<IndexType, ScorerType> & context,
+        const query_server::admission_ticket * ticket
+) {
+    namespace bp = query_server::binary_protocol;
+    query_server::query_request request;
+    query_server::query_reply reply;
+    uint64_t id = 0;
+    bool has_id = false;
+
+    if (ticket != nullptr) {
+        reply.has_admission = true;
+        reply.queue_depth = ticket->queue_depth;
+        reply.queue_wait = ticket->queue_wait;
+        reply.shed_count = context.admission->shed_count();
+    }
+
+    if (static_cast<uint8_t>(data[3]) != bp::version) {
+        bp::encode_reply(reply, nullptr, bp::STATUS_UNSUPPORTED_VERSION, "Unsupported version of the binary protocol", reply_message);
+        return false;
+    }
+
+    try {
+        has_id = bp::decode_request(data, size, request, id);
+        if (ticket != nullptr && !ticket->admitted) {
+            bp::encode_reply(reply, has_id ? &id : nullptr, bp::STATUS_OVERLOADED, "overloaded", reply_message);
+            return has_id;
         }
-    } else if (!query_type_opt || query_type_opt.get() == "cnf") {
-        // parse it and transforms the terms into termids
-        auto query_expression = query::QueryStaticParser::parse<query::QueryExprAND<query::QueryExprOR<query::QueryExprTerm>>>(query_opt.get());
-        auto query_vector = query_server::translate_cnf_expression(query_expression, *segment_to_termid_map);
+        evaluate_request(request, reply, context);
+        bp::encode_reply(reply, has_id ? &id : nullptr, bp::STATUS_OK, nullptr, reply_message);
+    } catch (std::exception &e) {
+        query_server::query_reply error_reply;
+        error_reply.has_admission = reply.has_admission;
+        error_reply.queue_depth = reply.queue_depth;
+        error_reply.queue_wait = reply.queue_wait;
+        error_reply.shed_count = reply.shed_count;
+        bp::encode_reply(error_reply, has_id ? &id : nullptr, bp::STATUS_ERROR, e.what(), reply_message);
+    }
 
-        // perform the query
-        if (query_normalization) {
-            op_perf_evaluation(*index, wdata, query::and_or_query<true, true>(), query_vector, rel, &num_ret, &num_rel_ret, ranked_at, &exe_time);
-        } else {
-            op_perf_evaluation(*index, wdata, query::and_or_query<false, true>(), query_vector, rel, &num_ret, &num_rel_ret, ranked_at, &exe_time);
+    return has_id;
+}
+
+
+/**
+ * Answers the request contained in the message, writing the reply in reply_message.
+ * The request can be a json request, an array of json requests (batch) or a binary request.
+ * A message shed by the admission control is answered with an overloaded error, a batch holds one evaluation slot
+ * for every query it evaluates at the same time. The administrative requests, e.g., the status probes, are never
+ * shed and do not wait for a slot, thus an overloaded server still answers them.
+ * @param ticket The admission state of the message, taken when it arrived
+ * @return True if the request has an id, thus its reply can be sent out of order
+ */
+template <typename IndexType, typename ScorerType>
+bool process_message(
+        const char * data,
+        std::size_t size,
+        std::string & reply_message,
+        const server_context<IndexType, ScorerType> & context,
+        query_server::admission_ticket & ticket
+) {
+    const query_server::admission_ticket * ticket_ptr = context.admission != nullptr ? &ticket : nullptr;
+
+    if (query_server::binary_protocol::is_binary_message(data, size)) {
+        // wait for an evaluation slot, if the message has been admitted
+        query_server::AdmissionSlot slot(ticket.admitted ? context.admission : nullptr, ticket);
+        return handle_binary_message(data, size, reply_message, context, ticket_ptr);
+    }
+
+    // create a json root for the request and for the reply
+    pt::ptree request;
+    pt::ptree reply;
+    std::vector<pt::ptree> batch_replies;
+    bool batch = false;
+    bool unordered = false;
+
+    // load the json file in this ptree, reading it in place, the malformed requests are answered with their error
+    std::string parse_error;
+    try {
+        boost::iostreams::stream<boost::iostreams::array_source> message_stream(data, size);
+        pt::read_json(message_stream, request);
+    } catch (std::exception &e) {
+        parse_error = e.what();
+    }
+    const bool admin = parse_error.empty() && !query_server::json_protocol::is_batch_request(request) &&
+                       request.get_optional<std::string>("admin");
+    if (admin && context.admission != nullptr) {
+        context.admission->withdraw(ticket);
+    }
+
+    // wait for an evaluation slot, if the message has been admitted
+    query_server::AdmissionSlot slot(ticket.admitted && !admin ? context.admission : nullptr, ticket);
+
+    // handle the request
+    try {
+        if (!parse_error.empty()) {
+            throw std::runtime_error(parse_error);
         }
-    } else if (!query_type_opt || query_type_opt.get() == "cnf opt") {
-        // parse it and transforms the terms into termids
-        auto query_expression = query::QueryStaticParser::parse<query::QueryExprAND<query::QueryExprOR<query::QueryExprTerm>>>(query_opt.get());
-        auto query_vector = query_server::translate_cnf_expression(query_expression, *segment_to_termid_map);
 
-        // perform the query
-        if (query_normalization) {
-            op_perf_evaluation(*index, wdata, query::opt_and_or_query<true, true>(), query_vector, rel, &num_ret, &num_rel_ret, ranked_at, &exe_time);
+        // handle the request
+        if (query_server::json_protocol::is_batch_request(request)) {
+            batch = true;
+            slot.resize(std::max<std::size_t>(1, std::min<std::size_t>(request.size(), context.batch_threads)));
+            handle_batch_request<IndexType, ScorerType>(request, batch_replies, context, ticket_ptr);
         } else {
-            op_perf_evaluation(*index, wdata, query::opt_and_or_query<false, true>(), query_vector, rel, &num_ret, &num_rel_ret, ranked_at, &exe_time);
+            unordered = handle_single_request<IndexType, ScorerType>(request, reply, context, ticket_ptr);
         }
-    } else if (query_type_opt && query_type_opt.get() == "maxscore") {
-        // parse it and transforms the terms into termids
-        auto query_expression = query::QueryStaticParser::parse<query::QueryExprOR<query::QueryExprTerm>>(query_opt.get());
-        auto query_vector = query_server::translate_flat_expression(query_expression, *segment_to_termid_map);
+    } catch (std::exception &e) {
+        batch = false;
+        reply.clear();
+        reply.put<std::string>("error", e.what());
+    }
 
-        // perform the query
-        if (!query_normalization) {
-            throw std::runtime_error("normalization cannot be disabled for maxscore");
+    // transform the json tree into a string, reusing the memory of reply_message
+    reply_message.clear();
+    boost::iostreams::stream<boost::iostreams::back_insert_device<std::string>> ss(reply_message);
+    if (batch) {
+        // write_json cannot write an array as root
+        ss << '[';
+        for (std::size_t i = 0; i < batch_replies.size(); ++i) {
+            if (i > 0) {
+                ss << ',';
+            }
+            pt::write_json(ss, batch_replies[i], false);
         }
-        op_perf_evaluation(*index, wdata, query::maxscore_query(), query_vector, rel, &num_ret, &num_rel_ret, ranked_at, &exe_time);
+        ss << ']';
     } else {
-        throw std::runtime_error("Unrecognized query_type");
+        pt::write_json(ss, reply, false);
     }
+    ss.flush();
 
-    // compose the json
-    reply.put<std::size_t>("num_ret", num_ret);
-    reply.put<double>("exe_time", exe_time);
-    if (rel_opt) {
-        reply.put<std::size_t>("num_rel_ret", num_rel_ret);
-        reply.put<std::size_t>("num_rel", rel.size());
-    }
+    return unordered;
 }
 
 
 template <typename IndexType, typename ScorerType>
 void session(
         query_server::Socket * sock,
-        const std::unordered_map<std::string, unsigned int> * segment_to_termid_map,
-        const std::unordered_map<std::size_t, uint64_t> * docid_to_new_docid,
-        IndexType * index,
-        ds2i::wand_data<ScorerType> * wdata // optional
+        const server_context<IndexType, ScorerType> * context
 ) {
     bool close_socket = true;
 
     //std::cout << "CLIENT Connection" << std::endl;
     try {
-        // string stream used as buffer
-        std::stringstream ss;
-        // create a json root for the request and for the reply
-        pt::ptree request;
-        pt::ptree reply;
+        // the request is read in the socket buffer, the reply is written in a string reused by all the messages
+        std::string reply_message;
 
         for (;;) {
-            ss.str("");
-            sock->receive_message(ss);
-            //std::cout << "RECEIVED: " << ss.str() << std::endl;
+            std::size_t message_size;
+            const char * message = sock->receive_message(message_size);
+            //std::cout << "RECEIVED: " << std::string(message, message_size) << std::endl;
+            query_server::admission_ticket ticket;
+            if (context->admission != nullptr) {
+                ticket = context->admission->enter();
+            }
 
             // handle the request
-            try {
-                // load the json file in this ptree
-                request.clear();
-                pt::read_json(ss, request);
-
-                // handle the request
-                reply.clear();
-                handle_request<IndexType, ScorerType>(request, reply, segment_to_termid_map, docid_to_new_docid, index, wdata);
-            } catch (std::exception &e) {
-                reply.clear();
-                reply.put<std::string>("error", e.what());
-            }
+            process_message(message, message_size, reply_message, *context, ticket);
+            //std::cout << "ANSWER: " << reply_message << std::endl;
 
             // reply the request
-            {
-                // transform the json tree into a string
-                ss.str("");
-                pt::write_json(ss, reply, false);
-                //std::cout << "ANSWER: " << ss.str() << std::endl;
-
-                // send the string
-                sock->send_message(ss.str());
-            }
+            sock->send_message(reply_message);
         }
     } catch (const query_server::SocketConnectionClosedByPeerException &e) {
         //std::cout << "CLIENT Disconnection" << std::endl;
@@ -256,57 +1295,207 @@ void session(
 }
 
 
+/**
+ * Locks in memory the posting lists of the terms used most on every shard of the served index, the budget is split
+ * among the shards in proportion to the size of their index files
+ */
+template <typename IndexType, typename ScorerType>
+void lock_hot_lists(
+        const sharded_index<IndexType, ScorerType> & index,
+        const std::string & index_type,
+        uint64_t budget
+) {
+    uint64_t total_size = 0;
+    for (const auto & shard: index.shards) {
+        total_size += shard->index_file_source.size();
+    }
+    for (const auto & shard: index.shards) {
+        const uint64_t shard_budget = total_size > 0 ? static_cast<uint64_t>(static_cast<double>(budget) * shard->index_file_source.size() / total_size) : 0;
+        const std::vector<std::size_t> ranked_terms = shard->term_counters.rank_and_decay();
+        if (shard->hot_lists.lock(shard->basename + "." + index_type, shard->replica(0).index, ranked_terms, shard_budget)) {
+            std::cerr << "Locked " << shard->hot_lists.num_terms() << " of " << ranked_terms.size() << " used lists ("
+                      << (shard->hot_lists.locked_bytes() >> 20) << " MB) of " << shard->basename << std::endl;
+        }
+    }
+}
+
+
+/**
+ * Counts the uses of the terms of a query log on every shard of the index
+ * @param log_counts The uses of the lexemes of the log, see query_server::read_query_log
+ */
+template <typename IndexType, typename ScorerType>
+void count_query_log(
+        const sharded_index<IndexType, ScorerType> & index,
+        const std::unordered_map<std::string, uint32_t> & log_counts
+) {
+    for (const auto & shard: index.shards) {
+        for (const auto & entry: log_counts) {
+            query_server::term_id_type term_id;
+            if (shard->lexicon.find(entry.first, term_id)) {
+                shard->term_counters.add(term_id, entry.second);
+            }
+        }
+    }
+}
+
+
 template <typename IndexType, typename ScorerType>
 void server(
         const char *ip,
         unsigned short port,
         const std::string & index_type,
-        const std::string & index_basename
+        const std::string & index_basename,
+        const query_server::server_options & options
 ) {
     // create the socket server to check the ip and port
     boost::asio::io_service io_service;
-    query_server::SocketServer server(&io_service, ip, port);
+    std::unique_ptr<query_server::SocketServer> server;
+    std::unique_ptr<query_server::AsyncServer> async_server;
+    if (options.num_threads > 0) {
+        async_server.reset(new query_server::AsyncServer(ip, port, options.num_reactors, options.max_frame_mb << 20));
+    } else {
+        server.reset(new query_server::SocketServer(&io_service, ip, port, options.max_frame_mb << 20));
+    }
 
-    // loading the term map
-    std::cerr << "Loading the term map from " << index_basename << ".terms and from " << index_basename << ".mterms" << std::endl;
-    std::unordered_map<std::string, unsigned int> segment_to_termid = query_server::get_segment_to_termid_map(
-            index_basename + ".terms"
-    );
-    std::unordered_set<std::string> missing_segments = query_server::get_segment_set(
-            index_basename + ".mterms"
-    );
+    // the index is loaded after the server starts listening, meanwhile the status requests report the progress
+    query_server::SnapshotRegistry<sharded_index<IndexType, ScorerType>> snapshots(nullptr);
+    query_server::LoadProgress progress;
+    const query_server::MemoryPlacement placement(options.huge_pages, options.numa_replicas);
+    if (placement.copies_files()) {
+        std::cerr << "Copying the index to " << placement.num_replicas() << " NUMA node(s), huge pages: "
+                  << query_server::huge_pages_mode_to_string(placement.huge_pages()) << std::endl;
+    }
 
-    // loading the doc map
-    std::cerr << "Loading the doc map from " << index_basename << ".docids.map" << std::endl;
-    std::unordered_map<std::size_t, uint64_t> docid_to_new_docid = query_server::get_docid_to_new_docid_map(
-            index_basename + ".docids.map"
-    );
+    std::unique_ptr<query_server::ListPrefetcher> prefetcher;
+    if (options.prefetch_threads > 0) {
+        prefetcher.reset(new query_server::ListPrefetcher(options.prefetch_threads, options.prefetch_ttl_s));
+        std::cerr << "Serving the index out of core, " << options.prefetch_threads << " prefetch helpers" << std::endl;
+    }
 
-    // loading the index
-    std::cerr << "Loading the index (type " << index_type << ") from " << index_basename << "." << index_type << std::endl;
-    IndexType index;
-    boost::iostreams::mapped_file_source index_file_source(index_basename + "." + index_type);
-    succinct::mapper::map(index, index_file_source, succinct::mapper::map_flags::warmup);
+    server_context<IndexType, ScorerType> context;
+    context.index_type = index_type;
+    context.snapshots = &snapshots;
+    context.progress = &progress;
+    context.load_threads = options.load_threads;
+    context.placement = &placement;
+    context.prefetcher = prefetcher.get();
+    context.lock_budget = static_cast<uint64_t>(options.lock_budget_mb) << 20;
+    context.plan_cache_size = options.plan_cache_size;
+    context.result_cache_budget = static_cast<uint64_t>(options.result_cache_mb) << 20;
+    context.batch_threads = options.batch_threads;
+    context.shard_threads = options.shard_threads;
+    context.default_timeout_ms = options.timeout_ms;
+    std::unique_ptr<query_server::AdmissionController> admission;
+    if (options.max_in_flight > 0) {
+        admission.reset(new query_server::AdmissionController(options.max_in_flight, options.max_queue));
+    }
+    context.admission = admission.get();
 
-    ds2i::wand_data<ScorerType> wdata;
-    ds2i::wand_data<ScorerType> * wdata_ptr = nullptr;
-    boost::iostreams::mapped_file_source md;
-    std::string wand_data_filename = index_basename + ".wand";
-    if ( access( wand_data_filename.c_str(), F_OK ) != -1 ) { // it can also not exist
-        std::cerr << "Loading wand data from " << index_basename << ".wand" << std::endl;
-        md.open(wand_data_filename);
-        succinct::mapper::map(wdata, md, succinct::mapper::map_flags::warmup);
-        wdata_ptr = &wdata;
+    // SIGHUP reloads the files of the current index
+    boost::asio::io_service signal_service;
+    boost::asio::signal_set reload_signals(signal_service, SIGHUP);
+    std::function<void(const boost::system::error_code &, int)> on_reload_signal;
+    on_reload_signal = [&](const boost::system::error_code & error, int) {
+        if (error) {
+            return;
+        }
+        const auto index_ptr = snapshots.current();
+        if (!index_ptr) {
+            std::cerr << "SIGHUP ignored, the index is still loading" << std::endl;
+        } else if (!start_reload(context, index_ptr->basenames)) {
+            std::cerr << "SIGHUP ignored, a reload is already in progress" << std::endl;
+        }
+        reload_signals.async_wait(on_reload_signal);
+    };
+    reload_signals.async_wait(on_reload_signal);
+    boost::thread signal_thread([&signal_service]() { signal_service.run(); });
+
+    // the initial load counts as a reload, the reload requests are refused until its end
+    snapshots.begin_reload();
+    boost::thread load_thread([&snapshots, &progress, &index_type, &index_basename, &options, &placement, &prefetcher, &context]() {
+        try {
+            auto index = load_sharded_index<IndexType, ScorerType>(index_type, index_basename, options.load_threads, placement, static_cast<bool>(prefetcher), context.lock_budget > 0, context.plan_cache_size, context.result_cache_budget, progress);
+            snapshots.publish(index);
+            snapshots.end_reload();
+            std::cerr << "Index loaded, serving " << index_basename << std::endl;
+        } catch (std::exception &e) {
+            std::cerr << "Exception: " << e.what() << "\n";
+            std::exit(EXIT_FAILURE);
+        }
+    });
+    load_thread.detach();
+
+    // the posting lists of the terms used most are locked in memory, as soon as an index is published and then
+    // periodically, following the uses counted since the previous refresh
+    boost::thread lock_thread;
+    if (context.lock_budget > 0) {
+        std::cerr << "Locking the most used posting lists in " << options.lock_budget_mb << " MB, refreshed every "
+                  << options.lock_refresh_s << " s" << std::endl;
+        lock_thread = boost::thread([&snapshots, &index_type, &options, &context]() {
+            std::unordered_map<std::string, uint32_t> log_counts;
+            if (!options.lock_query_log.empty()) {
+                try {
+                    log_counts = query_server::read_query_log(options.lock_query_log);
+                } catch (std::exception &e) {
+                    std::cerr << "The query log is ignored: " << e.what() << std::endl;
+                }
+            }
+            std::weak_ptr<const sharded_index<IndexType, ScorerType>> locked_index;
+            unsigned int elapsed_s = 0;
+            try {
+                for (;;) {
+                    const auto index_ptr = snapshots.current();
+                    const bool published = index_ptr && locked_index.lock() != index_ptr;
+                    if (published || (index_ptr && elapsed_s >= options.lock_refresh_s)) {
+                        if (published) {
+                            count_query_log(*index_ptr, log_counts);
+                        }
+                        lock_hot_lists(*index_ptr, index_type, context.lock_budget);
+                        locked_index = index_ptr;
+                        elapsed_s = 0;
+                    }
+                    boost::this_thread::sleep_for(boost::chrono::seconds(1));
+                    ++elapsed_s;
+                }
+            } catch (const boost::thread_interrupted &) {
+                // the server is stopping
+            }
+        });
     }
 
-    // accepting connections
-    std::cerr << "Accepting connections" << std::endl;
-    while (true) {
-        auto sock = server.acceptConnection();
-        boost::thread t(boost::bind(session<IndexType, ScorerType>, sock, &segment_to_termid, &docid_to_new_docid, &index, wdata_ptr));
+    // accepting connections, the workers are pinned to the nodes of the replicas of the index, if any, and the
+    // threads they create inherit the pinning
+    const auto pin_worker = [&placement](std::size_t worker_id) { placement.pin_worker(worker_id); };
+    if (async_server) {
+        // the reactors read the requests, the workers evaluate them one at a time, thus an idle connection does not
+        // hold any worker
+        query_server::ThreadPool pool(options.num_threads, pin_worker);
+        std::cerr << "Accepting connections (" << async_server->num_reactors() << " reactors, "
+                  << pool.size() << " workers)" << std::endl;
+        async_server->run(&pool, context.admission, [&context](const std::string & request, std::string & reply, query_server::admission_ticket & ticket) {
+            return process_message(request.data(), request.size(), reply, context, ticket);
+        });
+    } else {
+        std::cerr << "Accepting connections (one thread per connection)" << std::endl;
+        for (std::size_t connection_id = 0; ; ++connection_id) {
+            auto sock = server->acceptConnection();
+            boost::thread t([sock, &context, &pin_worker, connection_id]() {
+                pin_worker(connection_id);
+                session<IndexType, ScorerType>(sock, &context);
+            });
+        }
     }
 
-    server.close();
+    signal_service.stop();
+    signal_thread.join();
+    lock_thread.interrupt();
+    if (lock_thread.joinable()) {
+        lock_thread.join();
+    }
+    if (server) {
+        server->close();
+    }
 }
 
 
@@ -318,7 +1507,9 @@ int main(
 
     try {
         if (argc <= 4) {
-            std::cerr << "Usage: " << argv[0] << " ip port index_type index_basename\n";
+            std::cerr << "Usage: " << argv[0] << " ip port index_type index_basename[,index_basename...] [options]\n";
+            std::cerr << "Several comma-separated basenames are served as the docid-partitioned shards of one index.\n";
+            std::cerr << "Options:\n" << query_server::server_options_usage();
             return -1;
         }
 
@@ -326,11 +1517,12 @@ int main(
         unsigned short port = static_cast<unsigned short>(std::atoi(argv[2]));
         std::string index_type = argv[3];
         std::string index_basename = argv[4];
+        query_server::server_options options = query_server::parse_server_options(argc, argv, 5);
 
         if (false) {
 #define LOOP_BODY(R, DATA, T)                                   \
         } else if (index_type == BOOST_PP_STRINGIZE(T)) {             \
-            server<BOOST_PP_CAT(T, _index), ds2i::bm25>(ip, port, index_type, index_basename);
+            server<BOOST_PP_CAT(T, _index), ds2i::bm25>(ip, port, index_type, index_basename, options);
             /**/
 
         BOOST_PP_SEQ_FOR_EACH(LOOP_BODY, _, DS2I_INDEX_TYPES);
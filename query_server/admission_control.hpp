@@ -0,0 +1,208 @@
+#ifndef INDEX_PARTITIONING_ADMISSION_CONTROL_HPP
+#define INDEX_PARTITIONING_ADMISSION_CONTROL_HPP
+
+#include <atomic>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+
+
+namespace query_server {
+    /**
+     * The admission state of a request, taken when it arrives
+     */
+    struct admission_ticket {
+        typedef std::chrono::steady_clock clock;
+
+        bool admitted;
+        std::size_t queue_depth; // requests waiting for an evaluation slot when this one arrived
+        clock::time_point arrival;
+        double queue_wait; // milliseconds spent waiting for an evaluation slot
+        std::size_t num_slots; // evaluation slots held, more than one by a batch evaluated in parallel
+
+        admission_ticket()
+                : admitted(true),
+                  queue_depth(0),
+                  arrival(clock::now()),
+                  queue_wait(0),
+                  num_slots(1) {}
+    };
+
+    /**
+     * Global limit on the requests being evaluated, with a bounded queue in front of the evaluation.
+     * A request is counted from its arrival until the end of its evaluation: when max_in_flight requests are being
+     * evaluated and max_queue are waiting, the new ones are shed instead of waiting.
+     * A request evaluating several queries at the same time, i.e., a batch, holds one slot for each of them. The
+     * requests growing their slots go first: no request starts while one of them is waiting, otherwise a steady flow
+     * of single requests would keep a batch waiting forever.
+     */
+    class AdmissionController {
+    public:
+        typedef admission_ticket::clock clock;
+
+        /**
+         * @param max_in_flight The maximum number of requests evaluated at the same time
+         * @param max_queue The maximum number of requests waiting for an evaluation slot
+         */
+        AdmissionController(std::size_t max_in_flight, std::size_t max_queue)
+                : _max_in_flight(max_in_flight),
+                  _max_queue(max_queue),
+                  _num_pending(0),
+                  _num_in_flight(0),
+                  _num_resizing(0),
+                  _num_shed(0) {
+            if (max_in_flight == 0) {
+                throw std::runtime_error("The maximum number of requests in flight must be greater than zero");
+            }
+        }
+
+        AdmissionController(const AdmissionController &) = delete;
+        AdmissionController & operator=(const AdmissionController &) = delete;
+
+        /**
+         * Registers the arrival of a request, deciding whether it is admitted or shed.
+         * It never blocks, thus it can be called by the network threads.
+         */
+        admission_ticket enter() {
+            admission_ticket ticket;
+
+            boost::unique_lock<boost::mutex> lock(this->_mutex);
+            const std::size_t num_waiting = this->_num_pending - this->_num_in_flight;
+            ticket.queue_depth = num_waiting;
+            if (this->_num_pending >= this->_max_in_flight + this->_max_queue) {
+                ticket.admitted = false;
+                ++this->_num_shed;
+                return ticket;
+            }
+            ++this->_num_pending;
+            return ticket;
+        }
+
+        /**
+         * Withdraws a request from the admission control, as if it had not arrived, e.g., an administrative request
+         * answered without evaluating anything. It must not have started.
+         */
+        void withdraw(admission_ticket & ticket) {
+            if (!ticket.admitted) {
+                --this->_num_shed;
+            } else {
+                boost::unique_lock<boost::mutex> lock(this->_mutex);
+                --this->_num_pending;
+            }
+            ticket.admitted = true;
+        }
+
+        /**
+         * Waits for an evaluation slot, after the requests growing their slots, the request must have been admitted by
+         * enter
+         */
+        void start(admission_ticket & ticket) {
+            boost::unique_lock<boost::mutex> lock(this->_mutex);
+            while (this->_num_in_flight >= this->_max_in_flight || this->_num_resizing > 0) {
+                this->_cond.wait(lock);
+            }
+            ++this->_num_in_flight;
+            ticket.num_slots = 1;
+            ticket.queue_wait = std::chrono::duration<double, std::milli>(clock::now() - ticket.arrival).count();
+        }
+
+        /**
+         * Waits until the request started holds num_slots evaluation slots, at most max_in_flight.
+         * The slots it holds are released while waiting, thus two requests growing their slots never wait for each
+         * other, meanwhile the request counts as waiting.
+         */
+        void resize(admission_ticket & ticket, std::size_t num_slots) {
+            if (num_slots > this->_max_in_flight) {
+                num_slots = this->_max_in_flight;
+            }
+            const clock::time_point begin = clock::now();
+            {
+                boost::unique_lock<boost::mutex> lock(this->_mutex);
+                this->_num_in_flight -= ticket.num_slots;
+                ++this->_num_resizing;
+                this->_cond.notify_all();
+                while (this->_num_in_flight + num_slots > this->_max_in_flight) {
+                    this->_cond.wait(lock);
+                }
+                --this->_num_resizing;
+                this->_num_in_flight += num_slots;
+                this->_num_pending = this->_num_pending - ticket.num_slots + num_slots;
+                ticket.num_slots = num_slots;
+            }
+            // the requests blocked by this one can start in the slots left
+            this->_cond.notify_all();
+            ticket.queue_wait += std::chrono::duration<double, std::milli>(clock::now() - begin).count();
+        }
+
+        /**
+         * Releases the evaluation slots taken by start and resize
+         */
+        void finish(const admission_ticket & ticket) {
+            {
+                boost::unique_lock<boost::mutex> lock(this->_mutex);
+                this->_num_in_flight -= ticket.num_slots;
+                this->_num_pending -= ticket.num_slots;
+            }
+            // the waiting requests may need different numbers of slots
+            this->_cond.notify_all();
+        }
+
+        /**
+         * @return The number of requests shed since the server started
+         */
+        uint64_t shed_count() const {
+            return this->_num_shed.load();
+        }
+
+    private:
+        const std::size_t _max_in_flight;
+        const std::size_t _max_queue;
+        boost::mutex _mutex;
+        boost::condition_variable _cond;
+        std::size_t _num_pending; // admitted requests, waiting or in flight
+        std::size_t _num_in_flight;
+        std::size_t _num_resizing; // requests waiting in resize, the new ones wait for them
+        std::atomic<uint64_t> _num_shed;
+    };
+
+
+    /**
+     * Keeps the evaluation slots of a request for the lifetime of the object
+     */
+    class AdmissionSlot {
+    public:
+        AdmissionSlot(AdmissionController * controller, admission_ticket & ticket)
+                : _controller(controller),
+                  _ticket(ticket) {
+            if (this->_controller != nullptr) {
+                this->_controller->start(ticket);
+            }
+        }
+
+        ~AdmissionSlot() {
+            if (this->_controller != nullptr) {
+                this->_controller->finish(this->_ticket);
+            }
+        }
+
+        /**
+         * Waits for num_slots evaluation slots, see AdmissionController::resize
+         */
+        void resize(std::size_t num_slots) {
+            if (this->_controller != nullptr) {
+                this->_controller->resize(this->_ticket, num_slots);
+            }
+        }
+
+        AdmissionSlot(const AdmissionSlot &) = delete;
+        AdmissionSlot & operator=(const AdmissionSlot &) = delete;
+
+    private:
+        AdmissionController * _controller;
+        admission_ticket & _ticket;
+    };
+}
+
+#endif //INDEX_PARTITIONING_ADMISSION_CONTROL_HPP
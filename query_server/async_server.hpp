@@ -0,0 +1,438 @@
+#ifndef INDEX_PARTITIONING_ASYNC_SERVER_HPP
+#define INDEX_PARTITIONING_ASYNC_SERVER_HPP
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/stream.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/thread/thread.hpp>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+
+#include "admission_control.hpp"
+#include "binary_protocol.hpp"
+#include "socket_exception.hpp"
+#include "thread_pool.hpp"
+
+
+namespace query_server {
+    using boost::asio::ip::tcp;
+
+    /**
+     * Writes the reply to a request whose evaluation failed in the protocol of the request: a binary error reply or a
+     * json object {"error": "..."}
+     */
+    inline void
+    encode_error_reply(const std::string & request, const char * error, std::string & reply) {
+        reply.clear();
+        if (binary_protocol::is_binary_message(request.data(), request.size())) {
+            binary_protocol::encode_reply(query_reply(), nullptr, binary_protocol::STATUS_ERROR, error, reply);
+            return;
+        }
+        boost::property_tree::ptree json;
+        json.put<std::string>("error", error);
+        boost::iostreams::stream<boost::iostreams::back_insert_device<std::string>> ss(reply);
+        boost::property_tree::write_json(ss, json, false);
+        ss.flush();
+    }
+
+    /**
+     * Event-driven server using the same framing of %Socket: every message is preceded by its size as unsigned int.
+     * A few reactors (one io_service and one thread each) read the frames without blocking and hand the complete
+     * requests to a pool of workers, so that an idle connection does not cost any thread.
+     *
+     * A frame larger than the maximum frame size closes its connection, thus a client cannot make the server allocate
+     * more than that for every request it pipelines.
+     *
+     * A client can pipeline its requests: the frames are read while the previous requests are being evaluated, up
+     * to max_pipelined_requests per connection. The replies to the requests marked by the handler as unordered are
+     * sent as soon as they are ready, the other ones are sent after the replies to all the previous requests.
+     */
+    class AsyncServer {
+    public:
+        /**
+         * Function transforming a request message into its reply message, given its admission state.
+         * It returns true if the reply can be sent before the ones of the previous requests.
+         */
+        typedef std::function<bool(const std::string & request, std::string & reply, admission_ticket & ticket)> handler_type;
+
+        /**
+         * Maximum number of requests of one connection evaluated or waiting to be sent at the same time
+         */
+        static const std::size_t max_pipelined_requests = 64;
+
+        /**
+         * Milliseconds waited before accepting again after a failed accept, e.g., when the file descriptors are
+         * exhausted, instead of failing again right away
+         */
+        static const unsigned int accept_backoff_ms = 100;
+
+    private:
+        /**
+         * A request and its reply
+         */
+        struct Exchange {
+            uint64_t seq;
+            std::string request;
+            std::string reply;
+            unsigned int reply_size;
+            bool unordered;
+            admission_ticket ticket;
+        };
+
+        /**
+         * All the methods of a connection are executed by the thread of its reactor, except the handler
+         */
+        class Connection : public std::enable_shared_from_this<Connection> {
+        public:
+            Connection(boost::asio::io_service *io_service, ThreadPool *workers, AdmissionController *admission, const handler_type *handler, unsigned int max_frame_size)
+                    : _io_service(io_service),
+                      _sock(*io_service),
+                      _workers(workers),
+                      _admission(admission),
+                      _handler(handler),
+                      _max_frame_size(max_frame_size),
+                      _request_size(0),
+                      _next_seq(0),
+                      _reading(false),
+                      _read_closed(false),
+                      _writing(false),
+                      _closed(false) {}
+
+            tcp::socket & socket() {
+                return this->_sock;
+            }
+
+            void start() {
+                boost::system::error_code ec;
+                this->_sock.set_option(tcp::no_delay(true), ec);
+                this->read_header();
+            }
+
+        private:
+            std::size_t in_flight() const {
+                return this->_outstanding.size() + this->_writes.size();
+            }
+
+            void read_header() {
+                this->_reading = true;
+                boost::asio::async_read(
+                        this->_sock,
+                        boost::asio::buffer(&this->_request_size, sizeof(unsigned int)),
+                        boost::bind(&Connection::on_header, this->shared_from_this(), boost::asio::placeholders::error)
+                );
+            }
+
+            void on_header(const boost::system::error_code &error) {
+                if (error) {
+                    this->on_read_error(error);
+                    return;
+                }
+                if (this->_request_size > this->_max_frame_size) {
+                    std::cerr << "Exception in connection: " << SocketMessageSizeException().what() << " ("
+                              << this->_request_size << " bytes)" << std::endl;
+                    this->_reading = false;
+                    this->close();
+                    return;
+                }
+                // the exchanges are recycled, thus their buffers are allocated only when they have to grow
+                std::shared_ptr<Exchange> exchange;
+                if (this->_free_exchanges.empty()) {
+                    exchange = std::make_shared<Exchange>();
+                } else {
+                    exchange = std::move(this->_free_exchanges.back());
+                    this->_free_exchanges.pop_back();
+                }
+                exchange->seq = this->_next_seq++;
+                exchange->request.resize(this->_request_size);
+                boost::asio::async_read(
+                        this->_sock,
+                        boost::asio::buffer(&exchange->request[0], exchange->request.size()),
+                        boost::bind(&Connection::on_body, this->shared_from_this(), exchange, boost::asio::placeholders::error)
+                );
+            }
+
+            void on_body(std::shared_ptr<Exchange> exchange, const boost::system::error_code &error) {
+                this->_reading = false;
+                if (error) {
+                    this->on_read_error(error);
+                    return;
+                }
+
+                this->_outstanding.insert(exchange->seq);
+                exchange->ticket = this->_admission != nullptr ? this->_admission->enter() : admission_ticket();
+                if (!exchange->ticket.admitted) {
+                    // a shed request is answered right away, without waiting for a worker
+                    this->handle(exchange);
+                    this->on_evaluated(exchange);
+                } else {
+                    // evaluate the request on a worker, the reactor goes back to serve the other connections
+                    auto self = this->shared_from_this();
+                    this->_workers->submit([self, exchange]() {
+                        self->handle(exchange);
+                        self->_io_service->post(boost::bind(&Connection::on_evaluated, self, exchange));
+                    });
+                }
+
+                // go on reading the pipelined requests
+                if (this->in_flight() < max_pipelined_requests) {
+                    this->read_header();
+                }
+            }
+
+            void handle(const std::shared_ptr<Exchange> & exchange) {
+                try {
+                    exchange->unordered = (*this->_handler)(exchange->request, exchange->reply, exchange->ticket);
+                } catch (const std::exception &e) {
+                    std::cerr << "Exception in handler: " << e.what() << std::endl;
+                    // an empty frame cannot be parsed by the clients
+                    encode_error_reply(exchange->request, e.what(), exchange->reply);
+                    exchange->unordered = false;
+                }
+            }
+
+            void on_evaluated(std::shared_ptr<Exchange> exchange) {
+                if (this->_closed) {
+                    return;
+                }
+
+                if (exchange->unordered || exchange->seq == *this->_outstanding.begin()) {
+                    this->enqueue_write(exchange);
+                } else {
+                    this->_held[exchange->seq] = exchange;
+                }
+
+                // the ordered replies waiting only for the current one can be sent too
+                while (!this->_held.empty() && !this->_outstanding.empty() &&
+                       this->_held.begin()->first == *this->_outstanding.begin()) {
+                    this->enqueue_write(this->_held.begin()->second);
+                    this->_held.erase(this->_held.begin());
+                }
+
+                if (!this->_writing) {
+                    this->write_next();
+                }
+            }
+
+            void enqueue_write(std::shared_ptr<Exchange> exchange) {
+                this->_outstanding.erase(exchange->seq);
+                this->_writes.push_back(exchange);
+            }
+
+            void write_next() {
+                if (this->_writes.empty()) {
+                    this->_writing = false;
+                    return;
+                }
+                std::shared_ptr<Exchange> exchange = this->_writes.front();
+                if (exchange->reply.size() > static_cast<unsigned int>(-1)) {
+                    std::cerr << "Exception in connection: " << SocketMessageSizeException().what() << std::endl;
+                    this->close();
+                    return;
+                }
+                exchange->reply_size = static_cast<unsigned int>(exchange->reply.size());
+                this->_writing = true;
+
+                // send the size and the message with a single gather write
+                std::vector<boost::asio::const_buffer> buffers;
+                buffers.push_back(boost::asio::buffer(&exchange->reply_size, sizeof(unsigned int)));
+                buffers.push_back(boost::asio::buffer(exchange->reply));
+                boost::asio::async_write(
+                        this->_sock,
+                        buffers,
+                        boost::bind(&Connection::on_reply_written, this->shared_from_this(), exchange, boost::asio::placeholders::error)
+                );
+            }
+
+            void on_reply_written(std::shared_ptr<Exchange> exchange, const boost::system::error_code &error) {
+                if (error) {
+                    this->log_error(error);
+                    this->close();
+                    return;
+                }
+                this->_writes.pop_front();
+                this->_free_exchanges.push_back(std::move(exchange));
+
+                if (this->_read_closed && this->in_flight() == 0) {
+                    this->close();
+                    return;
+                }
+                // resume the reading stopped by a full pipeline
+                if (!this->_reading && !this->_read_closed && this->in_flight() < max_pipelined_requests) {
+                    this->read_header();
+                }
+                this->write_next();
+            }
+
+            void on_read_error(const boost::system::error_code &error) {
+                this->log_error(error);
+                // the replies to the pipelined requests are sent before closing the connection
+                this->_read_closed = true;
+                if (this->in_flight() == 0) {
+                    this->close();
+                }
+            }
+
+            void log_error(const boost::system::error_code &error) {
+                namespace error_ns = boost::asio::error;
+                if (error != error_ns::eof && error != error_ns::connection_reset && error != error_ns::broken_pipe &&
+                    error != error_ns::operation_aborted) {
+                    std::cerr << "Exception in connection: " << error.message() << std::endl;
+                }
+            }
+
+            void close() {
+                if (this->_closed) {
+                    return;
+                }
+                this->_closed = true;
+                this->_writes.clear();
+                this->_held.clear();
+                boost::system::error_code ec;
+                this->_sock.shutdown(tcp::socket::shutdown_both, ec);
+                this->_sock.close(ec);
+            }
+
+        private:
+            boost::asio::io_service *_io_service;
+            tcp::socket _sock;
+            ThreadPool *_workers;
+            AdmissionController *_admission;
+            const handler_type *_handler;
+            const unsigned int _max_frame_size;
+            unsigned int _request_size;
+            uint64_t _next_seq;
+            std::set<uint64_t> _outstanding; // requests whose reply has not been enqueued yet
+            std::map<uint64_t, std::shared_ptr<Exchange>> _held; // ordered replies waiting for the previous ones
+            std::deque<std::shared_ptr<Exchange>> _writes; // replies to send, the first one is being sent
+            std::vector<std::shared_ptr<Exchange>> _free_exchanges; // exchanges ready to be reused
+            bool _reading;
+            bool _read_closed;
+            bool _writing;
+            bool _closed;
+        };
+
+    public:
+        /**
+         * Binds the listening socket
+         * @param num_reactors The number of threads waiting for network events
+         * @param max_frame_size The maximum size of a request, in bytes
+         */
+        AsyncServer(const char *ip, unsigned short port, std::size_t num_reactors, unsigned int max_frame_size)
+                : _io_services(num_reactors == 0 ? 1 : num_reactors),
+                  _acceptor(this->_io_services[0], tcp::endpoint(boost::asio::ip::address::from_string(ip), port)),
+                  _accept_timer(this->_io_services[0]),
+                  _max_frame_size(max_frame_size),
+                  _next_reactor(0),
+                  _workers(nullptr),
+                  _admission(nullptr) {
+            raise_open_files_limit();
+        }
+
+        /**
+         * Accepts and serves the connections until the server is stopped
+         * @param workers The pool evaluating the requests
+         * @param admission The admission control applied when the requests arrive, nullptr to admit all of them
+         * @param handler The function transforming a request into its reply, called by the workers
+         */
+        void run(ThreadPool *workers, AdmissionController *admission, handler_type handler) {
+            this->_workers = workers;
+            this->_admission = admission;
+            this->_handler = std::move(handler);
+
+            std::vector<std::unique_ptr<boost::asio::io_service::work>> works;
+            for (auto &io_service: this->_io_services) {
+                works.emplace_back(new boost::asio::io_service::work(io_service));
+            }
+
+            this->accept();
+
+            boost::thread_group reactors;
+            for (auto &io_service: this->_io_services) {
+                reactors.create_thread(boost::bind(&AsyncServer::run_reactor, &io_service));
+            }
+            reactors.join_all();
+        }
+
+        /**
+         * Stops the reactors, the connections are closed
+         */
+        void stop() {
+            for (auto &io_service: this->_io_services) {
+                io_service.stop();
+            }
+        }
+
+        std::size_t num_reactors() const {
+            return this->_io_services.size();
+        }
+
+    private:
+        void accept() {
+            // the connections are spread among the reactors in a round-robin fashion
+            boost::asio::io_service *io_service = &this->_io_services[this->_next_reactor];
+            this->_next_reactor = (this->_next_reactor + 1) % this->_io_services.size();
+
+            std::shared_ptr<Connection> connection = std::make_shared<Connection>(io_service, this->_workers, this->_admission, &this->_handler, this->_max_frame_size);
+            this->_acceptor.async_accept(
+                    connection->socket(),
+                    boost::bind(&AsyncServer::on_accept, this, connection, boost::asio::placeholders::error)
+            );
+        }
+
+        void on_accept(std::shared_ptr<Connection> connection, const boost::system::error_code &error) {
+            if (!error) {
+                connection->start();
+            } else if (error != boost::asio::error::operation_aborted) {
+                std::cerr << "Exception in accept: " << error.message() << std::endl;
+                this->_accept_timer.expires_from_now(boost::posix_time::milliseconds(accept_backoff_ms));
+                this->_accept_timer.async_wait(boost::bind(&AsyncServer::accept, this));
+                return;
+            }
+            this->accept();
+        }
+
+        static void run_reactor(boost::asio::io_service *io_service) {
+            for (;;) {
+                try {
+                    io_service->run();
+                    return;
+                } catch (const std::exception &e) {
+                    std::cerr << "Exception in reactor: " << e.what() << std::endl;
+                }
+            }
+        }
+
+        /**
+         * Every open connection costs a file descriptor, thus the soft limit is raised up to the hard one
+         */
+        static void raise_open_files_limit() {
+            struct rlimit limit;
+            if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+                limit.rlim_cur = limit.rlim_max;
+                setrlimit(RLIMIT_NOFILE, &limit);
+            }
+        }
+
+    private:
+        std::vector<boost::asio::io_service> _io_services;
+        tcp::acceptor _acceptor;
+        boost::asio::deadline_timer _accept_timer; // delays the accept after a failure
+        const unsigned int _max_frame_size;
+        std::size_t _next_reactor;
+        ThreadPool *_workers;
+        AdmissionController *_admission;
+        handler_type _handler;
+    };
+}
+
+#endif //INDEX_PARTITIONING_ASYNC_SERVER_HPP
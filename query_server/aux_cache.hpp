@@ -0,0 +1,200 @@
+#ifndef INDEX_PARTITIONING_AUX_CACHE_HPP
+#define INDEX_PARTITIONING_AUX_CACHE_HPP
+
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+
+/**
+ * Binary snapshots of the structures parsed from the auxiliary files of an index (.terms, .mterms, .docids.map),
+ * written as <source>.cache on the first load and memory-mapped by the following ones.
+ * A snapshot is used only if it has been written from a source with the same size and modification time, and if
+ * its payload matches the checksum; otherwise the structure is parsed again from the source and the snapshot is
+ * rewritten. All the integers are in native byte order.
+ *
+ *   offset  size  field
+ *        0     4  magic "QSAC"
+ *        4     4  format version of the header
+ *        8     4  kind of the structure, e.g., "LEXI"
+ *       12     4  version of the structure
+ *       16     8  size of the source
+ *       24     8  modification time of the source, in ns
+ *       32     8  payload_size
+ *       40     8  checksum of the payload
+ *       48    16  reserved, 0
+ *       64        payload
+ */
+namespace query_server {
+    namespace aux_cache {
+        const uint32_t format_version = 1;
+        const std::size_t header_size = 64;
+
+        /**
+         * The size and the modification time of a source file
+         */
+        struct source_stamp {
+            uint64_t size;
+            int64_t mtime_ns;
+        };
+
+        std::string
+        cache_path(
+                const std::string & source_path
+        ) {
+            return source_path + ".cache";
+        }
+
+        /**
+         * @return False if the source cannot be accessed
+         */
+        bool
+        stat_source(
+                const std::string & source_path,
+                source_stamp & stamp
+        ) {
+            struct stat st;
+            if (::stat(source_path.c_str(), &st) != 0) {
+                return false;
+            }
+            stamp.size = static_cast<uint64_t>(st.st_size);
+            stamp.mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+            return true;
+        }
+
+        /**
+         * Hashes the payload 8 bytes at a time, fast enough to be verified at every load
+         */
+        uint64_t
+        checksum(
+                const char * data,
+                std::size_t size
+        ) {
+            uint64_t h = 0x9E3779B97F4A7C15ull ^ size;
+            std::size_t i = 0;
+            for (; i + 8 <= size; i += 8) {
+                uint64_t word;
+                std::memcpy(&word, data + i, 8);
+                h = (h ^ word) * 0xFF51AFD7ED558CCDull;
+                h ^= h >> 32;
+            }
+            for (; i < size; ++i) {
+                h = (h ^ static_cast<unsigned char>(data[i])) * 0xC4CEB9FE1A85EC53ull;
+            }
+            return h ^ (h >> 29);
+        }
+
+        /**
+         * Maps the snapshot of a source, if it is still valid
+         * @param kind The 4 characters identifying the structure
+         * @param payload Filled with the address of the payload inside file
+         * @return False if the snapshot is missing, stale or corrupted, the reason is logged
+         */
+        bool
+        open(
+                const std::string & source_path,
+                const char * kind,
+                uint32_t kind_version,
+                boost::iostreams::mapped_file_source & file,
+                const char * & payload,
+                std::size_t & payload_size
+        ) {
+            const std::string path = cache_path(source_path);
+            if (access(path.c_str(), F_OK) == -1) {
+                return false;
+            }
+            source_stamp stamp;
+            if (!stat_source(source_path, stamp)) {
+                return false;
+            }
+
+            try {
+                file.open(path);
+            } catch (const std::exception &e) {
+                std::cerr << " aux_cache: unable to map " << path << ": " << e.what() << std::endl;
+                return false;
+            }
+            const char * data = file.data();
+            const std::size_t size = file.size();
+
+            uint32_t header_version, cached_kind_version;
+            uint64_t cached_size, cached_payload_size, cached_checksum;
+            int64_t cached_mtime_ns;
+            const char * reason = nullptr;
+            if (size < header_size || std::memcmp(data, "QSAC", 4) != 0) {
+                reason = "not a snapshot";
+            } else {
+                std::memcpy(&header_version, data + 4, 4);
+                std::memcpy(&cached_kind_version, data + 12, 4);
+                std::memcpy(&cached_size, data + 16, 8);
+                std::memcpy(&cached_mtime_ns, data + 24, 8);
+                std::memcpy(&cached_payload_size, data + 32, 8);
+                std::memcpy(&cached_checksum, data + 40, 8);
+                if (header_version != format_version || std::memcmp(data + 8, kind, 4) != 0 || cached_kind_version != kind_version) {
+                    reason = "written by another version";
+                } else if (cached_size != stamp.size || cached_mtime_ns != stamp.mtime_ns) {
+                    reason = "the source has changed";
+                } else if (cached_payload_size != size - header_size || checksum(data + header_size, size - header_size) != cached_checksum) {
+                    reason = "corrupted";
+                }
+            }
+            if (reason != nullptr) {
+                std::cerr << " aux_cache: ignoring " << path << ", " << reason << std::endl;
+                file.close();
+                return false;
+            }
+
+            payload = data + header_size;
+            payload_size = size - header_size;
+            return true;
+        }
+
+        /**
+         * Writes the snapshot of a source, replacing the previous one atomically
+         * @param stamp The stamp of the source taken before parsing it
+         * @return False if the snapshot cannot be written, e.g., in a read-only directory, the reason is logged
+         */
+        bool
+        write(
+                const std::string & source_path,
+                const source_stamp & stamp,
+                const char * kind,
+                uint32_t kind_version,
+                const std::string & payload
+        ) {
+            const std::string path = cache_path(source_path);
+            const std::string tmp_path = path + ".tmp." + std::to_string(getpid());
+
+            char header[header_size] = {};
+            const uint64_t payload_size = payload.size();
+            const uint64_t payload_checksum = checksum(payload.data(), payload.size());
+            std::memcpy(header, "QSAC", 4);
+            std::memcpy(header + 4, &format_version, 4);
+            std::memcpy(header + 8, kind, 4);
+            std::memcpy(header + 12, &kind_version, 4);
+            std::memcpy(header + 16, &stamp.size, 8);
+            std::memcpy(header + 24, &stamp.mtime_ns, 8);
+            std::memcpy(header + 32, &payload_size, 8);
+            std::memcpy(header + 40, &payload_checksum, 8);
+
+            std::ofstream out(tmp_path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+            out.write(header, header_size);
+            out.write(payload.data(), static_cast<std::streamsize>(payload.size()));
+            out.close();
+            if (!out || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+                std::cerr << " aux_cache: unable to write " << path << std::endl;
+                std::remove(tmp_path.c_str());
+                return false;
+            }
+            return true;
+        }
+    }
+}
+
+#endif //INDEX_PARTITIONING_AUX_CACHE_HPP
@@ -0,0 +1,373 @@
+#ifndef INDEX_PARTITIONING_BACKEND_POOL_HPP
+#define INDEX_PARTITIONING_BACKEND_POOL_HPP
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/chrono.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "socket.hpp"
+#include "thread_pool.hpp"
+
+
+namespace query_server {
+    /**
+     * Lets a thread abort the calls of the other ones to the backends, e.g., when their deadline has passed: the
+     * connections of the running calls are shut down, thus their threads stop waiting for the replies.
+     */
+    class CallCancellation {
+    public:
+        CallCancellation()
+                : _cancelled(false) {}
+
+        CallCancellation(const CallCancellation &) = delete;
+        CallCancellation & operator=(const CallCancellation &) = delete;
+
+        /**
+         * Registers the connection of a call about to start
+         * @return False if the calls have been cancelled, then the call must not start
+         */
+        bool add(Socket * connection) {
+            boost::lock_guard<boost::mutex> lock(this->_mutex);
+            if (this->_cancelled) {
+                return false;
+            }
+            this->_connections.push_back(connection);
+            return true;
+        }
+
+        /**
+         * Unregisters the connection of a call ended
+         * @return False if the calls have been cancelled meanwhile, then the connection may have been shut down
+         */
+        bool remove(Socket * connection) {
+            boost::lock_guard<boost::mutex> lock(this->_mutex);
+            this->_connections.erase(std::find(this->_connections.begin(), this->_connections.end(), connection));
+            return !this->_cancelled;
+        }
+
+        /**
+         * Aborts the running calls and the ones about to start
+         */
+        void cancel() {
+            boost::lock_guard<boost::mutex> lock(this->_mutex);
+            this->_cancelled = true;
+            for (Socket * connection: this->_connections) {
+                connection->abort();
+            }
+        }
+
+        bool cancelled() {
+            boost::lock_guard<boost::mutex> lock(this->_mutex);
+            return this->_cancelled;
+        }
+
+    private:
+        boost::mutex _mutex;
+        bool _cancelled;
+        std::vector<Socket *> _connections;
+    };
+
+
+    /**
+     * The connections to one query_server, given as ip:port.
+     * The idle connections are kept and reused by the following requests.
+     */
+    class BackendConnections {
+    public:
+        typedef boost::chrono::steady_clock clock;
+
+        /**
+         * @param address The address of the backend, as ip:port
+         * @throws std::runtime_error If the address is malformed
+         */
+        BackendConnections(const std::string & address)
+                : _address(address) {
+            const std::size_t colon = address.rfind(':');
+            if (colon == std::string::npos || colon == 0 || colon + 1 == address.size()) {
+                throw std::runtime_error("Invalid backend address \"" + address + "\", expected ip:port");
+            }
+            this->_ip = address.substr(0, colon);
+            this->_port = static_cast<unsigned short>(std::atoi(address.c_str() + colon + 1));
+        }
+
+        BackendConnections(const BackendConnections &) = delete;
+        BackendConnections & operator=(const BackendConnections &) = delete;
+
+        ~BackendConnections() {
+            for (SocketClient * connection: this->_idle) {
+                delete connection;
+            }
+        }
+
+        /**
+         * Sends a message and waits for its reply, on an idle connection or on a new one
+         * @param cancellation Optional, aborts the call, whose connection is then closed
+         * @param connect_deadline The time after which a new connection stops waiting for the backend
+         * @throws SocketException If the backend cannot be reached, it closes the connection or the call is cancelled
+         */
+        void call(const std::string & message, std::string & reply, CallCancellation * cancellation, clock::time_point connect_deadline) {
+            // an idle connection can have been closed by the backend, then the message is sent on a new one
+            for (;;) {
+                if (cancellation != nullptr && cancellation->cancelled()) {
+                    throw SocketException("Call cancelled");
+                }
+                bool reused = false;
+                std::unique_ptr<SocketClient> connection(this->acquire(reused));
+                // a new connection is registered before connecting, thus the cancellation stops its connect too
+                if (cancellation != nullptr && !cancellation->add(connection.get())) {
+                    if (reused) {
+                        this->release(connection.release());
+                    }
+                    throw SocketException("Call cancelled");
+                }
+                std::string error;
+                try {
+                    if (!reused) {
+                        connection->connect(this->_ip.c_str(), this->_port, connect_deadline);
+                    }
+                    connection->send_message(message);
+                    std::size_t reply_size;
+                    const char * reply_data = connection->receive_message(reply_size);
+                    reply.assign(reply_data, reply_size);
+                } catch (const SocketException &e) {
+                    error = e.what();
+                }
+                // a connection shut down by the cancellation is not reused
+                const bool intact = cancellation == nullptr || cancellation->remove(connection.get());
+                if (!error.empty()) {
+                    if (reused && intact) {
+                        continue;
+                    }
+                    throw SocketException(intact ? error.c_str() : "Call cancelled");
+                }
+                if (intact) {
+                    this->release(connection.release());
+                }
+                return;
+            }
+        }
+
+        const std::string & address() const {
+            return this->_address;
+        }
+
+    private:
+        /**
+         * @return An idle connection, or a new one not connected yet
+         */
+        SocketClient * acquire(bool & reused) {
+            {
+                boost::lock_guard<boost::mutex> lock(this->_mutex);
+                if (!this->_idle.empty()) {
+                    SocketClient * connection = this->_idle.back();
+                    this->_idle.pop_back();
+                    reused = true;
+                    return connection;
+                }
+            }
+            reused = false;
+            return new SocketClient(&this->_io_service);
+        }
+
+        void release(SocketClient * connection) {
+            boost::lock_guard<boost::mutex> lock(this->_mutex);
+            this->_idle.push_back(connection);
+        }
+
+    private:
+        std::string _address;
+        std::string _ip;
+        unsigned short _port;
+        boost::asio::io_service _io_service; // only used by the blocking operations of the connections
+        boost::mutex _mutex;
+        std::vector<SocketClient *> _idle;
+    };
+
+
+    /**
+     * The replies of the shards to one message
+     */
+    struct fan_out_result {
+        std::vector<std::string> replies;
+        std::vector<bool> answered; // false for the shards that failed or missed the deadline
+        std::vector<bool> hedged; // the message has been sent a second time to the shard
+    };
+
+
+    /**
+     * Sends a message to a list of shards in parallel and gathers their replies until a deadline.
+     * Every shard is served by one or more replicas, the message is sent to the first one and, if it cannot be reached,
+     * to the following ones. When hedging is enabled, the shards that have not answered after hedge_ms receive the
+     * message again, on their next replica or on a new connection to the same one, and the first reply wins.
+     * The calls are executed by a pool of workers. The calls still running at the deadline, or once all the shards
+     * have answered, e.g., the hedged ones, are cancelled and their connections closed, even while connecting, thus a
+     * backend that does not answer, or does not accept the connection, holds a worker until the deadline at most.
+     */
+    class FanOut {
+    public:
+        typedef boost::chrono::steady_clock clock;
+
+        /**
+         * @param shards The addresses of the replicas of every shard
+         * @param num_threads The number of workers waiting for the replies of the backends
+         * @param timeout_ms The time given to the shards to answer, 0 means no deadline
+         * @param hedge_ms The time after which a shard is hedged, 0 disables the hedging
+         */
+        FanOut(const std::vector<std::vector<std::string>> & shards, std::size_t num_threads, unsigned int timeout_ms, unsigned int hedge_ms)
+                : _workers(num_threads),
+                  _timeout_ms(timeout_ms),
+                  _hedge_ms(hedge_ms) {
+            if (shards.empty()) {
+                throw std::runtime_error("At least one backend is required");
+            }
+            for (const auto & replicas: shards) {
+                if (replicas.empty()) {
+                    throw std::runtime_error("Every shard needs at least one backend");
+                }
+                this->_shards.emplace_back();
+                for (const std::string & address: replicas) {
+                    this->_shards.back().emplace_back(new BackendConnections(address));
+                }
+            }
+        }
+
+        FanOut(const FanOut &) = delete;
+        FanOut & operator=(const FanOut &) = delete;
+
+        std::size_t num_shards() const {
+            return this->_shards.size();
+        }
+
+        /**
+         * Sends the message to all the shards and waits for their replies
+         */
+        void send(const std::string & message, fan_out_result & result) {
+            const std::size_t num_shards = this->_shards.size();
+            std::shared_ptr<call_state> state(new call_state());
+            state->message = message;
+            state->replies.resize(num_shards);
+            state->answered.assign(num_shards, false);
+            state->num_calls.assign(num_shards, 1);
+            state->num_finished = 0;
+            state->closed = false;
+            result.hedged.assign(num_shards, false);
+
+            const clock::time_point start = clock::now();
+            const clock::time_point deadline = start + boost::chrono::milliseconds(this->_timeout_ms);
+            state->deadline = this->_timeout_ms > 0 ? deadline : clock::time_point::max();
+
+            for (std::size_t s = 0; s < num_shards; ++s) {
+                this->submit(state, s, 0);
+            }
+
+            const clock::time_point hedge_time = start + boost::chrono::milliseconds(this->_hedge_ms);
+            bool hedging_done = this->_hedge_ms == 0;
+
+            boost::unique_lock<boost::mutex> lock(state->mutex);
+            while (state->num_finished < num_shards) {
+                if (hedging_done && this->_timeout_ms == 0) {
+                    state->cond.wait(lock);
+                    continue;
+                }
+                clock::time_point wake_up = hedging_done || (this->_timeout_ms > 0 && deadline < hedge_time) ? deadline : hedge_time;
+                state->cond.wait_until(lock, wake_up);
+
+                const clock::time_point now = clock::now();
+                if (this->_timeout_ms > 0 && now >= deadline) {
+                    break;
+                }
+                if (!hedging_done && now >= hedge_time) {
+                    hedging_done = true;
+                    for (std::size_t s = 0; s < num_shards; ++s) {
+                        if (!state->answered[s] && state->num_calls[s] > 0) {
+                            result.hedged[s] = true;
+                            ++state->num_calls[s];
+                            this->submit(state, s, 1);
+                        }
+                    }
+                }
+            }
+
+            // the late replies are discarded and the calls still running are aborted
+            state->closed = true;
+            state->cancellation.cancel();
+            result.replies.swap(state->replies);
+            result.answered = state->answered;
+        }
+
+    private:
+        /**
+         * The state of one message, shared with the workers calling the backends
+         */
+        struct call_state {
+            std::string message;
+            boost::mutex mutex;
+            boost::condition_variable cond;
+            std::vector<std::string> replies;
+            std::vector<bool> answered;
+            std::vector<std::size_t> num_calls; // calls of each shard still running, 0 when all of them failed
+            std::size_t num_finished; // shards answered or failed
+            bool closed;
+            clock::time_point deadline; // time_point::max() without a deadline
+            CallCancellation cancellation;
+        };
+
+        void submit(const std::shared_ptr<call_state> & state, std::size_t shard, std::size_t replica) {
+            this->_workers.submit(boost::bind(&FanOut::call, this, state, shard, replica));
+        }
+
+        void call(std::shared_ptr<call_state> state, std::size_t shard, std::size_t replica) {
+            const auto & replicas = this->_shards[shard];
+            BackendConnections * backend = replicas[replica % replicas.size()].get();
+            std::string reply;
+            bool failed = false;
+            try {
+                backend->call(state->message, reply, &state->cancellation, state->deadline);
+            } catch (const std::exception &e) {
+                if (!state->cancellation.cancelled()) {
+                    std::cerr << "Backend " << backend->address() << " failed: " << e.what() << std::endl;
+                }
+                failed = true;
+            }
+
+            {
+                boost::lock_guard<boost::mutex> lock(state->mutex);
+                if (state->closed || state->answered[shard]) {
+                    return;
+                }
+                if (failed) {
+                    // fail over to the next replica, the shard fails when all of them have been tried
+                    if (replica + 1 < replicas.size()) {
+                        this->submit(state, shard, replica + 1);
+                        return;
+                    }
+                    if (--state->num_calls[shard] > 0) {
+                        return;
+                    }
+                } else {
+                    state->replies[shard].swap(reply);
+                    state->answered[shard] = true;
+                }
+                ++state->num_finished;
+            }
+            state->cond.notify_all();
+        }
+
+    private:
+        std::vector<std::vector<std::unique_ptr<BackendConnections>>> _shards;
+        ThreadPool _workers;
+        const unsigned int _timeout_ms;
+        const unsigned int _hedge_ms;
+    };
+}
+
+#endif //INDEX_PARTITIONING_BACKEND_POOL_HPP
@@ -0,0 +1,550 @@
+#ifndef INDEX_PARTITIONING_BINARY_PROTOCOL_HPP
+#define INDEX_PARTITIONING_BINARY_PROTOCOL_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
+
+#include "query_request.hpp"
+
+
+/**
+ * Compact binary alternative to the json messages, carried by the same %Socket framing.
+ * Every binary message starts with the magic "QSB" followed by the protocol version, so that it cannot be confused
+ * with a json message. The server answers a binary request with a binary reply. All the integers are little-endian.
+ *
+ * Request:
+ *   offset  size  field
+ *        0     4  magic "QSB" + version
+ *        4     1  query_type (see QueryType)
+ *        5     1  flags: bit 0 query_normalization, bit 1 lexemes instead of term ids, bit 2 has id, bit 3 has rel,
+ *                 bit 4 has timeout, bit 5 skip the unknown rel docids
+ *        6     2  num_groups (OR groups of a cnf query, 1 for flat queries)
+ *        8     4  ranked_at (0 when the documents are not ranked)
+ *       12     4  num_rel
+ *       16     8  id
+ *       24     4  timeout_ms (0 means no deadline, used only with the has timeout flag)
+ *       28     4  reserved
+ *       32        for each group: u16 num_terms followed by num_terms u32 term ids,
+ *                 or by num_terms lexemes encoded as u16 size + bytes
+ *                 num_rel u64 original docids
+ *
+ * Reply:
+ *        0     4  magic "QSB" + version
+ *        4     1  status (see BinaryReplyStatus)
+ *        5     1  flags: bit 0 has id, bit 1 has rel, bit 2 has admission statistics, bit 3 has deadline,
+ *                 bit 4 timed out (the result is partial), bit 5 has results, bit 6 num_hits is exact, bit 7 has shards
+ *        6     1  extended flags: bit 0 partial (some shards are missing), bit 1 has segments, bit 2 has prefetch,
+ *                 bit 3 cached (the results come from the result cache)
+ *        7     1  reserved
+ *        8     8  id
+ *       16     8  num_ret
+ *       24     8  num_rel_ret
+ *       32     8  num_rel
+ *       40     8  exe_time (IEEE 754 double, milliseconds)
+ *       48     8  queue_depth
+ *       56     8  queue_wait (IEEE 754 double, milliseconds)
+ *       64     8  shed_count
+ *       72        when status is not ok: u32 size + error message
+ *                 when the reply has results: u64 num_hits, u32 num_results and, for each result,
+ *                 u64 original docid + f32 score (IEEE 754 float), sorted by decreasing score
+ *                 when the reply has shards: u32 num_shards and, for each shard, f64 exe_time + u64 num_ret + u8 flags
+ *                 (bit 0 missing, bit 1 hedged)
+ *                 when the reply has segments: the missing segments then the unknown ones, each list as u32 num_segments
+ *                 followed by the segments encoded as u16 size + bytes
+ *                 when the reply has prefetch: u64 prefetched_lists, u64 prefetch_faults, f64 prefetch_wait
+ *                 (milliseconds), u64 major_faults
+ */
+namespace query_server {
+    namespace binary_protocol {
+        const uint8_t version = 1;
+        const char magic[3] = {'Q', 'S', 'B'};
+        const std::size_t request_header_size = 32;
+        const std::size_t reply_header_size = 72;
+
+        enum RequestFlags : uint8_t {
+            REQUEST_NORMALIZATION = 1,
+            REQUEST_LEXEMES = 2,
+            REQUEST_HAS_ID = 4,
+            REQUEST_HAS_REL = 8,
+            REQUEST_HAS_TIMEOUT = 16,
+            REQUEST_SKIP_UNKNOWN_REL = 32
+        };
+
+        enum ReplyFlags : uint8_t {
+            REPLY_HAS_ID = 1,
+            REPLY_HAS_REL = 2,
+            REPLY_HAS_ADMISSION = 4,
+            REPLY_HAS_DEADLINE = 8,
+            REPLY_TIMED_OUT = 16,
+            REPLY_HAS_RESULTS = 32,
+            REPLY_NUM_HITS_EXACT = 64,
+            REPLY_HAS_SHARDS = 128
+        };
+
+        enum ReplyExtendedFlags : uint8_t {
+            REPLY_PARTIAL = 1,
+            REPLY_HAS_SEGMENTS = 2,
+            REPLY_HAS_PREFETCH = 4,
+            REPLY_CACHED = 8
+        };
+
+        enum ShardFlags : uint8_t {
+            SHARD_MISSING = 1,
+            SHARD_HEDGED = 2
+        };
+
+        enum BinaryReplyStatus : uint8_t {
+            STATUS_OK = 0,
+            STATUS_ERROR = 1,
+            STATUS_UNSUPPORTED_VERSION = 2,
+            STATUS_OVERLOADED = 3
+        };
+
+        /**
+         * @return True if the message starts with the binary magic, whatever its version
+         */
+        bool
+        is_binary_message(
+                const char * data,
+                std::size_t size
+        ) {
+            return size >= 4 && std::memcmp(data, magic, sizeof(magic)) == 0;
+        }
+
+        /**
+         * Bounds-checked little-endian decoder
+         */
+        class Reader {
+        public:
+            Reader(const char * data, std::size_t size)
+                    : _data(reinterpret_cast<const unsigned char *>(data)),
+                      _size(size),
+                      _pos(0) {}
+
+            uint8_t u8() {
+                this->require(1);
+                return this->_data[this->_pos++];
+            }
+
+            uint16_t u16() {
+                return static_cast<uint16_t>(this->uint(2));
+            }
+
+            uint32_t u32() {
+                return static_cast<uint32_t>(this->uint(4));
+            }
+
+            uint64_t u64() {
+                return this->uint(8);
+            }
+
+            float f32() {
+                uint32_t bits = this->u32();
+                float value;
+                std::memcpy(&value, &bits, sizeof(float));
+                return value;
+            }
+
+            double f64() {
+                uint64_t bits = this->u64();
+                double value;
+                std::memcpy(&value, &bits, sizeof(double));
+                return value;
+            }
+
+            void bytes(std::string & out, std::size_t size) {
+                this->require(size);
+                out.assign(reinterpret_cast<const char *>(this->_data + this->_pos), size);
+                this->_pos += size;
+            }
+
+            void skip(std::size_t size) {
+                this->require(size);
+                this->_pos += size;
+            }
+
+            std::size_t remaining() const {
+                return this->_size - this->_pos;
+            }
+
+        private:
+            uint64_t uint(std::size_t num_bytes) {
+                this->require(num_bytes);
+                uint64_t value = 0;
+                for (std::size_t i = 0; i < num_bytes; ++i) {
+                    value |= static_cast<uint64_t>(this->_data[this->_pos + i]) << (8 * i);
+                }
+                this->_pos += num_bytes;
+                return value;
+            }
+
+            void require(std::size_t num_bytes) const {
+                if (this->_size - this->_pos < num_bytes) {
+                    throw std::runtime_error("Truncated binary message");
+                }
+            }
+
+        private:
+            const unsigned char * _data;
+            std::size_t _size;
+            std::size_t _pos;
+        };
+
+        /**
+         * Little-endian encoder appending to a string
+         */
+        class Writer {
+        public:
+            Writer(std::string & out)
+                    : _out(out) {}
+
+            void u8(uint8_t value) {
+                this->_out.push_back(static_cast<char>(value));
+            }
+
+            void u16(uint16_t value) {
+                this->uint(value, 2);
+            }
+
+            void u32(uint32_t value) {
+                this->uint(value, 4);
+            }
+
+            void u64(uint64_t value) {
+                this->uint(value, 8);
+            }
+
+            void f32(float value) {
+                uint32_t bits;
+                std::memcpy(&bits, &value, sizeof(float));
+                this->u32(bits);
+            }
+
+            void f64(double value) {
+                uint64_t bits;
+                std::memcpy(&bits, &value, sizeof(double));
+                this->u64(bits);
+            }
+
+            void bytes(const char * data, std::size_t size) {
+                this->_out.append(data, size);
+            }
+
+            void magic() {
+                this->bytes(binary_protocol::magic, sizeof(binary_protocol::magic));
+                this->u8(version);
+            }
+
+        private:
+            void uint(uint64_t value, std::size_t num_bytes) {
+                for (std::size_t i = 0; i < num_bytes; ++i) {
+                    this->_out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+                }
+            }
+
+        private:
+            std::string & _out;
+        };
+
+        /**
+         * Decodes a binary request
+         * @param id Filled with the request id, if the request has one
+         * @return True if the request has an id
+         * @throws std::runtime_error If the message is malformed
+         */
+        bool
+        decode_request(
+                const char * data,
+                std::size_t size,
+                query_request & request,
+                uint64_t & id
+        ) {
+            Reader reader(data, size);
+            reader.skip(sizeof(magic) + 1);
+
+            uint8_t query_type = reader.u8();
+            if (query_type == QUERY_TYPE_BOOLEAN) {
+                throw std::runtime_error("The boolean queries are supported only as query strings, by the json protocol");
+            }
+            if (query_type > QUERY_TYPE_MAXSCORE) {
+                throw std::runtime_error("Unrecognized query_type");
+            }
+            request.query_type = static_cast<QueryType>(query_type);
+            uint8_t flags = reader.u8();
+            request.query_normalization = (flags & REQUEST_NORMALIZATION) != 0;
+            uint16_t num_groups = reader.u16();
+            request.ranked_at = reader.u32();
+            uint32_t num_rel = reader.u32();
+            id = reader.u64();
+            request.timeout_ms = reader.u32();
+            request.has_timeout = (flags & REQUEST_HAS_TIMEOUT) != 0;
+            reader.u32();
+
+            if (is_flat_query_type(request.query_type) && num_groups != 1) {
+                throw std::runtime_error("Flat queries must have exactly one group");
+            }
+
+            if (flags & REQUEST_LEXEMES) {
+                request.terms_format = query_request::TERMS_LEXEMES;
+                request.lexemes.resize(num_groups);
+                for (auto & group: request.lexemes) {
+                    group.resize(reader.u16());
+                    for (auto & lexeme: group) {
+                        uint16_t lexeme_size = reader.u16();
+                        reader.bytes(lexeme, lexeme_size);
+                    }
+                }
+            } else {
+                request.terms_format = query_request::TERMS_TERM_IDS;
+                request.term_ids.resize(num_groups);
+                for (auto & group: request.term_ids) {
+                    group.resize(reader.u16());
+                    for (auto & term_id: group) {
+                        term_id = reader.u32();
+                    }
+                }
+            }
+
+            request.has_rel = (flags & REQUEST_HAS_REL) != 0;
+            request.skip_unknown_rel = (flags & REQUEST_SKIP_UNKNOWN_REL) != 0;
+            if (!request.has_rel && num_rel > 0) {
+                throw std::runtime_error("Rel docids given without the rel flag");
+            }
+            if (reader.remaining() != 8 * static_cast<std::size_t>(num_rel)) {
+                throw std::runtime_error("Unexpected size of the binary request");
+            }
+            request.rel.resize(num_rel);
+            for (auto & docid: request.rel) {
+                docid = reader.u64();
+            }
+
+            return (flags & REQUEST_HAS_ID) != 0;
+        }
+
+        /**
+         * Encodes a binary request, used by the clients
+         */
+        void
+        encode_request(
+                const query_request & request,
+                const uint64_t * id,
+                std::string & out
+        ) {
+            const bool lexemes = request.terms_format == query_request::TERMS_LEXEMES;
+            if (!lexemes && request.terms_format != query_request::TERMS_TERM_IDS) {
+                throw std::runtime_error("The binary protocol does not carry query strings");
+            }
+            const std::size_t num_groups = lexemes ? request.lexemes.size() : request.term_ids.size();
+            if (num_groups > 0xFFFF || request.rel.size() > 0xFFFFFFFFul) {
+                throw std::runtime_error("Request too large for the binary protocol");
+            }
+
+            uint8_t flags = 0;
+            flags |= request.query_normalization ? REQUEST_NORMALIZATION : 0;
+            flags |= lexemes ? REQUEST_LEXEMES : 0;
+            flags |= id != nullptr ? REQUEST_HAS_ID : 0;
+            flags |= request.has_rel ? REQUEST_HAS_REL : 0;
+            flags |= request.has_timeout ? REQUEST_HAS_TIMEOUT : 0;
+            flags |= request.skip_unknown_rel ? REQUEST_SKIP_UNKNOWN_REL : 0;
+
+            out.clear();
+            Writer writer(out);
+            writer.magic();
+            writer.u8(request.query_type);
+            writer.u8(flags);
+            writer.u16(static_cast<uint16_t>(num_groups));
+            writer.u32(request.ranked_at);
+            writer.u32(static_cast<uint32_t>(request.rel.size()));
+            writer.u64(id != nullptr ? *id : 0);
+            writer.u32(request.has_timeout ? request.timeout_ms : 0);
+            writer.u32(0);
+            for (std::size_t g = 0; g < num_groups; ++g) {
+                const std::size_t num_terms = lexemes ? request.lexemes[g].size() : request.term_ids[g].size();
+                if (num_terms > 0xFFFF) {
+                    throw std::runtime_error("Request too large for the binary protocol");
+                }
+                writer.u16(static_cast<uint16_t>(num_terms));
+                for (std::size_t t = 0; t < num_terms; ++t) {
+                    if (lexemes) {
+                        const std::string & lexeme = request.lexemes[g][t];
+                        if (lexeme.size() > 0xFFFF) {
+                            throw std::runtime_error("Lexeme too long for the binary protocol");
+                        }
+                        writer.u16(static_cast<uint16_t>(lexeme.size()));
+                        writer.bytes(lexeme.data(), lexeme.size());
+                    } else {
+                        writer.u32(request.term_ids[g][t]);
+                    }
+                }
+            }
+            for (uint64_t docid: request.rel) {
+                writer.u64(docid);
+            }
+        }
+
+        /**
+         * Encodes a binary reply
+         * @param id The id of the request, nullptr if it has none
+         * @param error The error message, nullptr if the request succeeded
+         */
+        void
+        encode_reply(
+                const query_reply & reply,
+                const uint64_t * id,
+                BinaryReplyStatus status,
+                const char * error,
+                std::string & out
+        ) {
+            uint8_t flags = 0;
+            flags |= id != nullptr ? REPLY_HAS_ID : 0;
+            flags |= reply.has_rel ? REPLY_HAS_REL : 0;
+            flags |= reply.has_admission ? REPLY_HAS_ADMISSION : 0;
+            flags |= reply.has_deadline ? REPLY_HAS_DEADLINE : 0;
+            flags |= reply.timed_out ? REPLY_TIMED_OUT : 0;
+            flags |= reply.has_results ? REPLY_HAS_RESULTS : 0;
+            flags |= reply.num_hits_exact ? REPLY_NUM_HITS_EXACT : 0;
+            flags |= !reply.shards.empty() ? REPLY_HAS_SHARDS : 0;
+            uint8_t extended_flags = 0;
+            extended_flags |= reply.partial ? REPLY_PARTIAL : 0;
+            const bool has_segments = !reply.missing_segments.empty() || !reply.unknown_segments.empty();
+            extended_flags |= has_segments ? REPLY_HAS_SEGMENTS : 0;
+            extended_flags |= reply.has_prefetch ? REPLY_HAS_PREFETCH : 0;
+            extended_flags |= reply.cached ? REPLY_CACHED : 0;
+
+            out.clear();
+            Writer writer(out);
+            writer.magic();
+            writer.u8(status);
+            writer.u8(flags);
+            writer.u8(extended_flags);
+            writer.u8(0);
+            writer.u64(id != nullptr ? *id : 0);
+            writer.u64(reply.num_ret);
+            writer.u64(reply.num_rel_ret);
+            writer.u64(reply.num_rel);
+            writer.f64(reply.exe_time);
+            writer.u64(reply.queue_depth);
+            writer.f64(reply.queue_wait);
+            writer.u64(reply.shed_count);
+            if (status != STATUS_OK) {
+                const std::size_t error_size = std::strlen(error);
+                writer.u32(static_cast<uint32_t>(error_size));
+                writer.bytes(error, error_size);
+            } else if (reply.has_results) {
+                writer.u64(reply.num_hits);
+                writer.u32(static_cast<uint32_t>(reply.results.size()));
+                for (const auto & result: reply.results) {
+                    writer.u64(result.docid);
+                    writer.f32(result.score);
+                }
+            }
+            if (status == STATUS_OK && !reply.shards.empty()) {
+                writer.u32(static_cast<uint32_t>(reply.shards.size()));
+                for (const auto & shard: reply.shards) {
+                    writer.f64(shard.exe_time);
+                    writer.u64(shard.num_ret);
+                    writer.u8((shard.missing ? SHARD_MISSING : 0) | (shard.hedged ? SHARD_HEDGED : 0));
+                }
+            }
+            if (status == STATUS_OK && has_segments) {
+                for (const auto * segments: {&reply.missing_segments, &reply.unknown_segments}) {
+                    writer.u32(static_cast<uint32_t>(segments->size()));
+                    for (const auto & segment: *segments) {
+                        // the segments longer than 64 KB are truncated
+                        const uint16_t segment_size = static_cast<uint16_t>(std::min<std::size_t>(segment.size(), UINT16_MAX));
+                        writer.u16(segment_size);
+                        writer.bytes(segment.data(), segment_size);
+                    }
+                }
+            }
+            if (status == STATUS_OK && reply.has_prefetch) {
+                writer.u64(reply.prefetched_lists);
+                writer.u64(reply.prefetch_faults);
+                writer.f64(reply.prefetch_wait);
+                writer.u64(reply.major_faults);
+            }
+        }
+
+        /**
+         * Decodes a binary reply, used by the clients
+         * @param error Filled with the error message when the status is not ok
+         * @return The status of the reply
+         */
+        BinaryReplyStatus
+        decode_reply(
+                const char * data,
+                std::size_t size,
+                query_reply & reply,
+                uint64_t & id,
+                std::string & error
+        ) {
+            if (!is_binary_message(data, size)) {
+                throw std::runtime_error("Not a binary reply");
+            }
+            Reader reader(data, size);
+            reader.skip(sizeof(magic) + 1);
+            BinaryReplyStatus status = static_cast<BinaryReplyStatus>(reader.u8());
+            uint8_t flags = reader.u8();
+            uint8_t extended_flags = reader.u8();
+            reader.u8();
+            id = reader.u64();
+            reply.num_ret = reader.u64();
+            reply.num_rel_ret = reader.u64();
+            reply.num_rel = reader.u64();
+            reply.exe_time = reader.f64();
+            reply.queue_depth = reader.u64();
+            reply.queue_wait = reader.f64();
+            reply.shed_count = reader.u64();
+            reply.has_rel = (flags & REPLY_HAS_REL) != 0;
+            reply.has_admission = (flags & REPLY_HAS_ADMISSION) != 0;
+            reply.has_deadline = (flags & REPLY_HAS_DEADLINE) != 0;
+            reply.timed_out = (flags & REPLY_TIMED_OUT) != 0;
+            reply.has_results = (flags & REPLY_HAS_RESULTS) != 0;
+            reply.num_hits_exact = (flags & REPLY_NUM_HITS_EXACT) != 0;
+            reply.partial = (extended_flags & REPLY_PARTIAL) != 0;
+            reply.cached = (extended_flags & REPLY_CACHED) != 0;
+            if (status != STATUS_OK) {
+                reader.bytes(error, reader.u32());
+            } else if (reply.has_results) {
+                reply.num_hits = reader.u64();
+                reply.results.resize(reader.u32());
+                for (auto & result: reply.results) {
+                    result.docid = reader.u64();
+                    result.score = reader.f32();
+                }
+            }
+            if (status == STATUS_OK && (flags & REPLY_HAS_SHARDS) != 0) {
+                reply.shards.resize(reader.u32());
+                for (auto & shard: reply.shards) {
+                    shard.exe_time = reader.f64();
+                    shard.num_ret = reader.u64();
+                    uint8_t shard_flags = reader.u8();
+                    shard.missing = (shard_flags & SHARD_MISSING) != 0;
+                    shard.hedged = (shard_flags & SHARD_HEDGED) != 0;
+                }
+            }
+            if (status == STATUS_OK && (extended_flags & REPLY_HAS_SEGMENTS) != 0) {
+                for (auto * segments: {&reply.missing_segments, &reply.unknown_segments}) {
+                    segments->resize(reader.u32());
+                    for (auto & segment: *segments) {
+                        reader.bytes(segment, reader.u16());
+                    }
+                }
+            }
+            reply.has_prefetch = status == STATUS_OK && (extended_flags & REPLY_HAS_PREFETCH) != 0;
+            if (reply.has_prefetch) {
+                reply.prefetched_lists = reader.u64();
+                reply.prefetch_faults = reader.u64();
+                reply.prefetch_wait = reader.f64();
+                reply.major_faults = reader.u64();
+            }
+            return status;
+        }
+    }
+}
+
+#endif //INDEX_PARTITIONING_BINARY_PROTOCOL_HPP
@@ -0,0 +1,51 @@
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "query_server/lexicon.hpp"
+#include "query_server/segment_filter.hpp"
+
+
+/**
+ * Compiles the gzipped .terms and .mterms files of every index basename into the snapshots mapped by the query
+ * server, e.g., when the server cannot write them next to the index
+ */
+int main(
+        int argc,
+        char *argv[]
+) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " index_basename [index_basename...]\n"
+                  << "  reads index_basename.terms and index_basename.mterms and writes their .cache snapshots,\n"
+                  << "  the server rebuilds a snapshot by itself when its source changes.\n";
+        return -1;
+    }
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string basename(argv[i]);
+        try {
+            const std::string terms = basename + ".terms";
+            std::cerr << "Compiling " << terms << " into " << query_server::aux_cache::cache_path(terms) << std::endl;
+            query_server::Lexicon::write(terms);
+
+            // check the written snapshot
+            query_server::Lexicon lexicon;
+            if (!lexicon.load(terms)) {
+                throw std::runtime_error("The snapshot of " + terms + " is not valid");
+            }
+
+            // the missing segments are only tested for membership, thus they are compiled into a filter
+            const std::string mterms = basename + ".mterms";
+            std::cerr << "Compiling " << mterms << " into " << query_server::aux_cache::cache_path(mterms) << std::endl;
+            query_server::SegmentFilter missing_filter;
+            if (!missing_filter.load(mterms) && !query_server::SegmentFilter().load(mterms)) {
+                throw std::runtime_error("The snapshot of " + mterms + " is not valid");
+            }
+        } catch (const std::exception &e) {
+            std::cerr << "Unable to compile the lexicon of " << basename << ": " << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,21 @@
+#ifndef INDEX_PARTITIONING_CACHE_SHARDING_HPP
+#define INDEX_PARTITIONING_CACHE_SHARDING_HPP
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+
+namespace query_server {
+    /**
+     * @return The shard of a cache split by the hash of its keys among num_shards shards, each one with its own hash
+     *         table: the shard is chosen by the high bits of the hash, since the low ones choose the bucket in the table
+     */
+    inline std::size_t
+    cache_shard(const std::string & key, std::size_t num_shards) {
+        const uint64_t hash = static_cast<uint64_t>(std::hash<std::string>()(key)) * 0x9E3779B97F4A7C15ull;
+        return static_cast<std::size_t>((hash >> 32) % num_shards);
+    }
+}
+
+#endif //INDEX_PARTITIONING_CACHE_SHARDING_HPP
@@ -0,0 +1,252 @@
+#ifndef INDEX_PARTITIONING_DOCID_MAP_HPP
+#define INDEX_PARTITIONING_DOCID_MAP_HPP
+
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "aux_cache.hpp"
+#include "elias_fano.hpp"
+
+
+namespace query_server {
+    /**
+     * The map between the original docids and the docids of the index, read from a .docids.map file made of 12-byte
+     * records: the original docid as a native u64 followed by the docid of the index as a native u32.
+     * The original docids are kept sorted in an Elias-Fano sequence, next to the docid of the index of each of them,
+     * bit-packed in the same order. The docids of the index are translated back through an array of positions in the
+     * sequence, bit-packed too. The map takes about 2 + log(max docid / num docids) + 2 log(num docids) bits per
+     * document, e.g., 7 bytes for 50M documents with dense original docids.
+     * The words of the map are the payload of its snapshot (see aux_cache.hpp), mapped by the following loads:
+     *
+     *   num_records u64, max_docid u64, num_positions u64, the Elias-Fano words of the original docids, the packed
+     *   docids of the index, the packed positions (position + 1, 0 if not mapped)
+     */
+    class DocidMap {
+    public:
+        static const uint64_t not_mapped = static_cast<uint64_t>(-1);
+        static const std::size_t record_size = 12;
+        static const uint32_t version = 2;
+
+        DocidMap()
+                : _num_positions(0) {}
+
+        DocidMap(const DocidMap &) = delete;
+        DocidMap & operator=(const DocidMap &) = delete;
+
+        /**
+         * Maps the snapshot of the map if it is still valid, otherwise reads the map file and writes the snapshot
+         * @throws std::runtime_error If the file cannot be opened or its size is not a multiple of the record size
+         */
+        void open(const std::string & map_file_path) {
+            const char * payload;
+            std::size_t payload_size;
+            if (aux_cache::open(map_file_path, "DMAP", version, this->_file, payload, payload_size)) {
+                this->attach(payload, payload_size);
+                std::cerr << " DocidMap::open: stored " << this->size() << " docid (snapshot)." << std::endl;
+                return;
+            }
+
+            aux_cache::source_stamp stamp;
+            const bool has_stamp = aux_cache::stat_source(map_file_path, stamp);
+            this->read(map_file_path);
+            if (has_stamp) {
+                aux_cache::write(map_file_path, stamp, "DMAP", version, this->payload());
+            }
+        }
+
+        /**
+         * @param new_docid Filled with the docid of the index, if the original docid is in the map
+         * @return True if the original docid is in the map
+         */
+        bool find(uint64_t docid, uint64_t & new_docid) const {
+            std::size_t position;
+            if (!this->_docids.find(docid, position)) {
+                return false;
+            }
+            new_docid = this->_new_docids.get(position);
+            return true;
+        }
+
+        /**
+         * @return The original docid of a docid of the index, not_mapped if it has none
+         */
+        uint64_t original(uint64_t new_docid) const {
+            if (new_docid >= this->_num_positions) {
+                return not_mapped;
+            }
+            const uint64_t position = this->_positions.get(new_docid);
+            if (position == 0) {
+                return not_mapped;
+            }
+            return this->_docids.access(position - 1);
+        }
+
+        /**
+         * @return The number of mapped docids
+         */
+        std::size_t size() const {
+            return this->_docids.size();
+        }
+
+    private:
+        static const std::size_t header_words = 3;
+
+        /**
+         * The number of words of the sections of the map
+         */
+        struct layout {
+            std::size_t docids_words;
+            unsigned int new_docid_width;
+            std::size_t new_docids_words;
+            unsigned int position_width;
+            std::size_t positions_words;
+
+            layout(uint64_t num_records, uint64_t max_docid, uint64_t num_positions) {
+                this->docids_words = EliasFano::num_words(num_records, max_docid);
+                this->new_docid_width = bit_width(num_positions > 0 ? num_positions - 1 : 0);
+                this->new_docids_words = PackedArray::num_words(num_records, this->new_docid_width);
+                this->position_width = bit_width(num_records);
+                this->positions_words = PackedArray::num_words(num_positions, this->position_width);
+            }
+
+            std::size_t size() const {
+                return header_words + this->docids_words + this->new_docids_words + this->positions_words;
+            }
+        };
+
+        /**
+         * Reads the map file and builds the words of the map. The records are read from the mapped file, the ones not
+         * sorted by original docid through a sorted array of their positions, 4 bytes per record.
+         */
+        void read(const std::string & map_file_path) {
+            boost::iostreams::mapped_file_source file;
+            file.open(map_file_path);
+            if ( !file.is_open() ) {
+                throw std::runtime_error("Error opening file");
+            }
+            if (file.size() % record_size) {
+                throw std::runtime_error("Incompatible size of the file");
+            }
+            const char * records = file.data();
+            const std::size_t num_file_records = file.size() / record_size;
+            if (num_file_records >= static_cast<uint32_t>(-1)) {
+                throw std::runtime_error("Too many docids in the map file");
+            }
+            const auto key = [records](std::size_t i) {
+                uint64_t k;
+                std::memcpy(&k, records + i * record_size, 8);
+                return k;
+            };
+            const auto value = [records](std::size_t i) {
+                uint32_t v;
+                std::memcpy(&v, records + i * record_size + 8, 4);
+                return v;
+            };
+
+            bool sorted = true;
+            for (std::size_t i = 1; i < num_file_records && sorted; ++i) {
+                sorted = key(i - 1) < key(i);
+            }
+            // a docid appearing more than once keeps its last record
+            std::vector<uint32_t> order;
+            if (!sorted) {
+                order.resize(num_file_records);
+                for (std::size_t i = 0; i < num_file_records; ++i) {
+                    order[i] = static_cast<uint32_t>(i);
+                }
+                std::stable_sort(order.begin(), order.end(), [&key](uint32_t lhs, uint32_t rhs) {
+                    return key(lhs) < key(rhs);
+                });
+                std::size_t num_unique = 0;
+                for (std::size_t i = 0; i < order.size(); ++i) {
+                    if (i + 1 < order.size() && key(order[i + 1]) == key(order[i])) {
+                        continue;
+                    }
+                    order[num_unique++] = order[i];
+                }
+                order.resize(num_unique);
+            }
+            const std::size_t num_records = sorted ? num_file_records : order.size();
+            const auto record = [sorted, &order](std::size_t i) -> std::size_t {
+                return sorted ? i : order[i];
+            };
+
+            const uint64_t max_docid = num_records > 0 ? key(record(num_records - 1)) : 0;
+            uint64_t num_positions = 0;
+            for (std::size_t i = 0; i < num_records; ++i) {
+                num_positions = std::max<uint64_t>(num_positions, value(record(i)) + uint64_t(1));
+            }
+
+            const layout l(num_records, max_docid, num_positions);
+            this->_words.assign(l.size(), 0);
+            uint64_t * header = this->_words.data();
+            header[0] = num_records;
+            header[1] = max_docid;
+            header[2] = num_positions;
+            uint64_t * docids = header + header_words;
+            uint64_t * new_docids = docids + l.docids_words;
+            uint64_t * positions = new_docids + l.new_docids_words;
+            EliasFano::build(docids, num_records, max_docid, [&key, &record](std::size_t i) {
+                return key(record(i));
+            });
+            for (std::size_t i = 0; i < num_records; ++i) {
+                const uint32_t new_docid = value(record(i));
+                PackedArray::set(new_docids, l.new_docid_width, i, new_docid);
+                PackedArray::set(positions, l.position_width, new_docid, i + 1);
+            }
+
+            this->attach(reinterpret_cast<const char *>(this->_words.data()), this->_words.size() * 8);
+            std::cerr << " DocidMap::open: stored " << this->size() << " docid (" << this->_words.size() * 8
+                      << " bytes" << (sorted ? "" : ", sorted in memory") << ")." << std::endl;
+        }
+
+        /**
+         * @return The snapshot of the map, its words
+         */
+        std::string payload() const {
+            return std::string(reinterpret_cast<const char *>(this->_words.data()), this->_words.size() * 8);
+        }
+
+        /**
+         * Points the map to its words, either built by read or mapped from the payload of its snapshot
+         */
+        void attach(const char * data, std::size_t size) {
+            if (size < header_words * 8 || size % 8 != 0) {
+                throw std::runtime_error("Corrupted docid map snapshot");
+            }
+            const uint64_t * header = reinterpret_cast<const uint64_t *>(data);
+            const uint64_t num_records = header[0];
+            const uint64_t max_docid = header[1];
+            const uint64_t num_positions = header[2];
+            if (num_records >= static_cast<uint32_t>(-1) || num_positions > (uint64_t(1) << 32)
+                || (num_records > 0 && max_docid < num_records - 1)) {
+                throw std::runtime_error("Corrupted docid map snapshot");
+            }
+            const layout l(num_records, max_docid, num_positions);
+            if (size != l.size() * 8) {
+                throw std::runtime_error("Corrupted docid map snapshot");
+            }
+            const uint64_t * docids = header + header_words;
+            this->_docids.attach(docids, num_records, max_docid);
+            this->_new_docids.attach(docids + l.docids_words, l.new_docid_width);
+            this->_positions.attach(docids + l.docids_words + l.new_docids_words, l.position_width);
+            this->_num_positions = num_positions;
+        }
+
+    private:
+        boost::iostreams::mapped_file_source _file; // the snapshot
+        std::vector<uint64_t> _words; // the words of the map, when they are not mapped from the snapshot
+        EliasFano _docids; // the original docids, sorted
+        PackedArray _new_docids; // the docid of the index of every original docid, in the same order
+        PackedArray _positions; // the position + 1 of every docid of the index, 0 if not mapped
+        std::size_t _num_positions;
+    };
+}
+
+#endif //INDEX_PARTITIONING_DOCID_MAP_HPP
@@ -0,0 +1,265 @@
+#ifndef INDEX_PARTITIONING_ELIAS_FANO_HPP
+#define INDEX_PARTITIONING_ELIAS_FANO_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+
+/**
+ * Compact sequences read in place from an array of 64-bit words, either built in memory or mapped from a snapshot
+ * (see aux_cache.hpp). The words are written by the static build functions, the classes only point to them.
+ */
+namespace query_server {
+    /**
+     * @return The number of bits needed to write value, 0 for 0
+     */
+    inline unsigned int
+    bit_width(uint64_t value) {
+        return value == 0 ? 0 : 64 - static_cast<unsigned int>(__builtin_clzll(value));
+    }
+
+
+    /**
+     * Unsigned integers of width bits each, packed one after the other in 64-bit words
+     */
+    class PackedArray {
+    public:
+        PackedArray()
+                : _words(nullptr),
+                  _width(0) {}
+
+        /**
+         * @return The number of words holding size integers of width bits
+         */
+        static std::size_t
+        num_words(std::size_t size, unsigned int width) {
+            return static_cast<std::size_t>((static_cast<uint64_t>(size) * width + 63) / 64);
+        }
+
+        /**
+         * Writes the integer at position i of the words of an array, overwriting the previous one
+         */
+        static void
+        set(uint64_t * words, unsigned int width, std::size_t i, uint64_t value) {
+            if (width == 0) {
+                return;
+            }
+            const uint64_t mask = width == 64 ? ~uint64_t(0) : (uint64_t(1) << width) - 1;
+            const uint64_t bit = static_cast<uint64_t>(i) * width;
+            const std::size_t word = static_cast<std::size_t>(bit >> 6);
+            const unsigned int shift = static_cast<unsigned int>(bit & 63);
+            words[word] = (words[word] & ~(mask << shift)) | (value << shift);
+            if (shift + width > 64) {
+                const unsigned int written = 64 - shift;
+                words[word + 1] = (words[word + 1] & ~(mask >> written)) | (value >> written);
+            }
+        }
+
+        void
+        attach(const uint64_t * words, unsigned int width) {
+            this->_words = words;
+            this->_width = width;
+        }
+
+        uint64_t
+        get(std::size_t i) const {
+            if (this->_width == 0) {
+                return 0;
+            }
+            const uint64_t bit = static_cast<uint64_t>(i) * this->_width;
+            const std::size_t word = static_cast<std::size_t>(bit >> 6);
+            const unsigned int shift = static_cast<unsigned int>(bit & 63);
+            uint64_t value = this->_words[word] >> shift;
+            if (shift + this->_width > 64) {
+                value |= this->_words[word + 1] << (64 - shift);
+            }
+            return this->_width == 64 ? value : value & ((uint64_t(1) << this->_width) - 1);
+        }
+
+    private:
+        const uint64_t * _words;
+        unsigned int _width;
+    };
+
+
+    /**
+     * Strictly increasing sequence of integers in the Elias-Fano representation: the low bits of every value are packed,
+     * the high ones are written in unary in a bit vector whose ones and zeros are sampled every select_step, thus a
+     * value is read in O(1) and searched in O(log of its bucket).
+     * It takes about 2 + log(max_value / size) bits per value, plus 0.5 bits for the samples.
+     *
+     *   words: the low bits, the high bit vector, the positions of the sampled ones, the positions of the sampled zeros
+     */
+    class EliasFano {
+    public:
+        static const std::size_t select_step = 256;
+
+        EliasFano()
+                : _size(0),
+                  _max_value(0),
+                  _low_bits(0),
+                  _high(nullptr),
+                  _ones(nullptr),
+                  _zeros(nullptr) {}
+
+        /**
+         * @return The number of words holding size values up to max_value
+         */
+        static std::size_t
+        num_words(std::size_t size, uint64_t max_value) {
+            const layout l(size, max_value);
+            return l.low_words + l.high_words + l.ones_samples + l.zeros_samples;
+        }
+
+        /**
+         * Writes the sequence into words, which must hold num_words(size, max_value) words set to zero
+         * @param values Functor returning the i-th value, they must be strictly increasing and at most max_value
+         */
+        template <typename Values>
+        static void
+        build(uint64_t * words, std::size_t size, uint64_t max_value, Values values) {
+            const layout l(size, max_value);
+            uint64_t * low = words;
+            uint64_t * high = low + l.low_words;
+            uint64_t * ones = high + l.high_words;
+            uint64_t * zeros = ones + l.ones_samples;
+
+            const uint64_t low_mask = (uint64_t(1) << l.low_bits) - 1;
+            for (std::size_t i = 0; i < size; ++i) {
+                const uint64_t value = values(i);
+                PackedArray::set(low, l.low_bits, i, value & low_mask);
+                const uint64_t pos = (value >> l.low_bits) + i;
+                high[pos >> 6] |= uint64_t(1) << (pos & 63);
+                if (i % select_step == 0) {
+                    ones[i / select_step] = pos;
+                }
+            }
+
+            uint64_t num_zeros = 0;
+            for (std::size_t word = 0; word < l.high_words; ++word) {
+                uint64_t w = ~high[word];
+                if (word + 1 == l.high_words && l.num_high_bits % 64 != 0) {
+                    w &= (uint64_t(1) << (l.num_high_bits % 64)) - 1;
+                }
+                for (; w != 0; w &= w - 1, ++num_zeros) {
+                    if (num_zeros % select_step == 0) {
+                        zeros[num_zeros / select_step] = word * 64 + static_cast<unsigned int>(__builtin_ctzll(w));
+                    }
+                }
+            }
+        }
+
+        void
+        attach(const uint64_t * words, std::size_t size, uint64_t max_value) {
+            const layout l(size, max_value);
+            this->_size = size;
+            this->_max_value = max_value;
+            this->_low_bits = l.low_bits;
+            this->_low.attach(words, l.low_bits);
+            this->_high = words + l.low_words;
+            this->_ones = this->_high + l.high_words;
+            this->_zeros = this->_ones + l.ones_samples;
+        }
+
+        std::size_t
+        size() const {
+            return this->_size;
+        }
+
+        /**
+         * @return The i-th value
+         */
+        uint64_t
+        access(std::size_t i) const {
+            const uint64_t high = this->select(i, true) - i;
+            return (high << this->_low_bits) | this->_low.get(i);
+        }
+
+        /**
+         * @param position Filled with the position of value, if it is in the sequence
+         * @return True if value is in the sequence
+         */
+        bool
+        find(uint64_t value, std::size_t & position) const {
+            if (this->_size == 0 || value > this->_max_value) {
+                return false;
+            }
+            // the values with the same high bits are between two zeros, their low bits are sorted
+            const uint64_t bucket = value >> this->_low_bits;
+            const uint64_t low = value & ((uint64_t(1) << this->_low_bits) - 1);
+            std::size_t begin = bucket == 0 ? 0 : static_cast<std::size_t>(this->select(bucket - 1, false) + 1 - bucket);
+            std::size_t end = static_cast<std::size_t>(this->select(bucket, false) - bucket);
+            while (begin < end) {
+                const std::size_t middle = begin + (end - begin) / 2;
+                const uint64_t middle_low = this->_low.get(middle);
+                if (middle_low == low) {
+                    position = middle;
+                    return true;
+                }
+                if (middle_low < low) {
+                    begin = middle + 1;
+                } else {
+                    end = middle;
+                }
+            }
+            return false;
+        }
+
+    private:
+        struct layout {
+            unsigned int low_bits;
+            uint64_t num_high_bits;
+            std::size_t low_words;
+            std::size_t high_words;
+            std::size_t ones_samples;
+            std::size_t zeros_samples;
+
+            layout(std::size_t size, uint64_t max_value) {
+                const uint64_t ratio = size == 0 ? 0 : max_value / size;
+                this->low_bits = ratio == 0 ? 0 : bit_width(ratio) - 1;
+                const uint64_t num_zeros = (max_value >> this->low_bits) + 1;
+                this->num_high_bits = size + num_zeros;
+                this->low_words = PackedArray::num_words(size, this->low_bits);
+                this->high_words = static_cast<std::size_t>((this->num_high_bits + 63) / 64);
+                this->ones_samples = (size + select_step - 1) / select_step;
+                this->zeros_samples = static_cast<std::size_t>((num_zeros + select_step - 1) / select_step);
+            }
+        };
+
+        /**
+         * @return The position in the high bit vector of its i-th one, or zero, which must exist
+         */
+        uint64_t
+        select(uint64_t i, bool one) const {
+            const uint64_t * samples = one ? this->_ones : this->_zeros;
+            const uint64_t sample = samples[i / select_step];
+            uint64_t remaining = i % select_step;
+            std::size_t word = static_cast<std::size_t>(sample >> 6);
+            uint64_t w = (one ? this->_high[word] : ~this->_high[word]) & (~uint64_t(0) << (sample & 63));
+            for (;;) {
+                const uint64_t count = static_cast<uint64_t>(__builtin_popcountll(w));
+                if (remaining < count) {
+                    break;
+                }
+                remaining -= count;
+                ++word;
+                w = one ? this->_high[word] : ~this->_high[word];
+            }
+            for (; remaining > 0; --remaining) {
+                w &= w - 1;
+            }
+            return word * 64 + static_cast<unsigned int>(__builtin_ctzll(w));
+        }
+
+    private:
+        std::size_t _size;
+        uint64_t _max_value;
+        unsigned int _low_bits;
+        PackedArray _low;
+        const uint64_t * _high;
+        const uint64_t * _ones;
+        const uint64_t * _zeros;
+    };
+}
+
+#endif //INDEX_PARTITIONING_ELIAS_FANO_HPP
@@ -0,0 +1,262 @@
+#ifndef INDEX_PARTITIONING_HOT_LISTS_HPP
+#define INDEX_PARTITIONING_HOT_LISTS_HPP
+
+#include <fcntl.h>
+#include <succinct/mapper.hpp>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+namespace query_server {
+    /**
+     * The uses of every term of an index in the served queries, halved at every refresh of the locked lists so that
+     * they follow the changes of the workload
+     */
+    class TermCounters {
+    public:
+        TermCounters()
+                : _num_terms(0) {}
+
+        TermCounters(const TermCounters &) = delete;
+        TermCounters & operator=(const TermCounters &) = delete;
+
+        /**
+         * Enables the counting for an index of num_terms terms, all of them unused
+         */
+        void reset(std::size_t num_terms) {
+            this->_counts.reset(new std::atomic<uint32_t>[num_terms]);
+            for (std::size_t i = 0; i < num_terms; ++i) {
+                this->_counts[i].store(0, std::memory_order_relaxed);
+            }
+            this->_num_terms = num_terms;
+        }
+
+        bool enabled() const {
+            return this->_num_terms > 0;
+        }
+
+        void add(std::size_t term_id, uint32_t count = 1) {
+            if (term_id < this->_num_terms) {
+                this->_counts[term_id].fetch_add(count, std::memory_order_relaxed);
+            }
+        }
+
+        /**
+         * Counts the terms of a flat query
+         */
+        template <typename TermIdType>
+        void add(const std::vector<TermIdType> & terms) {
+            for (TermIdType term_id: terms) {
+                this->add(term_id);
+            }
+        }
+
+        /**
+         * Counts the terms of all the groups of a cnf query
+         */
+        template <typename TermIdType>
+        void add(const std::vector<std::vector<TermIdType>> & groups) {
+            for (const auto & group: groups) {
+                this->add(group);
+            }
+        }
+
+        /**
+         * @return The used terms by decreasing uses, which are halved
+         */
+        std::vector<std::size_t> rank_and_decay() {
+            std::vector<std::pair<uint32_t, std::size_t>> used;
+            for (std::size_t i = 0; i < this->_num_terms; ++i) {
+                const uint32_t count = this->_counts[i].load(std::memory_order_relaxed);
+                if (count > 0) {
+                    used.push_back(std::make_pair(count, i));
+                    this->_counts[i].fetch_sub(count - count / 2, std::memory_order_relaxed);
+                }
+            }
+            std::sort(used.begin(), used.end(), [](const std::pair<uint32_t, std::size_t> & lhs, const std::pair<uint32_t, std::size_t> & rhs) {
+                return lhs.first > rhs.first || (lhs.first == rhs.first && lhs.second < rhs.second);
+            });
+
+            std::vector<std::size_t> result;
+            result.reserve(used.size());
+            for (const auto & entry: used) {
+                result.push_back(entry.second);
+            }
+            return result;
+        }
+
+    private:
+        std::unique_ptr<std::atomic<uint32_t>[]> _counts;
+        std::size_t _num_terms;
+    };
+
+
+    /**
+     * Reads a query log, one query per line, counting the uses of its terms: the runs of the characters allowed in the
+     * terms of the query syntax, [0-9a-zA-Z_]
+     * @throws std::runtime_error If the log cannot be opened
+     */
+    std::unordered_map<std::string, uint32_t>
+    read_query_log(
+            const std::string & log_path
+    ) {
+        std::ifstream log(log_path);
+        if (!log.is_open()) {
+            throw std::runtime_error("Error opening file " + log_path);
+        }
+        std::unordered_map<std::string, uint32_t> counts;
+        std::string term;
+        for (std::string line; std::getline(log, line);) {
+            line.push_back(' ');
+            for (char c: line) {
+                if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_') {
+                    term.push_back(c);
+                } else if (!term.empty()) {
+                    ++counts[term];
+                    term.clear();
+                }
+            }
+        }
+        return counts;
+    }
+
+
+    /**
+     * Keeps the posting lists of the most used terms of an index locked in memory, up to a budget, so that the page
+     * cache does not evict them under memory pressure.
+     * The index file is mapped again and locked on fault (mlock2 with MLOCK_ONFAULT), then the lists are read through
+     * this mapping with IndexType::warmup: only their pages are locked. The read-ahead around the faults is disabled,
+     * so that the neighbouring lists are not locked too. A list takes about its number of postings times the average
+     * size of a posting in the index.
+     * Locking needs CAP_IPC_LOCK or a RLIMIT_MEMLOCK as large as the index file, since the whole mapping is charged.
+     */
+    template <typename IndexType>
+    class HotListLock {
+    public:
+        HotListLock()
+                : _mapping(nullptr),
+                  _mapping_size(0),
+                  _bytes_per_posting(0),
+                  _num_terms(0),
+                  _locked_bytes(0) {}
+
+        HotListLock(const HotListLock &) = delete;
+        HotListLock & operator=(const HotListLock &) = delete;
+
+        ~HotListLock() {
+            this->release();
+        }
+
+        /**
+         * Locks the lists of the ranked terms, in their order, until the budget is reached, then unlocks the lists
+         * locked before, so that the lists in both sets stay locked meanwhile
+         * @param index The index mapped from index_path
+         * @return False if the lists cannot be locked, the reason is logged and the lists locked before are kept
+         */
+        bool lock(const std::string & index_path, const IndexType & index, const std::vector<std::size_t> & ranked_terms, uint64_t budget) {
+            int fd = open(index_path.c_str(), O_RDONLY);
+            struct stat st;
+            if (fd == -1 || fstat(fd, &st) != 0) {
+                std::cerr << " HotListLock: unable to open " << index_path << ": " << std::strerror(errno) << std::endl;
+                if (fd != -1) {
+                    close(fd);
+                }
+                return false;
+            }
+            const std::size_t size = static_cast<std::size_t>(st.st_size);
+            void * mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            if (mapping == MAP_FAILED) {
+                std::cerr << " HotListLock: unable to map " << index_path << ": " << std::strerror(errno) << std::endl;
+                return false;
+            }
+            madvise(mapping, size, MADV_RANDOM);
+            if (mlock2(mapping, size, MLOCK_ONFAULT) != 0) {
+                std::cerr << " HotListLock: unable to lock " << index_path << ": " << std::strerror(errno) << std::endl;
+                munmap(mapping, size);
+                return false;
+            }
+
+            if (this->_bytes_per_posting == 0) {
+                uint64_t num_postings = 0;
+                for (std::size_t i = 0; i < index.size(); ++i) {
+                    num_postings += index[i].size();
+                }
+                this->_bytes_per_posting = std::max(1.0, static_cast<double>(size) / std::max<uint64_t>(1, num_postings));
+            }
+
+            // the lists are read through the locked mapping
+            IndexType locked_index;
+            succinct::mapper::map(locked_index, static_cast<const char *>(mapping));
+            const uint64_t page_size = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+            uint64_t locked_bytes = 0;
+            std::size_t num_terms = 0;
+            for (std::size_t term_id: ranked_terms) {
+                if (term_id >= index.size()) {
+                    continue;
+                }
+                const uint64_t list_bytes = std::max(page_size, static_cast<uint64_t>(index[term_id].size() * this->_bytes_per_posting));
+                if (locked_bytes + list_bytes > budget) {
+                    break;
+                }
+                locked_index.warmup(term_id);
+                locked_bytes += list_bytes;
+                ++num_terms;
+            }
+
+            this->release();
+            this->_mapping = mapping;
+            this->_mapping_size = size;
+            this->_num_terms = num_terms;
+            this->_locked_bytes = locked_bytes;
+            return true;
+        }
+
+        /**
+         * @return The number of lists locked
+         */
+        std::size_t num_terms() const {
+            return this->_num_terms;
+        }
+
+        /**
+         * @return The estimated size of the lists locked
+         */
+        uint64_t locked_bytes() const {
+            return this->_locked_bytes;
+        }
+
+    private:
+        void release() {
+            if (this->_mapping != nullptr) {
+                munmap(this->_mapping, this->_mapping_size);
+                this->_mapping = nullptr;
+                this->_num_terms = 0;
+                this->_locked_bytes = 0;
+            }
+        }
+
+    private:
+        void * _mapping;
+        std::size_t _mapping_size;
+        double _bytes_per_posting;
+        std::atomic<std::size_t> _num_terms; // read by the status requests
+        std::atomic<uint64_t> _locked_bytes;
+    };
+}
+
+#endif //INDEX_PARTITIONING_HOT_LISTS_HPP
@@ -0,0 +1,274 @@
+#ifndef INDEX_PARTITIONING_JSON_PROTOCOL_HPP
+#define INDEX_PARTITIONING_JSON_PROTOCOL_HPP
+
+#include <boost/optional.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "query_request.hpp"
+
+
+/**
+ * The json messages, e.g., {"query": "((a|b)(c))", "query_type": "cnf", "ranked_at": 10}, or
+ * {"query": "(a (b | c d) -e)", "query_type": "boolean"}.
+ * A message can also be an array of requests (batch) or an administrative request, which are handled by the server.
+ */
+namespace query_server {
+    namespace json_protocol {
+        namespace pt = boost::property_tree;
+
+        /**
+         * @return True if the json request is an array of requests
+         */
+        bool
+        is_batch_request(
+                const pt::ptree &request
+        ) {
+            if (request.empty() || !request.data().empty()) {
+                return false;
+            }
+            for (const pt::ptree::value_type &child: request) {
+                if (!child.first.empty()) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        /**
+         * Decodes a json request
+         * @throws std::runtime_error If a field is missing or has an invalid value
+         */
+        void
+        decode_request(
+                const pt::ptree &request,
+                query_request &parsed
+        ) {
+            // identify the query inside the json
+            boost::optional<std::string> query_opt = request.get_optional<std::string>("query");
+            if (!query_opt) {
+                throw std::runtime_error("Missing query field");
+            }
+            parsed.terms_format = query_request::TERMS_QUERY_STRING;
+            parsed.query = query_opt.get();
+
+            auto rel_opt = request.get_child_optional("rel");
+            if (rel_opt) {
+                parsed.has_rel = true;
+                for (const pt::ptree::value_type &docid_obj : rel_opt.get()) {
+                    parsed.rel.push_back(docid_obj.second.get_value<std::size_t>());
+                }
+                if (parsed.rel.size() == 0) {
+                    throw std::runtime_error("Empty rel option");
+                }
+            }
+            boost::optional<std::string> skip_unknown_rel_opt = request.get_optional<std::string>("skip_unknown_rel");
+            if (skip_unknown_rel_opt) {
+                if (skip_unknown_rel_opt.get() == "true") {
+                    parsed.skip_unknown_rel = true;
+                } else if (skip_unknown_rel_opt.get() != "false") {
+                    throw std::runtime_error("Unrecognized skip_unknown_rel");
+                }
+            }
+
+            // query normalization
+            boost::optional<std::string> query_normalization_opt = request.get_optional<std::string>("query_normalization");
+            if (query_normalization_opt) {
+                if (query_normalization_opt.get() == "false") {
+                    parsed.query_normalization = false;
+                } else if (query_normalization_opt.get() != "true") {
+                    throw std::runtime_error("Unrecognized query_normalization");
+                }
+            }
+
+            // ranked
+            boost::optional<unsigned int> ranked_at_opt = request.get_optional<unsigned int>("ranked_at");
+            if (ranked_at_opt) {
+                parsed.ranked_at = ranked_at_opt.get();
+                if (parsed.ranked_at == 0) {
+                    throw std::runtime_error("Ranked at must be greater than 0 and lower than 1M");
+                }
+            }
+
+            // query type
+            boost::optional<std::string> query_type_opt = request.get_optional<std::string>("query_type");
+            if (query_type_opt) {
+                parsed.query_type = query_type_from_string(query_type_opt.get());
+            }
+
+            // deadline
+            boost::optional<unsigned int> timeout_ms_opt = request.get_optional<unsigned int>("timeout_ms");
+            if (timeout_ms_opt) {
+                parsed.has_timeout = true;
+                parsed.timeout_ms = timeout_ms_opt.get();
+            }
+        }
+
+        /**
+         * Puts a list of segments as an array, omitted when empty
+         */
+        void
+        put_segments(
+                pt::ptree &json,
+                const std::string &key,
+                const std::vector<std::string> &segments
+        ) {
+            if (segments.empty()) {
+                return;
+            }
+            pt::ptree array;
+            for (const auto & segment: segments) {
+                pt::ptree segment_json;
+                segment_json.put_value(segment);
+                array.push_back(std::make_pair("", segment_json));
+            }
+            json.add_child(key, array);
+        }
+
+        void
+        get_segments(
+                const pt::ptree &json,
+                const std::string &key,
+                std::vector<std::string> &segments
+        ) {
+            auto array_opt = json.get_child_optional(key);
+            if (array_opt) {
+                for (const pt::ptree::value_type &segment_json: array_opt.get()) {
+                    segments.push_back(segment_json.second.get_value<std::string>());
+                }
+            }
+        }
+
+        /**
+         * Encodes a reply as json
+         */
+        void
+        encode_reply(
+                const query_reply &reply,
+                pt::ptree &json
+        ) {
+            json.put<std::size_t>("num_ret", reply.num_ret);
+            json.put<double>("exe_time", reply.exe_time);
+            if (reply.has_rel) {
+                json.put<std::size_t>("num_rel_ret", reply.num_rel_ret);
+                json.put<std::size_t>("num_rel", reply.num_rel);
+            }
+            if (reply.has_deadline) {
+                json.put<bool>("timed_out", reply.timed_out);
+            }
+            if (reply.has_results) {
+                json.put<uint64_t>("num_hits", reply.num_hits);
+                json.put<bool>("num_hits_exact", reply.num_hits_exact);
+                pt::ptree results;
+                for (const auto & result: reply.results) {
+                    pt::ptree result_json;
+                    result_json.put<uint64_t>("docid", result.docid);
+                    result_json.put<float>("score", result.score);
+                    results.push_back(std::make_pair("", result_json));
+                }
+                json.add_child("results", results);
+            }
+            if (!reply.shards.empty()) {
+                pt::ptree shards;
+                for (const auto & shard: reply.shards) {
+                    pt::ptree shard_json;
+                    shard_json.put<double>("exe_time", shard.exe_time);
+                    shard_json.put<uint64_t>("num_ret", shard.num_ret);
+                    if (shard.missing) {
+                        shard_json.put<bool>("missing", true);
+                    }
+                    if (shard.hedged) {
+                        shard_json.put<bool>("hedged", true);
+                    }
+                    shards.push_back(std::make_pair("", shard_json));
+                }
+                json.add_child("shards", shards);
+            }
+            if (reply.partial) {
+                json.put<bool>("partial", true);
+            }
+            if (reply.cached) {
+                json.put<bool>("cached", true);
+            }
+            put_segments(json, "missing_segments", reply.missing_segments);
+            put_segments(json, "unknown_segments", reply.unknown_segments);
+            if (reply.has_prefetch) {
+                json.put<uint64_t>("prefetched_lists", reply.prefetched_lists);
+                json.put<uint64_t>("prefetch_faults", reply.prefetch_faults);
+                json.put<double>("prefetch_wait", reply.prefetch_wait);
+                json.put<uint64_t>("major_faults", reply.major_faults);
+            }
+        }
+
+        /**
+         * Decodes a json reply, used by the clients
+         * @param error Filled with the error message of an error reply
+         * @return False if the reply is an error
+         */
+        bool
+        decode_reply(
+                const pt::ptree &json,
+                query_reply &reply,
+                std::string &error
+        ) {
+            boost::optional<std::string> error_opt = json.get_optional<std::string>("error");
+            if (error_opt) {
+                error = error_opt.get();
+                return false;
+            }
+
+            reply.num_ret = json.get<uint64_t>("num_ret");
+            reply.exe_time = json.get<double>("exe_time");
+            boost::optional<uint64_t> num_rel_ret_opt = json.get_optional<uint64_t>("num_rel_ret");
+            reply.has_rel = static_cast<bool>(num_rel_ret_opt);
+            if (reply.has_rel) {
+                reply.num_rel_ret = num_rel_ret_opt.get();
+                reply.num_rel = json.get<uint64_t>("num_rel");
+            }
+            boost::optional<bool> timed_out_opt = json.get_optional<bool>("timed_out");
+            reply.has_deadline = static_cast<bool>(timed_out_opt);
+            reply.timed_out = reply.has_deadline && timed_out_opt.get();
+            auto results_opt = json.get_child_optional("results");
+            reply.has_results = static_cast<bool>(results_opt);
+            if (reply.has_results) {
+                reply.num_hits = json.get<uint64_t>("num_hits");
+                reply.num_hits_exact = json.get<bool>("num_hits_exact");
+                for (const pt::ptree::value_type &result_json: results_opt.get()) {
+                    reply.results.push_back(result_document {
+                            result_json.second.get<uint64_t>("docid"),
+                            result_json.second.get<float>("score")
+                    });
+                }
+            }
+            auto shards_opt = json.get_child_optional("shards");
+            if (shards_opt) {
+                for (const pt::ptree::value_type &shard_json: shards_opt.get()) {
+                    reply.shards.push_back(shard_stats {
+                            shard_json.second.get<double>("exe_time"),
+                            shard_json.second.get<uint64_t>("num_ret"),
+                            shard_json.second.get<bool>("missing", false),
+                            shard_json.second.get<bool>("hedged", false)
+                    });
+                }
+            }
+            reply.partial = json.get<bool>("partial", false);
+            reply.cached = json.get<bool>("cached", false);
+            get_segments(json, "missing_segments", reply.missing_segments);
+            get_segments(json, "unknown_segments", reply.unknown_segments);
+            boost::optional<uint64_t> prefetched_lists_opt = json.get_optional<uint64_t>("prefetched_lists");
+            reply.has_prefetch = static_cast<bool>(prefetched_lists_opt);
+            if (reply.has_prefetch) {
+                reply.prefetched_lists = prefetched_lists_opt.get();
+                reply.prefetch_faults = json.get<uint64_t>("prefetch_faults");
+                reply.prefetch_wait = json.get<double>("prefetch_wait");
+                reply.major_faults = json.get<uint64_t>("major_faults");
+            }
+
+            return true;
+        }
+    }
+}
+
+#endif //INDEX_PARTITIONING_JSON_PROTOCOL_HPP
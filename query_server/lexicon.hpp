@@ -0,0 +1,317 @@
+#ifndef INDEX_PARTITIONING_LEXICON_HPP
+#define INDEX_PARTITIONING_LEXICON_HPP
+
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/iostreams/filtering_streambuf.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "aux_cache.hpp"
+#include "memory_placement.hpp"
+
+
+/**
+ * Compiled lexicon mapping the segments of a gzipped list, e.g., .terms, to their term ids, compiled once and
+ * memory-mapped from its snapshot (see aux_cache.hpp). The term id of a segment is the position of its first
+ * occurrence among the non-empty lines of the list, the following occurrences are skipped.
+ * The payload of the snapshot is an open-addressing hash table whose slots point to the segments, which are stored
+ * to verify the matches. A lookup reads the mapped file only. All the integers are in native byte order.
+ *
+ *   offset  size  field
+ *        0     4  magic "QSLX"
+ *        4     4  version
+ *        8     8  num_terms
+ *       16     8  num_slots, a power of two at least twice num_terms
+ *       24     8  strings_size
+ *       32        num_slots u32 slots: term id + 1 of the segment hashed there, 0 when the slot is empty
+ *                 num_terms + 1 u64 offsets of the segments inside the strings, ordered by term id
+ *                 strings_size bytes: the segments, concatenated
+ */
+namespace query_server {
+    /**
+     * Reads a gzipped list of segments, one per line, skipping the empty lines
+     * @throws std::runtime_error If the file cannot be opened
+     */
+    void
+    read_segment_list(
+            const std::string & file_path,
+            const std::function<void(const std::string &)> & callback
+    ) {
+        std::ifstream file(file_path, std::ios_base::in | std::ios_base::binary);
+        if (!file.is_open()) {
+            throw std::runtime_error("Error opening file " + file_path);
+        }
+        boost::iostreams::filtering_streambuf<boost::iostreams::input> inbuf;
+        inbuf.push(boost::iostreams::gzip_decompressor());
+        inbuf.push(file);
+        std::istream instream(&inbuf); // convert streambuf to istream
+
+        for (std::string segment; getline(instream, segment);) {
+            if (segment.size() == 0) {
+                continue;
+            }
+            callback(segment);
+        }
+    }
+
+
+    class Lexicon {
+    public:
+        typedef uint32_t term_id_type;
+
+        static const uint32_t version = 1;
+        static const std::size_t header_size = 32;
+
+        Lexicon()
+                : _data(nullptr),
+                  _size(0),
+                  _num_terms(0),
+                  _num_slots(0),
+                  _slots(nullptr),
+                  _offsets(nullptr),
+                  _strings(nullptr) {}
+
+        Lexicon(const Lexicon &) = delete;
+        Lexicon & operator=(const Lexicon &) = delete;
+
+        /**
+         * Maps the snapshot of the lexicon of a gzipped list of segments if it is still valid, otherwise compiles the
+         * lexicon and writes its snapshot for the following loads
+         * @return True if the snapshot has been mapped
+         */
+        bool load(const std::string & source_path) {
+            const char * payload;
+            std::size_t payload_size;
+            if (aux_cache::open(source_path, "LEXI", version, this->_file, payload, payload_size)) {
+                this->_buffer.clear();
+                this->attach(payload, payload_size);
+                std::cerr << " Lexicon::load: stored " << this->_num_terms << " segments (snapshot)" << std::endl;
+                return true;
+            }
+
+            aux_cache::source_stamp stamp;
+            const bool has_stamp = aux_cache::stat_source(source_path, stamp);
+            this->build(source_path);
+            if (has_stamp) {
+                aux_cache::write(source_path, stamp, "LEXI", version, this->_buffer);
+            }
+            return false;
+        }
+
+        /**
+         * Builds the lexicon in memory from a gzipped list of segments, with the same layout of the snapshot
+         */
+        void build(const std::string & terms_path) {
+            if (this->_file.is_open()) {
+                this->_file.close();
+            }
+            Lexicon::compile(terms_path, this->_buffer);
+            this->attach(this->_buffer.data(), this->_buffer.size());
+        }
+
+        /**
+         * Moves the lexicon from its mapping to anonymous memory backed by huge pages, since every lookup probes a
+         * random slot
+         */
+        void relocate(HugePagesMode mode) {
+            std::unique_ptr<PlacedBuffer> placed(new PlacedBuffer(this->_size, mode));
+            std::memcpy(placed->data(), this->_data, this->_size);
+            this->attach(placed->data(), placed->size());
+            this->_placed = std::move(placed);
+            std::string().swap(this->_buffer);
+            if (this->_file.is_open()) {
+                this->_file.close();
+            }
+        }
+
+        /**
+         * Compiles a gzipped list of segments and writes the snapshot of its lexicon
+         * @throws std::runtime_error If the list cannot be read or the snapshot cannot be written
+         */
+        static void write(const std::string & source_path) {
+            aux_cache::source_stamp stamp;
+            if (!aux_cache::stat_source(source_path, stamp)) {
+                throw std::runtime_error("Error opening file " + source_path);
+            }
+            std::string buffer;
+            Lexicon::compile(source_path, buffer);
+            if (!aux_cache::write(source_path, stamp, "LEXI", version, buffer)) {
+                throw std::runtime_error("Error writing file " + aux_cache::cache_path(source_path));
+            }
+        }
+
+        /**
+         * @param term_id Filled with the term id of the segment, if it is in the lexicon
+         * @return True if the segment is in the lexicon
+         */
+        bool find(const char * segment, std::size_t size, term_id_type & term_id) const {
+            if (this->_num_slots == 0) {
+                return false;
+            }
+            const uint64_t mask = this->_num_slots - 1;
+            for (uint64_t slot = Lexicon::hash(segment, size) & mask; ; slot = (slot + 1) & mask) {
+                const uint32_t entry = this->_slots[slot];
+                if (entry == 0) {
+                    return false;
+                }
+                if (this->matches(entry - 1, segment, size)) {
+                    term_id = entry - 1;
+                    return true;
+                }
+            }
+        }
+
+        bool find(const std::string & segment, term_id_type & term_id) const {
+            return this->find(segment.data(), segment.size(), term_id);
+        }
+
+        /**
+         * @return The number of segments
+         */
+        std::size_t size() const {
+            return this->_num_terms;
+        }
+
+        /**
+         * @return The segment having the given term id
+         */
+        std::string segment(term_id_type term_id) const {
+            return std::string(this->_strings + this->_offsets[term_id], this->_offsets[term_id + 1] - this->_offsets[term_id]);
+        }
+
+        /**
+         * FNV-1a, stable across builds since the hash values are stored in the snapshots
+         */
+        static uint64_t hash(const char * data, std::size_t size) {
+            uint64_t h = 14695981039346656037ull;
+            for (std::size_t i = 0; i < size; ++i) {
+                h ^= static_cast<unsigned char>(data[i]);
+                h *= 1099511628211ull;
+            }
+            return h;
+        }
+
+    private:
+
+        bool matches(term_id_type term_id, const char * segment, std::size_t size) const {
+            const uint64_t begin = this->_offsets[term_id];
+            return this->_offsets[term_id + 1] - begin == size && std::memcmp(this->_strings + begin, segment, size) == 0;
+        }
+
+        void attach(const char * data, std::size_t size) {
+            if (size < header_size || std::memcmp(data, "QSLX", 4) != 0) {
+                throw std::runtime_error("Not a lexicon");
+            }
+            uint32_t file_version;
+            uint64_t strings_size;
+            std::memcpy(&file_version, data + 4, 4);
+            std::memcpy(&this->_num_terms, data + 8, 8);
+            std::memcpy(&this->_num_slots, data + 16, 8);
+            std::memcpy(&strings_size, data + 24, 8);
+            if (file_version != version) {
+                throw std::runtime_error("Unsupported version of the lexicon");
+            }
+            if ((this->_num_slots & (this->_num_slots - 1)) != 0 || this->_num_slots < 2 * this->_num_terms
+                || size != header_size + 4 * this->_num_slots + 8 * (this->_num_terms + 1) + strings_size) {
+                throw std::runtime_error("Corrupted lexicon");
+            }
+            this->_slots = reinterpret_cast<const uint32_t *>(data + header_size);
+            this->_offsets = reinterpret_cast<const uint64_t *>(data + header_size + 4 * this->_num_slots);
+            this->_strings = data + header_size + 4 * this->_num_slots + 8 * (this->_num_terms + 1);
+            this->_data = data;
+            this->_size = size;
+        }
+
+        /**
+         * Reads the segments of a gzipped list and lays out the lexicon in buffer
+         */
+        static void compile(const std::string & terms_path, std::string & buffer) {
+            // the slots are doubled when they are half full, so that the probe sequences stay short
+            std::string strings;
+            std::vector<uint64_t> offsets(1, 0);
+            std::vector<uint32_t> slots(1024, 0);
+            read_segment_list(terms_path, [&strings, &offsets, &slots](const std::string & segment) {
+                if (2 * offsets.size() > slots.size()) {
+                    std::vector<uint32_t> grown(2 * slots.size(), 0);
+                    for (uint32_t entry: slots) {
+                        if (entry != 0) {
+                            const uint64_t begin = offsets[entry - 1];
+                            Lexicon::insert(grown, Lexicon::hash(strings.data() + begin, offsets[entry] - begin), entry);
+                        }
+                    }
+                    slots.swap(grown);
+                }
+
+                const uint64_t h = Lexicon::hash(segment.data(), segment.size());
+                const uint64_t mask = slots.size() - 1;
+                bool duplicate = false;
+                for (uint64_t slot = h & mask; slots[slot] != 0; slot = (slot + 1) & mask) {
+                    const uint64_t begin = offsets[slots[slot] - 1];
+                    if (offsets[slots[slot]] - begin == segment.size() && strings.compare(begin, segment.size(), segment) == 0) {
+                        duplicate = true;
+                        break;
+                    }
+                }
+                if (duplicate) {
+                    std::cerr << "The segment \"" << segment << "\" appeared two times into the map file" << std::endl;
+                    return;
+                }
+                if (offsets.size() > 0xFFFFFFFFul) {
+                    throw std::runtime_error("Too many segments for the lexicon");
+                }
+
+                strings.append(segment);
+                offsets.push_back(strings.size());
+                Lexicon::insert(slots, h, static_cast<uint32_t>(offsets.size() - 1));
+            });
+
+            const uint32_t file_version = version;
+            const uint64_t num_terms = offsets.size() - 1;
+            const uint64_t num_slots = slots.size();
+            const uint64_t strings_size = strings.size();
+            buffer.clear();
+            buffer.reserve(header_size + 4 * num_slots + 8 * offsets.size() + strings_size);
+            buffer.append("QSLX", 4);
+            buffer.append(reinterpret_cast<const char *>(&file_version), 4);
+            buffer.append(reinterpret_cast<const char *>(&num_terms), 8);
+            buffer.append(reinterpret_cast<const char *>(&num_slots), 8);
+            buffer.append(reinterpret_cast<const char *>(&strings_size), 8);
+            buffer.append(reinterpret_cast<const char *>(slots.data()), 4 * num_slots);
+            buffer.append(reinterpret_cast<const char *>(offsets.data()), 8 * offsets.size());
+            buffer.append(strings);
+
+            std::cerr << " Lexicon::compile: stored " << num_terms << " segments" << std::endl;
+        }
+
+        static void insert(std::vector<uint32_t> & slots, uint64_t h, uint32_t entry) {
+            const uint64_t mask = slots.size() - 1;
+            uint64_t slot = h & mask;
+            while (slots[slot] != 0) {
+                slot = (slot + 1) & mask;
+            }
+            slots[slot] = entry;
+        }
+
+    private:
+        boost::iostreams::mapped_file_source _file;
+        std::string _buffer; // the lexicon built in memory, when it is not mapped
+        std::unique_ptr<PlacedBuffer> _placed; // the lexicon moved to huge pages
+        const char * _data;
+        std::size_t _size;
+        uint64_t _num_terms;
+        uint64_t _num_slots;
+        const uint32_t * _slots;
+        const uint64_t * _offsets;
+        const char * _strings;
+    };
+}
+
+#endif //INDEX_PARTITIONING_LEXICON_HPP
@@ -0,0 +1,262 @@
+#ifndef INDEX_PARTITIONING_LIST_PREFETCHER_HPP
+#define INDEX_PARTITIONING_LIST_PREFETCHER_HPP
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <sys/resource.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "thread_pool.hpp"
+
+
+namespace query_server {
+    /**
+     * @return The number of major page faults of the calling thread, i.e., the faults waiting for a disk read
+     */
+    uint64_t
+    thread_major_faults() {
+        struct rusage usage;
+        if (getrusage(RUSAGE_THREAD, &usage) != 0) {
+            return 0;
+        }
+        return static_cast<uint64_t>(usage.ru_majflt);
+    }
+
+
+    /**
+     * The posting lists of an index read into memory by a prefetch, one state per term.
+     * The page cache can evict a list afterwards, thus a list is resident for ttl_s seconds after its prefetch only,
+     * or until an evaluation reading it takes major faults, then the next query reads it again.
+     */
+    class ResidentLists {
+    public:
+        typedef std::chrono::steady_clock clock;
+
+        enum claim_result {
+            LIST_CLAIMED, // the caller has to load the list
+            LIST_LOADING, // another query is loading the list
+            LIST_RESIDENT
+        };
+
+        ResidentLists()
+                : _num_terms(0) {}
+
+        ResidentLists(const ResidentLists &) = delete;
+        ResidentLists & operator=(const ResidentLists &) = delete;
+
+        /**
+         * Marks all the lists of an index of num_terms terms as cold
+         */
+        void reset(std::size_t num_terms) {
+            this->_states.reset(new std::atomic<uint32_t>[num_terms]);
+            for (std::size_t i = 0; i < num_terms; ++i) {
+                this->_states[i].store(list_cold, std::memory_order_relaxed);
+            }
+            this->_num_terms = num_terms;
+            this->_epoch = clock::now();
+        }
+
+        /**
+         * Claims the load of a list that is cold or whose prefetch is older than ttl_s seconds, 0 for no limit
+         */
+        claim_result claim(std::size_t term_id, unsigned int ttl_s) {
+            if (term_id >= this->_num_terms) {
+                return LIST_RESIDENT;
+            }
+            uint32_t state = this->_states[term_id].load(std::memory_order_relaxed);
+            for (;;) {
+                if (state == list_loading) {
+                    return LIST_LOADING;
+                }
+                if (state != list_cold && (ttl_s == 0 || this->now() - state < ttl_s)) {
+                    return LIST_RESIDENT;
+                }
+                if (this->_states[term_id].compare_exchange_weak(state, list_loading, std::memory_order_relaxed)) {
+                    return LIST_CLAIMED;
+                }
+            }
+        }
+
+        /**
+         * Ends the load of a list claimed, waking up the queries waiting for it
+         */
+        void set_resident(std::size_t term_id) {
+            {
+                boost::lock_guard<boost::mutex> lock(this->_mutex);
+                this->_states[term_id].store(this->now(), std::memory_order_relaxed);
+            }
+            this->_cond.notify_all();
+        }
+
+        /**
+         * Waits until the list loaded by another query is resident
+         */
+        void wait(std::size_t term_id) {
+            boost::unique_lock<boost::mutex> lock(this->_mutex);
+            while (this->_states[term_id].load(std::memory_order_relaxed) == list_loading) {
+                this->_cond.wait(lock);
+            }
+        }
+
+        /**
+         * Marks the resident lists of the terms as cold, e.g., when their evaluation has taken major faults
+         */
+        void evict(const std::vector<std::size_t> & terms) {
+            for (std::size_t term_id: terms) {
+                if (term_id >= this->_num_terms) {
+                    continue;
+                }
+                uint32_t state = this->_states[term_id].load(std::memory_order_relaxed);
+                while (state != list_cold && state != list_loading) {
+                    if (this->_states[term_id].compare_exchange_weak(state, list_cold, std::memory_order_relaxed)) {
+                        break;
+                    }
+                }
+            }
+        }
+
+    private:
+        // a resident list stores the second of its prefetch since the reset, offset by the two other states
+        static const uint32_t list_cold = 0;
+        static const uint32_t list_loading = 1;
+
+        uint32_t now() const {
+            return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::seconds>(clock::now() - this->_epoch).count()) + 2;
+        }
+
+    private:
+        std::unique_ptr<std::atomic<uint32_t>[]> _states;
+        std::size_t _num_terms;
+        clock::time_point _epoch;
+        boost::mutex _mutex;
+        boost::condition_variable _cond;
+    };
+
+
+    /**
+     * The outcome of the prefetch of the lists of a query
+     */
+    struct prefetch_stats {
+        uint64_t num_lists; // cold lists read by the helpers
+        uint64_t num_faults; // major page faults taken by the helpers
+        double wait; // milliseconds waited by the evaluation
+    };
+
+
+    /**
+     * Reads the cold posting lists of a query into memory before its evaluation on a pool of helper threads, so that
+     * their page faults are taken in parallel instead of one at a time inside the evaluation loop.
+     * The evaluation waits for the cold lists only, and for the ones being read for another query, it starts right
+     * away when all the lists are resident.
+     */
+    class ListPrefetcher {
+    public:
+        /**
+         * @param resident_ttl_s The seconds after which a list prefetched is read again, 0 for never
+         */
+        ListPrefetcher(unsigned int num_threads, unsigned int resident_ttl_s)
+                : _helpers(num_threads),
+                  _resident_ttl_s(resident_ttl_s) {}
+
+        ListPrefetcher(const ListPrefetcher &) = delete;
+        ListPrefetcher & operator=(const ListPrefetcher &) = delete;
+
+        /**
+         * Reads the cold lists of the terms, touching their pages through IndexType::warmup, and waits for them
+         * @param lists Filled with the lists of the terms
+         */
+        template <typename IndexType, typename TermIdType>
+        prefetch_stats prefetch(const IndexType & index, ResidentLists & resident, const std::vector<TermIdType> & terms, std::vector<std::size_t> & lists) {
+            prefetch_stats stats {0, 0, 0};
+            std::vector<std::size_t> cold_terms;
+            std::vector<std::size_t> loading_terms;
+            for (TermIdType term_id: terms) {
+                lists.push_back(term_id);
+                switch (resident.claim(term_id, this->_resident_ttl_s)) {
+                    case ResidentLists::LIST_CLAIMED:
+                        cold_terms.push_back(term_id);
+                        break;
+                    case ResidentLists::LIST_LOADING:
+                        loading_terms.push_back(term_id);
+                        break;
+                    case ResidentLists::LIST_RESIDENT:
+                        break;
+                }
+            }
+            if (cold_terms.empty() && loading_terms.empty()) {
+                return stats;
+            }
+
+            // the latch is shared with the helpers, a helper may still release its lock after the wait ends
+            const auto start = std::chrono::steady_clock::now();
+            std::shared_ptr<latch> done(new latch(cold_terms.size()));
+            for (std::size_t term_id: cold_terms) {
+                this->_helpers.submit([&index, &resident, term_id, done]() {
+                    const uint64_t faults = thread_major_faults();
+                    try {
+                        index.warmup(term_id);
+                    } catch (...) {
+                        // the evaluation reads the list anyway
+                    }
+                    resident.set_resident(term_id);
+                    boost::lock_guard<boost::mutex> lock(done->mutex);
+                    done->num_faults += thread_major_faults() - faults;
+                    if (--done->remaining == 0) {
+                        done->cond.notify_all();
+                    }
+                });
+            }
+            {
+                boost::unique_lock<boost::mutex> lock(done->mutex);
+                while (done->remaining > 0) {
+                    done->cond.wait(lock);
+                }
+                stats.num_faults = done->num_faults;
+            }
+            for (std::size_t term_id: loading_terms) {
+                resident.wait(term_id);
+            }
+            stats.num_lists = cold_terms.size();
+            stats.wait = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            return stats;
+        }
+
+        /**
+         * Reads the cold lists of the terms of all the groups of a cnf query
+         */
+        template <typename IndexType, typename TermIdType>
+        prefetch_stats prefetch(const IndexType & index, ResidentLists & resident, const std::vector<std::vector<TermIdType>> & groups, std::vector<std::size_t> & lists) {
+            std::vector<TermIdType> terms;
+            for (const auto & group: groups) {
+                terms.insert(terms.end(), group.begin(), group.end());
+            }
+            return this->prefetch(index, resident, terms, lists);
+        }
+
+        std::size_t num_helpers() const {
+            return this->_helpers.size();
+        }
+
+    private:
+        struct latch {
+            latch(std::size_t remaining)
+                    : remaining(remaining),
+                      num_faults(0) {}
+
+            boost::mutex mutex;
+            boost::condition_variable cond;
+            std::size_t remaining;
+            uint64_t num_faults;
+        };
+
+    private:
+        ThreadPool _helpers;
+        const unsigned int _resident_ttl_s;
+    };
+}
+
+#endif //INDEX_PARTITIONING_LIST_PREFETCHER_HPP
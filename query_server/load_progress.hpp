@@ -0,0 +1,348 @@
+#ifndef INDEX_PARTITIONING_LOAD_PROGRESS_HPP
+#define INDEX_PARTITIONING_LOAD_PROGRESS_HPP
+
+#include <boost/thread/mutex.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "thread_pool.hpp"
+
+
+namespace query_server {
+    /**
+     * The state of one stage of the loading of an index, e.g., the warmup of the index file of a shard
+     */
+    struct load_stage_status {
+        enum state_type {
+            STAGE_PENDING,
+            STAGE_RUNNING,
+            STAGE_DONE,
+            STAGE_FAILED
+        };
+
+        std::string basename;
+        std::string name;
+        state_type state;
+        uint64_t done; // work done, e.g., bytes warmed up
+        uint64_t total; // 0 when the amount of work is unknown
+        double elapsed; // ms, up to now for a running stage
+        std::string error;
+    };
+
+    const char *
+    stage_state_to_string(
+            load_stage_status::state_type state
+    ) {
+        switch (state) {
+            case load_stage_status::STAGE_PENDING:
+                return "pending";
+            case load_stage_status::STAGE_RUNNING:
+                return "running";
+            case load_stage_status::STAGE_DONE:
+                return "done";
+            case load_stage_status::STAGE_FAILED:
+                return "failed";
+        }
+        return "unknown";
+    }
+
+
+    /**
+     * The progress of the stages of the last load of the index, updated by the loading threads and read by the
+     * status requests
+     */
+    class LoadProgress {
+    public:
+        typedef std::chrono::steady_clock clock;
+
+        LoadProgress() = default;
+        LoadProgress(const LoadProgress &) = delete;
+        LoadProgress & operator=(const LoadProgress &) = delete;
+
+        /**
+         * Forgets the stages of the previous load
+         */
+        void reset() {
+            boost::lock_guard<boost::mutex> lock(this->_mutex);
+            this->_stages.clear();
+        }
+
+        /**
+         * @return The id of the new stage, pending until it starts
+         */
+        std::size_t add_stage(const std::string & basename, const std::string & name) {
+            boost::lock_guard<boost::mutex> lock(this->_mutex);
+            this->_stages.push_back(stage {
+                    load_stage_status {basename, name, load_stage_status::STAGE_PENDING, 0, 0, 0, ""},
+                    clock::time_point()
+            });
+            return this->_stages.size() - 1;
+        }
+
+        void start(std::size_t id) {
+            boost::lock_guard<boost::mutex> lock(this->_mutex);
+            this->_stages[id].status.state = load_stage_status::STAGE_RUNNING;
+            this->_stages[id].start = clock::now();
+        }
+
+        void set_total(std::size_t id, uint64_t total) {
+            boost::lock_guard<boost::mutex> lock(this->_mutex);
+            this->_stages[id].status.total = total;
+        }
+
+        void advance(std::size_t id, uint64_t amount) {
+            boost::lock_guard<boost::mutex> lock(this->_mutex);
+            this->_stages[id].status.done += amount;
+        }
+
+        void finish(std::size_t id) {
+            boost::lock_guard<boost::mutex> lock(this->_mutex);
+            stage & s = this->_stages[id];
+            s.status.state = load_stage_status::STAGE_DONE;
+            s.status.done = std::max(s.status.done, s.status.total);
+            s.status.elapsed = elapsed_ms(s.start);
+        }
+
+        void fail(std::size_t id, const std::string & error) {
+            boost::lock_guard<boost::mutex> lock(this->_mutex);
+            stage & s = this->_stages[id];
+            s.status.state = load_stage_status::STAGE_FAILED;
+            s.status.error = error;
+            s.status.elapsed = elapsed_ms(s.start);
+        }
+
+        /**
+         * @return The state of every stage, in the order they were added
+         */
+        std::vector<load_stage_status> stages() const {
+            boost::lock_guard<boost::mutex> lock(this->_mutex);
+            std::vector<load_stage_status> result;
+            result.reserve(this->_stages.size());
+            for (const stage & s: this->_stages) {
+                result.push_back(s.status);
+                if (s.status.state == load_stage_status::STAGE_RUNNING) {
+                    result.back().elapsed = elapsed_ms(s.start);
+                }
+            }
+            return result;
+        }
+
+    private:
+        struct stage {
+            load_stage_status status;
+            clock::time_point start;
+        };
+
+        static double elapsed_ms(clock::time_point start) {
+            return std::chrono::duration<double, std::milli>(clock::now() - start).count();
+        }
+
+    private:
+        mutable boost::mutex _mutex;
+        std::vector<stage> _stages;
+    };
+
+
+    /**
+     * Touches every page of a mapped file to load it in memory, as map_flags::warmup does, splitting the file in
+     * chunks read in parallel
+     * @param progress Optional, advanced by the bytes of every chunk read
+     */
+    void
+    warmup_mapped_file(
+            const char * data,
+            std::size_t size,
+            unsigned int num_threads,
+            LoadProgress * progress,
+            std::size_t stage_id
+    ) {
+        const std::size_t page_size = 4096;
+        const std::size_t chunk_size = 16 << 20;
+        const long num_chunks = static_cast<long>((size + chunk_size - 1) / chunk_size);
+        uint64_t checksum = 0;
+
+        #pragma omp parallel for schedule(dynamic, 1) num_threads(num_threads) reduction(+:checksum)
+        for (long c = 0; c < num_chunks; ++c) {
+            const std::size_t begin = static_cast<std::size_t>(c) * chunk_size;
+            const std::size_t end = std::min(size, begin + chunk_size);
+            for (std::size_t i = begin; i < end; i += page_size) {
+                checksum += static_cast<unsigned char>(data[i]);
+            }
+            if (progress != nullptr) {
+                progress->advance(stage_id, end - begin);
+            }
+        }
+
+        // the reads cannot be optimized away
+        volatile uint64_t sink = checksum;
+        (void) sink;
+    }
+
+
+    /**
+     * Copies a mapped file to memory, splitting it in chunks copied in parallel by threads that inherit the NUMA node
+     * of the caller, as warmup_mapped_file does
+     * @param progress Optional, advanced by the bytes of every chunk copied
+     */
+    void
+    copy_mapped_file(
+            char * destination,
+            const char * data,
+            std::size_t size,
+            unsigned int num_threads,
+            LoadProgress * progress,
+            std::size_t stage_id
+    ) {
+        const std::size_t chunk_size = 16 << 20;
+        const long num_chunks = static_cast<long>((size + chunk_size - 1) / chunk_size);
+
+        #pragma omp parallel for schedule(dynamic, 1) num_threads(num_threads)
+        for (long c = 0; c < num_chunks; ++c) {
+            const std::size_t begin = static_cast<std::size_t>(c) * chunk_size;
+            const std::size_t end = std::min(size, begin + chunk_size);
+            std::memcpy(destination + begin, data + begin, end - begin);
+            if (progress != nullptr) {
+                progress->advance(stage_id, end - begin);
+            }
+        }
+    }
+
+
+    /**
+     * Runs independent loading stages concurrently on a pool of threads, reporting their progress.
+     * A stage receives its id, used to report the progress of long stages, e.g., the warmup of a file.
+     * The loader never runs more than num_threads threads: the stages run on a pool of at most num_threads threads, the
+     * warmups and the copies get in addition the threads of the pool left idle, thus a single large file is read by all
+     * of them while the stages of a sharded index share them.
+     */
+    class StagedLoader {
+    public:
+        typedef std::function<void(std::size_t)> stage_type;
+
+        /**
+         * @param num_threads The number of threads running the stages and warming up or copying the files
+         */
+        StagedLoader(LoadProgress & progress, unsigned int num_threads)
+                : _progress(progress),
+                  _num_threads(num_threads),
+                  _num_spare_threads(0),
+                  _num_pending_stages(0) {}
+
+        StagedLoader(const StagedLoader &) = delete;
+        StagedLoader & operator=(const StagedLoader &) = delete;
+
+        void add(const std::string & basename, const std::string & name, stage_type stage) {
+            this->_stages.push_back(stage);
+            this->_ids.push_back(this->_progress.add_stage(basename, name));
+        }
+
+        /**
+         * Warms up a mapped file from a stage, splitting it among the threads of the loader
+         */
+        void warmup(std::size_t stage_id, const char * data, std::size_t size) {
+            this->_progress.set_total(stage_id, size);
+            const unsigned int num_threads = this->acquire_threads();
+            warmup_mapped_file(data, size, num_threads, &this->_progress, stage_id);
+            this->release_threads(num_threads);
+        }
+
+        /**
+         * Copies a mapped file from a stage, splitting it among the threads of the loader.
+         * The stage sets its total, e.g., the size of all the copies of the file.
+         */
+        void copy(std::size_t stage_id, char * destination, const char * data, std::size_t size) {
+            const unsigned int num_threads = this->acquire_threads();
+            copy_mapped_file(destination, data, size, num_threads, &this->_progress, stage_id);
+            this->release_threads(num_threads);
+        }
+
+        void set_total(std::size_t stage_id, uint64_t total) {
+            this->_progress.set_total(stage_id, total);
+        }
+
+        /**
+         * Runs all the stages and waits for their completion
+         * @throws The exception of the first stage failed, after the completion of the other ones
+         */
+        void run() {
+            std::vector<std::exception_ptr> errors(this->_stages.size());
+            {
+                const std::size_t num_stage_threads = std::max<std::size_t>(1, std::min<std::size_t>(this->_num_threads, this->_stages.size()));
+                {
+                    boost::lock_guard<boost::mutex> lock(this->_mutex);
+                    this->_num_spare_threads = this->_num_threads > num_stage_threads ? this->_num_threads - num_stage_threads : 0;
+                    this->_num_pending_stages = this->_stages.size();
+                }
+                ThreadPool pool(num_stage_threads);
+                for (std::size_t i = 0; i < this->_stages.size(); ++i) {
+                    pool.submit([this, i, &errors]() {
+                        const std::size_t id = this->_ids[i];
+                        {
+                            boost::lock_guard<boost::mutex> lock(this->_mutex);
+                            --this->_num_pending_stages;
+                        }
+                        this->_progress.start(id);
+                        try {
+                            this->_stages[i](id);
+                            this->_progress.finish(id);
+                        } catch (const std::exception &e) {
+                            this->_progress.fail(id, e.what());
+                            errors[i] = std::current_exception();
+                        } catch (...) {
+                            this->_progress.fail(id, "unrecognized exception");
+                            errors[i] = std::current_exception();
+                        }
+                        // the thread of the pool stays idle when no stage is left to start
+                        boost::lock_guard<boost::mutex> lock(this->_mutex);
+                        if (this->_num_pending_stages == 0) {
+                            ++this->_num_spare_threads;
+                        }
+                    });
+                }
+                pool.join();
+            }
+            for (const auto & error: errors) {
+                if (error) {
+                    std::rethrow_exception(error);
+                }
+            }
+        }
+
+        std::size_t num_stages() const {
+            return this->_stages.size();
+        }
+
+    private:
+        /**
+         * @return The number of threads of a warmup or a copy: the one of the stage and all the spare ones
+         */
+        unsigned int acquire_threads() {
+            boost::lock_guard<boost::mutex> lock(this->_mutex);
+            const unsigned int num_threads = 1 + this->_num_spare_threads;
+            this->_num_spare_threads = 0;
+            return num_threads;
+        }
+
+        void release_threads(unsigned int num_threads) {
+            boost::lock_guard<boost::mutex> lock(this->_mutex);
+            this->_num_spare_threads += num_threads - 1;
+        }
+
+    private:
+        LoadProgress & _progress;
+        const unsigned int _num_threads;
+        std::vector<stage_type> _stages;
+        std::vector<std::size_t> _ids; // the ids of the stages in the progress
+        boost::mutex _mutex;
+        unsigned int _num_spare_threads; // threads not used by the stages nor by the warmups
+        std::size_t _num_pending_stages; // stages not started yet
+    };
+}
+
+#endif //INDEX_PARTITIONING_LOAD_PROGRESS_HPP
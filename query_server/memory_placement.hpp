@@ -0,0 +1,352 @@
+#ifndef INDEX_PARTITIONING_MEMORY_PLACEMENT_HPP
+#define INDEX_PARTITIONING_MEMORY_PLACEMENT_HPP
+
+#include <boost/thread/thread.hpp>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+namespace query_server {
+    /**
+     * The pages backing the copies of the index files
+     */
+    enum HugePagesMode {
+        HUGE_PAGES_NONE, // the files are mapped on 4 KB pages
+        HUGE_PAGES_TRANSPARENT, // the files are copied to memory advised for the transparent huge pages
+        HUGE_PAGES_EXPLICIT // the files are copied to the huge pages reserved in vm.nr_hugepages
+    };
+
+    HugePagesMode
+    huge_pages_mode_from_string(
+            const std::string & mode
+    ) {
+        if (mode == "none") {
+            return HUGE_PAGES_NONE;
+        } else if (mode == "transparent") {
+            return HUGE_PAGES_TRANSPARENT;
+        } else if (mode == "explicit") {
+            return HUGE_PAGES_EXPLICIT;
+        }
+        throw std::runtime_error("Unrecognized huge pages mode \"" + mode + "\"");
+    }
+
+    const char *
+    huge_pages_mode_to_string(
+            HugePagesMode mode
+    ) {
+        switch (mode) {
+            case HUGE_PAGES_NONE:
+                return "none";
+            case HUGE_PAGES_TRANSPARENT:
+                return "transparent";
+            case HUGE_PAGES_EXPLICIT:
+                return "explicit";
+        }
+        return "unknown";
+    }
+
+    /**
+     * @return The size of the default huge pages, 2 MB when it cannot be read
+     */
+    std::size_t
+    huge_page_size() {
+        std::ifstream meminfo("/proc/meminfo");
+        std::string line;
+        while (std::getline(meminfo, line)) {
+            if (line.compare(0, 14, "Hugepagesize: ") == 0) {
+                const std::size_t size_kb = std::strtoul(line.c_str() + 14, nullptr, 10);
+                if (size_kb > 0) {
+                    return size_kb << 10;
+                }
+            }
+        }
+        return std::size_t(2) << 20;
+    }
+
+
+    /**
+     * Anonymous memory holding a copy of a file, e.g., of the index, backed by huge pages if requested.
+     * Its pages are allocated on the NUMA node of the thread writing them first.
+     */
+    class PlacedBuffer {
+    public:
+        /**
+         * @param mode The explicit huge pages fall back to the transparent ones when too few of them are reserved
+         * @throws std::runtime_error If the memory cannot be allocated
+         */
+        PlacedBuffer(std::size_t size, HugePagesMode mode)
+                : _data(nullptr),
+                  _size(size),
+                  _mapping(nullptr),
+                  _mapping_size(0),
+                  _mode(mode) {
+            const std::size_t page_size = mode == HUGE_PAGES_NONE ? static_cast<std::size_t>(sysconf(_SC_PAGESIZE)) : huge_page_size();
+            const std::size_t rounded_size = std::max<std::size_t>(1, (size + page_size - 1) / page_size) * page_size;
+
+            if (mode == HUGE_PAGES_EXPLICIT) {
+                void * mapping = mmap(nullptr, rounded_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+                if (mapping != MAP_FAILED) {
+                    this->_mapping = mapping;
+                    this->_mapping_size = rounded_size;
+                    this->_data = static_cast<char *>(mapping);
+                    return;
+                }
+                std::cerr << " PlacedBuffer: not enough reserved huge pages for " << size
+                          << " bytes, using the transparent ones" << std::endl;
+                this->_mode = HUGE_PAGES_TRANSPARENT;
+            }
+
+            // the transparent huge pages need a mapping aligned to their size, thus one more page is mapped and the
+            // unaligned head and tail are returned
+            const std::size_t alignment = this->_mode == HUGE_PAGES_TRANSPARENT ? page_size : 0;
+            void * mapping = mmap(nullptr, rounded_size + alignment, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mapping == MAP_FAILED) {
+                throw std::runtime_error("Unable to allocate " + std::to_string(size) + " bytes");
+            }
+            char * begin = static_cast<char *>(mapping);
+            if (alignment > 0) {
+                const std::size_t head = (alignment - reinterpret_cast<uintptr_t>(mapping) % alignment) % alignment;
+                if (head > 0) {
+                    munmap(begin, head);
+                }
+                if (alignment - head > 0) {
+                    munmap(begin + head + rounded_size, alignment - head);
+                }
+                begin += head;
+                if (madvise(begin, rounded_size, MADV_HUGEPAGE) != 0) {
+                    std::cerr << " PlacedBuffer: transparent huge pages not available" << std::endl;
+                }
+            }
+            this->_mapping = begin;
+            this->_mapping_size = rounded_size;
+            this->_data = begin;
+        }
+
+        PlacedBuffer(const PlacedBuffer &) = delete;
+        PlacedBuffer & operator=(const PlacedBuffer &) = delete;
+
+        ~PlacedBuffer() {
+            if (this->_mapping != nullptr) {
+                munmap(this->_mapping, this->_mapping_size);
+            }
+        }
+
+        char * data() {
+            return this->_data;
+        }
+
+        const char * data() const {
+            return this->_data;
+        }
+
+        std::size_t size() const {
+            return this->_size;
+        }
+
+        /**
+         * @return The pages actually backing the buffer
+         */
+        HugePagesMode huge_pages() const {
+            return this->_mode;
+        }
+
+    private:
+        char * _data;
+        std::size_t _size;
+        void * _mapping;
+        std::size_t _mapping_size;
+        HugePagesMode _mode;
+    };
+
+
+    /**
+     * Parses a cpu list of sysfs, e.g., "0-3,8-11"
+     */
+    std::vector<int>
+    parse_cpu_list(
+            const std::string & list
+    ) {
+        std::vector<int> cpus;
+        std::stringstream stream(list);
+        std::string range;
+        while (std::getline(stream, range, ',')) {
+            if (range.empty() || range == "\n") {
+                continue;
+            }
+            const std::size_t dash = range.find('-');
+            const int first = std::atoi(range.substr(0, dash).c_str());
+            const int last = dash == std::string::npos ? first : std::atoi(range.substr(dash + 1).c_str());
+            for (int cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+    /**
+     * Pins the calling thread to a set of cpus, the threads it creates afterwards inherit the pinning
+     * @return False if the thread cannot be pinned, e.g., when the cpus are outside of the cpuset of the process
+     */
+    bool
+    pin_current_thread(
+            const std::vector<int> & cpus
+    ) {
+        if (cpus.empty()) {
+            return false;
+        }
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu: cpus) {
+            if (cpu >= 0 && cpu < CPU_SETSIZE) {
+                CPU_SET(cpu, &set);
+            }
+        }
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+    }
+
+
+    /**
+     * Where the index lives in memory: the pages backing it and, when it is replicated, the NUMA nodes holding a copy
+     * of it, whose cores run the workers reading it.
+     * The nodes are read from sysfs, a machine without them is seen as a single node.
+     */
+    class MemoryPlacement {
+    public:
+        /**
+         * @param num_replicas The number of NUMA nodes holding a copy of the index, 0 shares one index among all the
+         *                     nodes without pinning the workers. It is limited to the number of nodes.
+         */
+        MemoryPlacement(HugePagesMode huge_pages, unsigned int num_replicas)
+                : _huge_pages(huge_pages) {
+            for (int node = 0; ; ++node) {
+                std::ifstream cpu_list("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+                if (!cpu_list) {
+                    break;
+                }
+                std::string list;
+                std::getline(cpu_list, list);
+                std::vector<int> cpus = parse_cpu_list(list);
+                if (!cpus.empty()) { // the nodes with memory only do not run the workers
+                    this->_node_cpus.push_back(cpus);
+                }
+            }
+
+            const std::size_t num_nodes = std::max<std::size_t>(1, this->_node_cpus.size());
+            this->_num_replicas = std::min<std::size_t>(num_replicas, num_nodes);
+            if (this->_num_replicas > 0 && this->_node_cpus.empty()) {
+                std::cerr << " MemoryPlacement: NUMA topology not available, the index is not replicated" << std::endl;
+                this->_num_replicas = 0;
+            }
+            int max_cpu = -1;
+            for (const auto & cpus: this->_node_cpus) {
+                max_cpu = std::max(max_cpu, *std::max_element(cpus.begin(), cpus.end()));
+            }
+            this->_replica_of_cpu.assign(static_cast<std::size_t>(max_cpu + 1), 0);
+            for (std::size_t node = 0; node < this->_num_replicas; ++node) {
+                for (int cpu: this->_node_cpus[node]) {
+                    this->_replica_of_cpu[static_cast<std::size_t>(cpu)] = node;
+                }
+            }
+        }
+
+        MemoryPlacement(const MemoryPlacement &) = delete;
+        MemoryPlacement & operator=(const MemoryPlacement &) = delete;
+
+        HugePagesMode huge_pages() const {
+            return this->_huge_pages;
+        }
+
+        /**
+         * @return True if the index has a copy on each of the first num_replicas() nodes
+         */
+        bool replicated() const {
+            return this->_num_replicas > 0;
+        }
+
+        /**
+         * @return The number of copies of the index, 1 when it is not replicated
+         */
+        std::size_t num_replicas() const {
+            return std::max<std::size_t>(1, this->_num_replicas);
+        }
+
+        /**
+         * @return True if the index files are copied to anonymous memory instead of being used from their mapping
+         */
+        bool copies_files() const {
+            return this->_huge_pages != HUGE_PAGES_NONE || this->replicated();
+        }
+
+        /**
+         * @return The replica local to the cpu running the calling thread, 0 when the index is not replicated
+         */
+        std::size_t local_replica() const {
+            if (!this->replicated()) {
+                return 0;
+            }
+            const int cpu = sched_getcpu();
+            if (cpu < 0 || static_cast<std::size_t>(cpu) >= this->_replica_of_cpu.size()) {
+                return 0;
+            }
+            return this->_replica_of_cpu[static_cast<std::size_t>(cpu)];
+        }
+
+        /**
+         * Pins the calling worker to the cores of the node of a replica, the workers are spread round-robin among
+         * the replicas. Nothing is done when the index is not replicated.
+         */
+        void pin_worker(std::size_t worker_id) const {
+            if (!this->replicated()) {
+                return;
+            }
+            const std::size_t replica = worker_id % this->_num_replicas;
+            if (!pin_current_thread(this->_node_cpus[replica])) {
+                std::cerr << " MemoryPlacement: unable to pin worker " << worker_id << " to node " << replica << std::endl;
+            }
+        }
+
+        /**
+         * Runs fn on a thread pinned to the node of a replica and waits for it, so that the memory it writes first is
+         * allocated on that node
+         * @throws The exception thrown by fn
+         */
+        template <typename Function>
+        void run_on_replica_node(std::size_t replica, Function fn) const {
+            std::exception_ptr error;
+            boost::thread thread([this, replica, &fn, &error]() {
+                if (this->replicated() && !pin_current_thread(this->_node_cpus[replica])) {
+                    std::cerr << " MemoryPlacement: unable to run on node " << replica << std::endl;
+                }
+                try {
+                    fn();
+                } catch (...) {
+                    error = std::current_exception();
+                }
+            });
+            thread.join();
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+
+    private:
+        HugePagesMode _huge_pages;
+        std::size_t _num_replicas; // 0 when the index is not replicated
+        std::vector<std::vector<int>> _node_cpus; // the cpus of each node with cpus
+        std::vector<std::size_t> _replica_of_cpu;
+    };
+}
+
+#endif //INDEX_PARTITIONING_MEMORY_PLACEMENT_HPP
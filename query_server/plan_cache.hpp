@@ -0,0 +1,201 @@
+#ifndef INDEX_PARTITIONING_PLAN_CACHE_HPP
+#define INDEX_PARTITIONING_PLAN_CACHE_HPP
+
+#include <atomic>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "query_server/cache_sharding.hpp"
+#include "query_server/query_request.hpp"
+#include "query/query_bool_plan.hpp"
+#include "query/query_scanner.hpp"
+
+
+namespace query_server {
+    /**
+     * A query translated for the index of a shard, normalized in advance when the request asks for it, thus ready to
+     * open its cursors: only the member of its query type is filled
+     */
+    struct query_plan {
+        term_id_vec terms; // and, or and maxscore
+        std::vector<term_id_vec> groups; // cnf and cnf_opt
+        query::BoolPlan bool_plan; // boolean
+        std::vector<std::string> missing_segments;
+        std::vector<std::string> unknown_segments;
+    };
+
+    /**
+     * @return The key of a query string in a PlanCache: the query type, the normalization and the tokens of the query,
+     * separated by a single space only between two terms, since the parser ignores any other space. Empty if the query
+     * contains characters that the parser rejects, thus its error is not cached.
+     */
+    std::string
+    plan_cache_key(QueryType query_type, bool query_normalization, const std::string & query) {
+        std::string key;
+        key.reserve(query.size() + 2);
+        key += static_cast<char>('0' + query_type);
+        key += query_normalization ? '1' : '0';
+
+        query::QueryScanner scanner(query);
+        bool after_term = false;
+        for (query::QueryScannerToken token = scanner.getNextToken(); token != query::TOK_END; token = scanner.getNextToken()) {
+            switch (token) {
+                case query::TOK_TERM:
+                    if (after_term) {
+                        key += ' ';
+                    }
+                    key.append(scanner.uLexVal.str_ptr, scanner.uLexVal.str_size);
+                    break;
+                case query::TOK_UNDEFINED:
+                    return std::string();
+                default:
+                    key += scanner.getCurrentChar();
+                    break;
+            }
+            after_term = token == query::TOK_TERM;
+        }
+        return key;
+    }
+
+    /**
+     * Concurrent LRU cache of query plans, keyed by plan_cache_key, so that a repeated query skips its parsing, its
+     * translation and its normalization.
+     * The entries are split among shards by the hash of their key, every one with its own lock and its own LRU list.
+     */
+    class PlanCache {
+    public:
+        typedef std::shared_ptr<const query_plan> plan_ptr;
+
+        PlanCache()
+                : _capacity(0),
+                  _num_shards(0),
+                  _hits(0),
+                  _misses(0) {}
+
+        PlanCache(const PlanCache &) = delete;
+        PlanCache & operator=(const PlanCache &) = delete;
+
+        /**
+         * Empties the cache and sets its capacity, to be called before it is shared by the evaluation threads
+         * @param capacity The maximum number of plans, 0 disables the cache
+         */
+        void
+        reset(std::size_t capacity) {
+            this->_capacity = capacity;
+            this->_num_shards = capacity < max_shards ? capacity : max_shards;
+            this->_shards.reset(this->_num_shards > 0 ? new shard[this->_num_shards] : nullptr);
+            for (std::size_t s = 0; s < this->_num_shards; ++s) {
+                // the first shards take the remainder
+                this->_shards[s].capacity = capacity / this->_num_shards + (s < capacity % this->_num_shards ? 1 : 0);
+            }
+            this->_hits = 0;
+            this->_misses = 0;
+        }
+
+        bool
+        enabled() const {
+            return this->_num_shards > 0;
+        }
+
+        /**
+         * @return The plan stored with key, marked as the most recently used, or nullptr, counted as a miss
+         */
+        plan_ptr
+        find(const std::string & key) {
+            shard & s = this->get_shard(key);
+            {
+                boost::lock_guard<boost::mutex> lock(s.mutex);
+                const auto it = s.entries.find(key);
+                if (it != s.entries.end()) {
+                    s.lru.splice(s.lru.begin(), s.lru, it->second);
+                    ++this->_hits;
+                    return it->second->second;
+                }
+            }
+            ++this->_misses;
+            return nullptr;
+        }
+
+        /**
+         * Stores plan with key, evicting the least recently used plan of its shard when it is full.
+         * A plan already stored by a concurrent miss on the same key is replaced.
+         */
+        void
+        insert(const std::string & key, plan_ptr plan) {
+            shard & s = this->get_shard(key);
+            boost::lock_guard<boost::mutex> lock(s.mutex);
+            const auto it = s.entries.find(key);
+            if (it != s.entries.end()) {
+                it->second->second = std::move(plan);
+                s.lru.splice(s.lru.begin(), s.lru, it->second);
+                return;
+            }
+            if (s.entries.size() >= s.capacity) {
+                s.entries.erase(s.lru.back().first);
+                s.lru.pop_back();
+            }
+            s.lru.emplace_front(key, std::move(plan));
+            s.entries.emplace(s.lru.front().first, s.lru.begin());
+        }
+
+        std::size_t
+        capacity() const {
+            return this->_capacity;
+        }
+
+        /**
+         * @return The number of plans stored
+         */
+        std::size_t
+        size() const {
+            std::size_t result = 0;
+            for (std::size_t s = 0; s < this->_num_shards; ++s) {
+                boost::lock_guard<boost::mutex> lock(this->_shards[s].mutex);
+                result += this->_shards[s].entries.size();
+            }
+            return result;
+        }
+
+        uint64_t
+        hits() const {
+            return this->_hits.load();
+        }
+
+        uint64_t
+        misses() const {
+            return this->_misses.load();
+        }
+
+    private:
+        typedef std::list<std::pair<std::string, plan_ptr>> lru_list;
+
+        struct shard {
+            mutable boost::mutex mutex;
+            std::size_t capacity;
+            lru_list lru; // the most recently used first
+            std::unordered_map<std::string, lru_list::iterator> entries;
+        };
+
+        static const std::size_t max_shards = 16;
+
+        shard &
+        get_shard(const std::string & key) {
+            return this->_shards[cache_shard(key, this->_num_shards)];
+        }
+
+    private:
+        std::size_t _capacity;
+        std::size_t _num_shards;
+        std::unique_ptr<shard[]> _shards;
+        std::atomic<uint64_t> _hits;
+        std::atomic<uint64_t> _misses;
+    };
+}
+
+#endif //INDEX_PARTITIONING_PLAN_CACHE_HPP
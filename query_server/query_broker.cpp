@@ -0,0 +1,485 @@
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/stream.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/thread/thread.hpp>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "async_server.hpp"
+#include "backend_pool.hpp"
+#include "binary_protocol.hpp"
+#include "json_protocol.hpp"
+#include "query_request.hpp"
+#include "query_server_options.hpp"
+#include "reply_merge.hpp"
+#include "thread_pool.hpp"
+
+
+namespace pt = boost::property_tree;
+
+
+/**
+ * Optional settings of the broker, given on the command line after the positional arguments
+ */
+struct broker_options {
+    unsigned int num_threads; // workers evaluating the requests of all the client connections
+    unsigned int num_reactors; // network threads reading the requests of the clients
+    unsigned int max_frame_mb; // maximum size of a request, the connections sending a larger one are closed
+    unsigned int fan_out_threads; // workers waiting for the backends, 0 means two per shard and client worker
+    unsigned int timeout_ms; // time given to the backends to answer, 0 means no deadline
+    unsigned int hedge_ms; // time after which a slow backend is hedged, 0 disables the hedging
+
+    broker_options()
+            : num_threads(boost::thread::hardware_concurrency()),
+              num_reactors(1),
+              max_frame_mb(16),
+              fan_out_threads(0),
+              timeout_ms(1000),
+              hedge_ms(0) {
+        if (this->num_threads == 0) {
+            this->num_threads = 1;
+        }
+    }
+};
+
+
+const char *
+broker_options_usage() {
+    return
+            "  --threads N   number of workers forwarding the requests of all the client connections, one request\n"
+            "                at a time (default: number of cores)\n"
+            "  --reactors N  number of network threads reading the requests of the clients without blocking, an\n"
+            "                idle connection does not hold any worker (default: 1)\n"
+            "  --max-frame-mb N\n"
+            "                maximum size of a request, the connections sending a larger one are closed (default: 16)\n"
+            "  --fan-out-threads N\n"
+            "                number of workers waiting for the replies of the backends\n"
+            "                (default: 0, two for each shard and client worker)\n"
+            "  --timeout-ms N\n"
+            "                time given to the backends to answer, the shards missing it are left out of the reply,\n"
+            "                which is marked as partial (default: 1000, 0 waits for all of them)\n"
+            "  --hedge-ms N  the shards that have not answered after N ms receive the request again, on their next\n"
+            "                replica or on a new connection, and the first reply wins (default: 0, no hedging)\n";
+}
+
+
+broker_options
+parse_broker_options(
+        int argc,
+        char * argv[],
+        int first
+) {
+    broker_options options;
+
+    for (int i = first; i < argc; ++i) {
+        const std::string name = argv[i];
+        if (i + 1 >= argc) {
+            throw std::runtime_error("Missing value for option " + name);
+        }
+        const char * value = argv[++i];
+
+        if (name == "--threads") {
+            options.num_threads = static_cast<unsigned int>(query_server::parse_unsigned_option(name, value));
+        } else if (name == "--reactors") {
+            options.num_reactors = static_cast<unsigned int>(query_server::parse_unsigned_option(name, value));
+        } else if (name == "--max-frame-mb") {
+            options.max_frame_mb = static_cast<unsigned int>(query_server::parse_unsigned_option(name, value));
+        } else if (name == "--fan-out-threads") {
+            options.fan_out_threads = static_cast<unsigned int>(query_server::parse_unsigned_option(name, value));
+        } else if (name == "--timeout-ms") {
+            options.timeout_ms = static_cast<unsigned int>(query_server::parse_unsigned_option(name, value));
+        } else if (name == "--hedge-ms") {
+            options.hedge_ms = static_cast<unsigned int>(query_server::parse_unsigned_option(name, value));
+        } else {
+            throw std::runtime_error("Unknown option " + name);
+        }
+    }
+
+    if (options.num_threads == 0) {
+        throw std::runtime_error("The number of threads must be greater than zero");
+    }
+    if (options.num_reactors == 0) {
+        throw std::runtime_error("The number of reactors must be greater than zero");
+    }
+    if (options.max_frame_mb == 0 || options.max_frame_mb >= 4096) {
+        throw std::runtime_error("The maximum frame size must be between 1 and 4095 MB");
+    }
+
+    return options;
+}
+
+
+/**
+ * Parses the list of backends: the shards are separated by commas, the replicas of a shard by '+',
+ * e.g., 10.0.0.1:9000+10.0.0.2:9000,10.0.0.3:9000
+ */
+std::vector<std::vector<std::string>>
+parse_backends(
+        const std::string & backends
+) {
+    std::vector<std::vector<std::string>> shards;
+    for (const std::string & shard: query_server::split_list(backends, ',')) {
+        shards.push_back(query_server::split_list(shard, '+'));
+    }
+    return shards;
+}
+
+
+/**
+ * Merges the replies of the shards, given in the order of the shards
+ * @param shard_replies The replies of the shards, nullptr for the missing ones
+ * @throws std::runtime_error If a rel docid is not contained in any of the shards
+ */
+void merge_replies(
+        const query_server::query_request & request,
+        const std::vector<const query_server::query_reply *> & shard_replies,
+        const std::vector<bool> & hedged,
+        query_server::query_reply & reply
+) {
+    query_server::merge_shard_replies(request, shard_replies, reply);
+    for (std::size_t s = 0; s < reply.shards.size(); ++s) {
+        reply.shards[s].hedged = hedged[s];
+    }
+
+    // every shard skips the rel docids it does not contain, the ones contained by none of them are checked here
+    if (request.has_rel && !request.skip_unknown_rel && !reply.partial) {
+        const std::unordered_set<uint64_t> rel_set(request.rel.begin(), request.rel.end());
+        if (reply.num_rel < rel_set.size()) {
+            throw std::runtime_error("Unable to find one of the docids");
+        }
+    }
+}
+
+
+/**
+ * Merges the json replies of the shards to one query request
+ * @param shard_replies The replies of the shards, nullptr for the missing ones
+ * @throws std::runtime_error If no shard answered, with the error of the first shard that failed, if any
+ */
+void merge_json_replies(
+        const pt::ptree & request,
+        const std::vector<const pt::ptree *> & shard_replies,
+        const std::vector<bool> & hedged,
+        pt::ptree & reply
+) {
+    query_server::query_request parsed_request;
+    query_server::json_protocol::decode_request(request, parsed_request);
+
+    // the shards answering with an error are missing from the result
+    std::vector<query_server::query_reply> decoded(shard_replies.size());
+    std::vector<const query_server::query_reply *> answered(shard_replies.size(), nullptr);
+    std::string first_error;
+    bool any_answered = false;
+    for (std::size_t s = 0; s < shard_replies.size(); ++s) {
+        if (shard_replies[s] == nullptr) {
+            continue;
+        }
+        std::string error;
+        if (query_server::json_protocol::decode_reply(*shard_replies[s], decoded[s], error)) {
+            answered[s] = &decoded[s];
+            any_answered = true;
+        } else if (first_error.empty()) {
+            first_error = error;
+        }
+    }
+    if (!any_answered) {
+        throw std::runtime_error(first_error.empty() ? "No backend answered in time" : first_error);
+    }
+
+    query_server::query_reply merged;
+    merge_replies(parsed_request, answered, hedged, merged);
+    query_server::json_protocol::encode_reply(merged, reply);
+}
+
+
+/**
+ * Reads the json replies of the shards
+ * @return The replies, nullptr for the shards that did not answer or answered with a malformed message
+ */
+std::vector<const pt::ptree *> read_json_replies(
+        const query_server::fan_out_result & result,
+        std::vector<pt::ptree> & replies
+) {
+    std::vector<const pt::ptree *> reply_ptrs(result.replies.size(), nullptr);
+    replies.resize(result.replies.size());
+    for (std::size_t s = 0; s < result.replies.size(); ++s) {
+        if (!result.answered[s]) {
+            continue;
+        }
+        try {
+            boost::iostreams::stream<boost::iostreams::array_source> reply_stream(result.replies[s].data(), result.replies[s].size());
+            pt::read_json(reply_stream, replies[s]);
+            reply_ptrs[s] = &replies[s];
+        } catch (const std::exception &e) {
+            std::cerr << "Malformed reply from shard " << s << ": " << e.what() << std::endl;
+        }
+    }
+    return reply_ptrs;
+}
+
+
+/**
+ * Forwards a json request, a batch of them or an administrative request to all the shards and merges their replies.
+ * The rel docids are split among the shards, thus every shard is asked to skip the ones it does not contain.
+ */
+void handle_json_message(
+        const char * data,
+        std::size_t size,
+        pt::ptree & reply,
+        std::vector<pt::ptree> & batch_replies,
+        bool & batch,
+        query_server::FanOut & fan_out
+) {
+    pt::ptree request;
+    boost::iostreams::stream<boost::iostreams::array_source> message_stream(data, size);
+    pt::read_json(message_stream, request);
+
+    // the request of the client keeps its skip_unknown_rel, used to check the merged replies
+    batch = query_server::json_protocol::is_batch_request(request);
+    const bool admin = !batch && request.get_optional<std::string>("admin");
+    pt::ptree forwarded = request;
+    if (batch) {
+        for (pt::ptree::value_type &child: forwarded) {
+            if (child.second.get_child_optional("rel")) {
+                child.second.put<std::string>("skip_unknown_rel", "true");
+            }
+        }
+    } else if (forwarded.get_child_optional("rel")) {
+        forwarded.put<std::string>("skip_unknown_rel", "true");
+    }
+
+    std::string message;
+    {
+        boost::iostreams::stream<boost::iostreams::back_insert_device<std::string>> ss(message);
+        pt::write_json(ss, forwarded, false);
+    }
+    query_server::fan_out_result result;
+    fan_out.send(message, result);
+    std::vector<pt::ptree> shard_replies;
+    std::vector<const pt::ptree *> shard_reply_ptrs = read_json_replies(result, shard_replies);
+
+    if (admin) {
+        // the administrative replies are not merged, they are listed in the order of the shards
+        pt::ptree backends;
+        for (std::size_t s = 0; s < shard_reply_ptrs.size(); ++s) {
+            pt::ptree backend_reply;
+            if (shard_reply_ptrs[s] != nullptr) {
+                backend_reply = *shard_reply_ptrs[s];
+            } else {
+                backend_reply.put<std::string>("error", "No reply in time");
+            }
+            backends.push_back(std::make_pair("", backend_reply));
+        }
+        reply.add_child("backends", backends);
+        return;
+    }
+
+    if (!batch) {
+        boost::optional<std::string> id_opt = request.get_optional<std::string>("id");
+        try {
+            merge_json_replies(request, shard_reply_ptrs, result.hedged, reply);
+        } catch (std::exception &e) {
+            reply.clear();
+            reply.put<std::string>("error", e.what());
+        }
+        if (id_opt) {
+            reply.put<std::string>("id", id_opt.get());
+        }
+        return;
+    }
+
+    // a backend answers a batch with an array of replies, in the order of the requests
+    std::vector<std::vector<const pt::ptree *>> shard_batch_replies(shard_reply_ptrs.size());
+    for (std::size_t s = 0; s < shard_reply_ptrs.size(); ++s) {
+        if (shard_reply_ptrs[s] != nullptr && shard_reply_ptrs[s]->size() == request.size()) {
+            for (const pt::ptree::value_type &child: *shard_reply_ptrs[s]) {
+                shard_batch_replies[s].push_back(&child.second);
+            }
+        }
+    }
+    batch_replies.resize(request.size());
+    std::size_t i = 0;
+    for (const pt::ptree::value_type &child: request) {
+        std::vector<const pt::ptree *> element_replies(shard_reply_ptrs.size(), nullptr);
+        for (std::size_t s = 0; s < shard_reply_ptrs.size(); ++s) {
+            if (!shard_batch_replies[s].empty()) {
+                element_replies[s] = shard_batch_replies[s][i];
+            }
+        }
+        boost::optional<std::string> id_opt = child.second.get_optional<std::string>("id");
+        try {
+            merge_json_replies(child.second, element_replies, result.hedged, batch_replies[i]);
+        } catch (std::exception &e) {
+            batch_replies[i].clear();
+            batch_replies[i].put<std::string>("error", e.what());
+        }
+        if (id_opt) {
+            batch_replies[i].put<std::string>("id", id_opt.get());
+        }
+        ++i;
+    }
+}
+
+
+/**
+ * Forwards a binary request to all the shards and merges their replies into a binary reply
+ */
+void handle_binary_message(
+        const char * data,
+        std::size_t size,
+        std::string & reply_message,
+        query_server::FanOut & fan_out
+) {
+    namespace bp = query_server::binary_protocol;
+    query_server::query_request request;
+    uint64_t id = 0;
+    bool has_id = false;
+
+    if (static_cast<uint8_t>(data[3]) != bp::version) {
+        bp::encode_reply(query_server::query_reply(), nullptr, bp::STATUS_UNSUPPORTED_VERSION, "Unsupported version of the binary protocol", reply_message);
+        return;
+    }
+
+    try {
+        has_id = bp::decode_request(data, size, request, id);
+
+        std::string message(data, size);
+        if (request.has_rel) {
+            message[5] = static_cast<char>(static_cast<uint8_t>(message[5]) | bp::REQUEST_SKIP_UNKNOWN_REL);
+        }
+        query_server::fan_out_result result;
+        fan_out.send(message, result);
+
+        // the shards answering with an error are missing from the result
+        const std::size_t num_shards = result.replies.size();
+        std::vector<query_server::query_reply> decoded(num_shards);
+        std::vector<const query_server::query_reply *> answered(num_shards, nullptr);
+        bp::BinaryReplyStatus first_status = bp::STATUS_OK;
+        std::string first_error;
+        bool any_answered = false;
+        for (std::size_t s = 0; s < num_shards; ++s) {
+            if (!result.answered[s]) {
+                continue;
+            }
+            uint64_t shard_id;
+            std::string error;
+            try {
+                bp::BinaryReplyStatus status = bp::decode_reply(result.replies[s].data(), result.replies[s].size(), decoded[s], shard_id, error);
+                if (status == bp::STATUS_OK) {
+                    answered[s] = &decoded[s];
+                    any_answered = true;
+                } else if (first_status == bp::STATUS_OK) {
+                    first_status = status;
+                    first_error = error;
+                }
+            } catch (const std::exception &e) {
+                std::cerr << "Malformed reply from shard " << s << ": " << e.what() << std::endl;
+            }
+        }
+
+        query_server::query_reply merged;
+        if (any_answered) {
+            merge_replies(request, answered, result.hedged, merged);
+            bp::encode_reply(merged, has_id ? &id : nullptr, bp::STATUS_OK, nullptr, reply_message);
+        } else if (first_status != bp::STATUS_OK) {
+            bp::encode_reply(merged, has_id ? &id : nullptr, first_status, first_error.c_str(), reply_message);
+        } else {
+            bp::encode_reply(merged, has_id ? &id : nullptr, bp::STATUS_ERROR, "No backend answered in time", reply_message);
+        }
+    } catch (std::exception &e) {
+        bp::encode_reply(query_server::query_reply(), has_id ? &id : nullptr, bp::STATUS_ERROR, e.what(), reply_message);
+    }
+}
+
+
+/**
+ * Answers the message of a client, writing the reply in reply_message
+ */
+void process_message(
+        const char * data,
+        std::size_t size,
+        std::string & reply_message,
+        query_server::FanOut & fan_out
+) {
+    if (query_server::binary_protocol::is_binary_message(data, size)) {
+        handle_binary_message(data, size, reply_message, fan_out);
+        return;
+    }
+
+    pt::ptree reply;
+    std::vector<pt::ptree> batch_replies;
+    bool batch = false;
+    try {
+        handle_json_message(data, size, reply, batch_replies, batch, fan_out);
+    } catch (std::exception &e) {
+        batch = false;
+        reply.clear();
+        reply.put<std::string>("error", e.what());
+    }
+
+    // transform the json tree into a string, reusing the memory of reply_message
+    reply_message.clear();
+    boost::iostreams::stream<boost::iostreams::back_insert_device<std::string>> ss(reply_message);
+    if (batch) {
+        // write_json cannot write an array as root
+        ss << '[';
+        for (std::size_t i = 0; i < batch_replies.size(); ++i) {
+            if (i > 0) {
+                ss << ',';
+            }
+            pt::write_json(ss, batch_replies[i], false);
+        }
+        ss << ']';
+    } else {
+        pt::write_json(ss, reply, false);
+    }
+    ss.flush();
+}
+
+
+int main(
+        int argc,
+        char *argv[]
+) {
+    try {
+        if (argc <= 3) {
+            std::cerr << "Usage: " << argv[0] << " ip port backends [options]\n";
+            std::cerr << "Forwards every request to the query servers serving the shards of the index and merges their\n"
+                      << "replies. The shards are separated by commas, the replicas of a shard by '+', e.g.,\n"
+                      << "10.0.0.1:9000+10.0.0.2:9000,10.0.0.3:9000\n";
+            std::cerr << "Options:\n" << broker_options_usage();
+            return -1;
+        }
+
+        const char *ip = argv[1];
+        unsigned short port = static_cast<unsigned short>(std::atoi(argv[2]));
+        const std::vector<std::vector<std::string>> shards = parse_backends(argv[3]);
+        broker_options options = parse_broker_options(argc, argv, 4);
+        if (options.fan_out_threads == 0) {
+            options.fan_out_threads = 2 * options.num_threads * static_cast<unsigned int>(shards.size());
+        }
+
+        query_server::AsyncServer server(ip, port, options.num_reactors, options.max_frame_mb << 20);
+        query_server::FanOut fan_out(shards, options.fan_out_threads, options.timeout_ms, options.hedge_ms);
+
+        // the reactors read the requests, the workers forward them one at a time, thus an idle connection does not
+        // hold any worker
+        query_server::ThreadPool pool(options.num_threads);
+        std::cerr << "Accepting connections (" << server.num_reactors() << " reactors, " << pool.size() << " workers, "
+                  << fan_out.num_shards() << " shards)" << std::endl;
+        server.run(&pool, nullptr, [&fan_out](const std::string & request, std::string & reply, query_server::admission_ticket &) {
+            process_message(request.data(), request.size(), reply, fan_out);
+            // the replies are sent in the order of the requests
+            return false;
+        });
+    } catch (std::exception &e) {
+        std::cerr << "Exception: " << e.what() << "\n";
+    }
+
+    return 0;
+}
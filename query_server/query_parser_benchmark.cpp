@@ -0,0 +1,187 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "query/query_static_parser.hpp"
+
+
+/**
+ * The heap allocations of the process, counted by the replaced global operator new
+ */
+static std::atomic<uint64_t> num_allocations(0);
+static std::atomic<uint64_t> allocated_bytes(0);
+
+void *
+operator new(std::size_t size) {
+    num_allocations.fetch_add(1, std::memory_order_relaxed);
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void * ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void *
+operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+// not inlined, otherwise GCC sees free() called on the result of operator new and warns about it
+__attribute__((noinline)) void
+operator delete(void * ptr) noexcept {
+    std::free(ptr);
+}
+
+__attribute__((noinline)) void
+operator delete[](void * ptr) noexcept {
+    std::free(ptr);
+}
+
+__attribute__((noinline)) void
+operator delete(void * ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+__attribute__((noinline)) void
+operator delete[](void * ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+
+/**
+ * Parses every query repetitions times with parse_query and prints the allocations and the time per query
+ * @return The number of terms parsed, so that the parsing is not optimized away
+ */
+template <typename ParseQuery>
+std::size_t
+run_mode(
+        const char * mode,
+        const std::vector<std::string> & queries,
+        std::size_t repetitions,
+        ParseQuery parse_query
+) {
+    std::size_t num_terms = 0;
+    const uint64_t allocations_before = num_allocations.load();
+    const uint64_t bytes_before = allocated_bytes.load();
+    const auto tick = std::chrono::steady_clock::now();
+    for (std::size_t r = 0; r < repetitions; ++r) {
+        for (const std::string & query: queries) {
+            num_terms += parse_query(query);
+        }
+    }
+    const auto tock = std::chrono::steady_clock::now();
+    const double num_queries = static_cast<double>(queries.size() * repetitions);
+
+    std::cout << std::setw(8) << mode
+              << std::setw(16) << std::fixed << std::setprecision(2) << (num_allocations.load() - allocations_before) / num_queries
+              << std::setw(16) << (allocated_bytes.load() - bytes_before) / num_queries
+              << std::setw(14) << std::chrono::duration<double, std::micro>(tock - tick).count() / num_queries
+              << std::endl;
+    return num_terms;
+}
+
+
+/**
+ * Counts the terms of a scanned query, see query::QueryStaticParser::scan
+ */
+struct term_counter {
+    std::size_t num_terms;
+
+    void term(const query::QueryLexeme &) {
+        ++this->num_terms;
+    }
+
+    void end_group() {}
+};
+
+
+/**
+ * Compares the allocations of the parser copying the lexemes into std::string with the ones of the parser referencing
+ * the query string, whose arena is reused by all the queries as a request would do, and of the scan building no
+ * expression, which the server translates on the fly
+ */
+template <typename StringExpr, typename ViewExpr>
+std::size_t
+run_benchmark(
+        const std::vector<std::string> & queries,
+        std::size_t repetitions
+) {
+    std::cout << std::setw(8) << "parser"
+              << std::setw(16) << "allocs/query"
+              << std::setw(16) << "bytes/query"
+              << std::setw(14) << "us/query"
+              << std::endl;
+
+    std::size_t num_terms = run_mode("string", queries, repetitions, [](const std::string & query) {
+        return query::QueryStaticParser::parse<StringExpr>(query).getTermsNumber();
+    });
+    query::QueryArena arena;
+    num_terms += run_mode("view", queries, repetitions, [&arena](const std::string & query) {
+        arena.clear();
+        return query::QueryStaticParser::parse<ViewExpr>(query, arena).getTermsNumber();
+    });
+    num_terms += run_mode("scan", queries, repetitions, [&arena](const std::string & query) {
+        arena.clear();
+        term_counter counter {0};
+        query::QueryStaticParser::scan<ViewExpr>(query.c_str(), arena, counter);
+        return counter.num_terms;
+    });
+    return num_terms;
+}
+
+
+int main(
+        int argc,
+        char *argv[]
+) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " queries_file [query_type] [repetitions]\n"
+                  << "  queries_file contains one query string per line, query_type is and, or or cnf (default: cnf)\n"
+                  << "  and every query is parsed repetitions times (default: 1000).\n";
+        return -1;
+    }
+
+    const std::string query_type = argc > 2 ? argv[2] : "cnf";
+    const std::size_t repetitions = argc > 3 ? static_cast<std::size_t>(std::atol(argv[3])) : 1000;
+
+    std::vector<std::string> queries;
+    {
+        std::ifstream file(argv[1]);
+        for (std::string line; std::getline(file, line);) {
+            if (line.size() > 0) {
+                queries.push_back(line);
+            }
+        }
+    }
+    if (queries.empty() || repetitions == 0) {
+        std::cerr << "No queries found in " << argv[1] << std::endl;
+        return -1;
+    }
+
+    try {
+        std::size_t num_terms;
+        if (query_type == "and") {
+            num_terms = run_benchmark<query::QueryExprAND<query::QueryExprTerm>, query::QueryExprAND<query::QueryExprTermView>>(queries, repetitions);
+        } else if (query_type == "or") {
+            num_terms = run_benchmark<query::QueryExprOR<query::QueryExprTerm>, query::QueryExprOR<query::QueryExprTermView>>(queries, repetitions);
+        } else if (query_type == "cnf") {
+            num_terms = run_benchmark<query::QueryExprAND<query::QueryExprOR<query::QueryExprTerm>>,
+                    query::QueryExprAND<query::QueryExprOR<query::QueryExprTermView>>>(queries, repetitions);
+        } else {
+            std::cerr << "Unrecognized query_type " << query_type << std::endl;
+            return -1;
+        }
+        std::cout << "terms parsed: " << num_terms << std::endl;
+    } catch (const std::exception &e) {
+        std::cerr << "Exception: " << e.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,182 @@
+#ifndef INDEX_PARTITIONING_QUERY_REQUEST_HPP
+#define INDEX_PARTITIONING_QUERY_REQUEST_HPP
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "ds2i/queries.hpp"
+
+
+namespace query_server {
+    using term_id_type = ds2i::term_id_type;
+    using term_id_vec = ds2i::term_id_vec;
+
+    /**
+     * Query operators supported by the server
+     */
+    enum QueryType : uint8_t {
+        QUERY_TYPE_CNF = 0,
+        QUERY_TYPE_CNF_OPT = 1,
+        QUERY_TYPE_AND = 2,
+        QUERY_TYPE_OR = 3,
+        QUERY_TYPE_MAXSCORE = 4,
+        QUERY_TYPE_BOOLEAN = 5 // nested AND, OR and NOT, given only as a query string
+    };
+
+    /**
+     * @return The query type having the given name
+     * @throws std::runtime_error If the name is not recognized
+     */
+    QueryType
+    query_type_from_string(
+            const std::string & name
+    ) {
+        if (name == "cnf") {
+            return QUERY_TYPE_CNF;
+        } else if (name == "cnf opt") {
+            return QUERY_TYPE_CNF_OPT;
+        } else if (name == "and") {
+            return QUERY_TYPE_AND;
+        } else if (name == "or") {
+            return QUERY_TYPE_OR;
+        } else if (name == "maxscore") {
+            return QUERY_TYPE_MAXSCORE;
+        } else if (name == "boolean") {
+            return QUERY_TYPE_BOOLEAN;
+        }
+        throw std::runtime_error("Unrecognized query_type");
+    }
+
+    /**
+     * @return True if the query is a flat list of terms, false if it is a conjunction of OR groups or a boolean query
+     */
+    bool
+    is_flat_query_type(
+            QueryType query_type
+    ) {
+        return query_type == QUERY_TYPE_AND || query_type == QUERY_TYPE_OR || query_type == QUERY_TYPE_MAXSCORE;
+    }
+
+    /**
+     * A request decoded from one of the wire formats.
+     * The terms are given in one of three forms: the query string, the lexemes or the term ids.
+     * Lexemes and term ids are organized in groups: the OR groups of a cnf query, or a single group for flat queries.
+     */
+    struct query_request {
+        enum TermsFormat : uint8_t {
+            TERMS_QUERY_STRING,
+            TERMS_LEXEMES,
+            TERMS_TERM_IDS
+        };
+
+        QueryType query_type;
+        bool query_normalization;
+        unsigned int ranked_at; // 0 when the documents are not ranked
+        bool has_rel;
+        std::vector<uint64_t> rel; // original docids
+        bool skip_unknown_rel; // the rel docids not in the index are ignored, e.g., when it is one of several shards
+        bool has_timeout; // when false the default timeout of the server is used
+        unsigned int timeout_ms; // 0 means no deadline
+
+        TermsFormat terms_format;
+        std::string query;
+        std::vector<std::vector<std::string>> lexemes;
+        std::vector<term_id_vec> term_ids;
+
+        query_request()
+                : query_type(QUERY_TYPE_CNF),
+                  query_normalization(true),
+                  ranked_at(0),
+                  has_rel(false),
+                  skip_unknown_rel(false),
+                  has_timeout(false),
+                  timeout_ms(0),
+                  terms_format(TERMS_QUERY_STRING) {}
+    };
+
+    /**
+     * A ranked document, identified by its original docid
+     */
+    struct result_document {
+        uint64_t docid;
+        float score;
+    };
+
+    /**
+     * The outcome of a request on one of the index shards
+     */
+    struct shard_stats {
+        double exe_time; // milliseconds
+        uint64_t num_ret;
+        bool missing; // the shard did not answer in time, it is not part of the result
+        bool hedged; // the request has been sent again to the shard, or to one of its replicas
+    };
+
+    /**
+     * The outcome of a request, independent from the wire format
+     */
+    struct query_reply {
+        uint64_t num_ret;
+        uint64_t num_rel_ret;
+        uint64_t num_rel;
+        double exe_time; // milliseconds
+        bool has_rel;
+        bool has_deadline;
+        bool timed_out; // the evaluation has been stopped by the deadline, the result is partial
+
+        // ranked queries only: the top-k list and the number of matching documents
+        bool has_results;
+        uint64_t num_hits;
+        bool num_hits_exact; // false when num_hits is a lower bound (maxscore skips documents)
+        std::vector<result_document> results; // sorted by decreasing score
+
+        // sharded indexes only: the outcome on each shard, in the order of the shards
+        std::vector<shard_stats> shards;
+        bool partial; // some shards are missing, the result covers only the other ones
+        bool cached; // the results come from the result cache, they have not been evaluated again
+
+        // the segments of the query not in the lexicon, in the order of the query: the missing ones have been left
+        // out of the index and are dropped from the query, the unknown ones are certainly not in the collection
+        std::vector<std::string> missing_segments;
+        std::vector<std::string> unknown_segments;
+
+        // out-of-core serving only: the prefetch of the cold posting lists and the faults of the evaluation
+        bool has_prefetch;
+        uint64_t prefetched_lists;
+        uint64_t prefetch_faults; // major page faults taken by the prefetch helpers
+        double prefetch_wait; // milliseconds
+        uint64_t major_faults; // major page faults taken by the evaluation
+
+        // admission control statistics, reported only when it is enabled
+        bool has_admission;
+        uint64_t queue_depth;
+        double queue_wait; // milliseconds
+        uint64_t shed_count;
+
+        query_reply()
+                : num_ret(0),
+                  num_rel_ret(0),
+                  num_rel(0),
+                  exe_time(0),
+                  has_rel(false),
+                  has_deadline(false),
+                  timed_out(false),
+                  has_results(false),
+                  num_hits(0),
+                  num_hits_exact(false),
+                  partial(false),
+                  cached(false),
+                  has_prefetch(false),
+                  prefetched_lists(0),
+                  prefetch_faults(0),
+                  prefetch_wait(0),
+                  major_faults(0),
+                  has_admission(false),
+                  queue_depth(0),
+                  queue_wait(0),
+                  shed_count(0) {}
+    };
+}
+
+#endif //INDEX_PARTITIONING_QUERY_REQUEST_HPP
@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <boost/thread/thread.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "socket.hpp"
+
+
+/**
+ * Sends num_requests requests on one connection, one at a time, recording the latency of each of them
+ */
+void
+client_loop(
+        const char * ip,
+        unsigned short port,
+        const std::vector<std::string> * requests,
+        std::size_t first_request,
+        std::size_t num_requests,
+        std::vector<double> * latencies,
+        std::size_t * num_errors
+) {
+    try {
+        boost::asio::io_service io_service;
+        query_server::SocketClient client(&io_service, ip, port);
+        std::stringstream ss;
+
+        for (std::size_t i = 0; i < num_requests; ++i) {
+            const std::string & request = (*requests)[(first_request + i) % requests->size()];
+
+            auto tick = std::chrono::steady_clock::now();
+            client.send_message(request);
+            ss.str("");
+            client.receive_message(ss);
+            auto tock = std::chrono::steady_clock::now();
+
+            latencies->push_back(std::chrono::duration<double, std::milli>(tock - tick).count());
+            if (ss.str().find("\"error\"") != std::string::npos) {
+                ++(*num_errors);
+            }
+        }
+
+        client.shutdown();
+        client.close();
+    } catch (const std::exception &e) {
+        std::cerr << "Exception in client: " << e.what() << std::endl;
+        ++(*num_errors);
+    }
+}
+
+
+/**
+ * Runs num_clients concurrent clients and prints throughput and latency percentiles
+ */
+void
+run_step(
+        const char * ip,
+        unsigned short port,
+        const std::vector<std::string> & requests,
+        std::size_t num_clients,
+        std::size_t requests_per_client
+) {
+    std::vector<std::vector<double>> latencies(num_clients);
+    std::vector<std::size_t> num_errors(num_clients, 0);
+
+    auto tick = std::chrono::steady_clock::now();
+    {
+        boost::thread_group clients;
+        for (std::size_t c = 0; c < num_clients; ++c) {
+            latencies[c].reserve(requests_per_client);
+            clients.create_thread(boost::bind(
+                    client_loop, ip, port, &requests, c * requests_per_client, requests_per_client,
+                    &latencies[c], &num_errors[c]
+            ));
+        }
+        clients.join_all();
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - tick).count();
+
+    // merge the latencies of all the clients
+    std::vector<double> all_latencies;
+    std::size_t errors = 0;
+    for (std::size_t c = 0; c < num_clients; ++c) {
+        all_latencies.insert(all_latencies.end(), latencies[c].begin(), latencies[c].end());
+        errors += num_errors[c];
+    }
+    std::sort(all_latencies.begin(), all_latencies.end());
+
+    auto percentile = [&all_latencies](double p) -> double {
+        if (all_latencies.empty()) {
+            return 0;
+        }
+        std::size_t pos = static_cast<std::size_t>(p * (all_latencies.size() - 1));
+        return all_latencies[pos];
+    };
+
+    std::cout << std::setw(8) << num_clients
+              << std::setw(14) << std::fixed << std::setprecision(1) << all_latencies.size() / elapsed
+              << std::setw(12) << std::setprecision(3) << percentile(0.50)
+              << std::setw(12) << percentile(0.99)
+              << std::setw(10) << errors
+              << std::endl;
+}
+
+
+int main(
+        int argc,
+        char *argv[]
+) {
+    if (argc < 5) {
+        std::cerr << "Usage: " << argv[0] << " ip port requests_file max_clients [requests_per_client]\n"
+                  << "  requests_file contains one json request per line. The number of concurrent clients is doubled\n"
+                  << "  at each step, from 1 up to max_clients, every client keeping its connection open. Run it\n"
+                  << "  against a server started with --threads 0 and with the default pool, whose workers evaluate\n"
+                  << "  the requests of all the connections, with max_clients above the number of workers to compare\n"
+                  << "  the two models.\n";
+        return -1;
+    }
+
+    const char * ip = argv[1];
+    unsigned short port = static_cast<unsigned short>(std::atoi(argv[2]));
+    std::size_t max_clients = static_cast<std::size_t>(std::atol(argv[4]));
+    std::size_t requests_per_client = argc > 5 ? static_cast<std::size_t>(std::atol(argv[5])) : 1000;
+
+    std::vector<std::string> requests;
+    {
+        std::ifstream file(argv[3]);
+        for (std::string line; std::getline(file, line);) {
+            if (line.size() > 0) {
+                requests.push_back(line);
+            }
+        }
+    }
+    if (requests.empty()) {
+        std::cerr << "No requests found in " << argv[3] << std::endl;
+        return -1;
+    }
+
+    std::cout << std::setw(8) << "clients"
+              << std::setw(14) << "req/s"
+              << std::setw(12) << "p50 (ms)"
+              << std::setw(12) << "p99 (ms)"
+              << std::setw(10) << "errors"
+              << std::endl;
+    for (std::size_t num_clients = 1; num_clients <= max_clients; num_clients *= 2) {
+        run_step(ip, port, requests, num_clients, requests_per_client);
+    }
+
+    return 0;
+}
@@ -0,0 +1,323 @@
+#ifndef INDEX_PARTITIONING_QUERY_SERVER_OPTIONS_HPP
+#define INDEX_PARTITIONING_QUERY_SERVER_OPTIONS_HPP
+
+#include <boost/thread/thread.hpp>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "memory_placement.hpp"
+
+
+namespace query_server {
+    /**
+     * Optional settings of the query server, given on the command line after the positional arguments
+     */
+    struct server_options {
+        /**
+         * Number of workers evaluating the requests of all the connections, 0 means one thread per connection
+         */
+        unsigned int num_threads;
+
+        /**
+         * Number of network reactors reading the requests handed to the workers
+         */
+        unsigned int num_reactors;
+
+        /**
+         * Maximum size, in MB, of a request, the connections sending a larger one are closed, in both the front-ends
+         */
+        unsigned int max_frame_mb;
+
+        /**
+         * Number of threads evaluating the queries of a batch request
+         */
+        unsigned int batch_threads;
+
+        /**
+         * Number of threads evaluating a query on the shards of a sharded index
+         */
+        unsigned int shard_threads;
+
+        /**
+         * Number of threads loading the stages of the index and warming up its files
+         */
+        unsigned int load_threads;
+
+        /**
+         * Maximum number of requests evaluated at the same time, 0 disables the admission control
+         */
+        unsigned int max_in_flight;
+
+        /**
+         * Maximum number of requests waiting for an evaluation slot, the exceeding ones are shed
+         */
+        unsigned int max_queue;
+
+        /**
+         * Deadline of the requests without timeout_ms, 0 means no deadline
+         */
+        unsigned int timeout_ms;
+
+        /**
+         * Pages backing the index, the wand data and the lexicon
+         */
+        HugePagesMode huge_pages;
+
+        /**
+         * Number of NUMA nodes holding a copy of the index, served by the workers pinned to their cores, 0 means one
+         * copy shared by all the nodes
+         */
+        unsigned int numa_replicas;
+
+        /**
+         * Number of helpers reading the cold posting lists of the queries before their evaluation, 0 disables the
+         * out-of-core serving
+         */
+        unsigned int prefetch_threads;
+
+        /**
+         * Seconds after which a posting list prefetched is read again, since the page cache may have evicted it, 0
+         * keeps it resident until its evaluation takes major faults
+         */
+        unsigned int prefetch_ttl_s;
+
+        /**
+         * Memory budget, in MB, of the posting lists of the most used terms locked in memory, 0 disables the locking
+         */
+        unsigned int lock_budget_mb;
+
+        /**
+         * Seconds between the refreshes of the locked posting lists
+         */
+        unsigned int lock_refresh_s;
+
+        /**
+         * Optional query log, one query per line, counting the uses of the terms before the first queries are served
+         */
+        std::string lock_query_log;
+
+        /**
+         * Number of query plans cached by every shard of the index, 0 disables the cache
+         */
+        unsigned int plan_cache_size;
+
+        /**
+         * Memory budget, in MB, of the results of the repeated requests, 0 disables the result cache
+         */
+        unsigned int result_cache_mb;
+
+        server_options()
+                : num_threads(boost::thread::hardware_concurrency()),
+                  num_reactors(1),
+                  max_frame_mb(16),
+                  max_in_flight(0),
+                  max_queue(0),
+                  timeout_ms(0),
+                  huge_pages(HUGE_PAGES_NONE),
+                  numa_replicas(0),
+                  prefetch_threads(0),
+                  prefetch_ttl_s(300),
+                  lock_budget_mb(0),
+                  lock_refresh_s(60),
+                  plan_cache_size(0),
+                  result_cache_mb(0) {
+            if (this->num_threads == 0) {
+                this->num_threads = 1;
+            }
+            this->batch_threads = this->num_threads;
+            this->shard_threads = this->num_threads;
+            this->load_threads = this->num_threads;
+        }
+    };
+
+    /**
+     * @return The usage string of the optional settings
+     */
+    const char *
+    server_options_usage() {
+        return
+                "  --threads N   number of workers evaluating the requests of all the connections, one request\n"
+                "                at a time (default: number of cores, 0 spawns one thread per connection)\n"
+                "  --reactors N  number of network threads reading the requests of the connections without\n"
+                "                blocking, an idle connection does not hold any worker (default: 1)\n"
+                "  --max-frame-mb N\n"
+                "                maximum size of a request, the connections sending a larger one are closed\n"
+                "                (default: 16)\n"
+                "  --batch-threads N\n"
+                "                number of threads evaluating the queries of a batch request (default: number of cores)\n"
+                "  --shard-threads N\n"
+                "                number of threads evaluating a query on the shards of a sharded index\n"
+                "                (default: number of cores)\n"
+                "  --load-threads N\n"
+                "                number of threads loading the index and warming up its files, the status of the\n"
+                "                loading is answered meanwhile (default: number of cores)\n"
+                "  --max-in-flight N\n"
+                "                maximum number of requests evaluated at the same time, the ones exceeding it and the\n"
+                "                queue are answered with an overloaded error (default: 0, no admission control)\n"
+                "  --max-queue N maximum number of requests waiting for an evaluation slot (default: 0)\n"
+                "  --timeout-ms N\n"
+                "                evaluation deadline of the requests without timeout_ms, the evaluation is stopped\n"
+                "                and the partial result is returned (default: 0, no deadline)\n"
+                "  --huge-pages none|transparent|explicit\n"
+                "                copy the index, the wand data and the lexicon to memory backed by transparent huge\n"
+                "                pages or by the ones reserved in vm.nr_hugepages (default: none, mapped files)\n"
+                "  --numa-replicas N\n"
+                "                copy the index and the wand data to the first N NUMA nodes and pin the workers to\n"
+                "                their cores, each worker reads the copy of its node (default: 0, one shared copy)\n"
+                "  --prefetch-threads N\n"
+                "                serve an index larger than the memory: the index is not warmed up at load, N helpers\n"
+                "                read the cold posting lists of a query before its evaluation (default: 0, disabled)\n"
+                "  --prefetch-ttl-s N\n"
+                "                seconds after which a prefetched posting list is read again, 0 for never; a list\n"
+                "                whose evaluation takes major faults is read again anyway (default: 300)\n"
+                "  --lock-budget-mb N\n"
+                "                lock in memory the posting lists of the terms used most by the served queries, up to\n"
+                "                about N MB per server (default: 0, disabled). It requires CAP_IPC_LOCK or a\n"
+                "                RLIMIT_MEMLOCK as large as the index files\n"
+                "  --lock-refresh-s N\n"
+                "                seconds between the refreshes of the locked posting lists (default: 60)\n"
+                "  --lock-query-log FILE\n"
+                "                count the terms of a query log, one query per line, before the first refresh of\n"
+                "                every loaded index (default: none)\n"
+                "  --plan-cache-size N\n"
+                "                cache the plans of the last N query strings used, translated and normalized, in every\n"
+                "                shard, emptied by a reload (default: 0, disabled)\n"
+                "  --result-cache-mb N\n"
+                "                cache the counts and the top-k lists of the repeated query strings in about N MB,\n"
+                "                keeping the results most expensive to evaluate, emptied by a reload\n"
+                "                (default: 0, disabled)\n";
+    }
+
+    unsigned long
+    parse_unsigned_option(
+            const std::string & name,
+            const char * value
+    ) {
+        char * end = nullptr;
+        unsigned long result = std::strtoul(value, &end, 10);
+        if (*value == '\0' || *end != '\0' || *value == '-') {
+            throw std::runtime_error("Invalid value \"" + std::string(value) + "\" for option " + name);
+        }
+        return result;
+    }
+
+    /**
+     * Splits a list given on the command line, e.g., the comma-separated basenames of the shards of an index
+     * @throws std::runtime_error If the list contains an empty element
+     */
+    std::vector<std::string>
+    split_list(
+            const std::string & list,
+            char separator
+    ) {
+        std::vector<std::string> result;
+        std::size_t begin = 0;
+        for (;;) {
+            const std::size_t end = list.find(separator, begin);
+            result.push_back(list.substr(begin, end == std::string::npos ? std::string::npos : end - begin));
+            if (result.back().empty()) {
+                throw std::runtime_error("Empty element in \"" + list + "\"");
+            }
+            if (end == std::string::npos) {
+                break;
+            }
+            begin = end + 1;
+        }
+        return result;
+    }
+
+    /**
+     * Parses the options in argv[first..argc)
+     * @throws std::runtime_error If an option is unknown or has an invalid value
+     */
+    server_options
+    parse_server_options(
+            int argc,
+            char * argv[],
+            int first
+    ) {
+        server_options options;
+
+        for (int i = first; i < argc; ++i) {
+            const std::string name = argv[i];
+            if (i + 1 >= argc) {
+                throw std::runtime_error("Missing value for option " + name);
+            }
+            const char * value = argv[++i];
+
+            if (name == "--threads") {
+                options.num_threads = static_cast<unsigned int>(parse_unsigned_option(name, value));
+            } else if (name == "--reactors") {
+                options.num_reactors = static_cast<unsigned int>(parse_unsigned_option(name, value));
+            } else if (name == "--max-frame-mb") {
+                options.max_frame_mb = static_cast<unsigned int>(parse_unsigned_option(name, value));
+            } else if (name == "--max-in-flight") {
+                options.max_in_flight = static_cast<unsigned int>(parse_unsigned_option(name, value));
+            } else if (name == "--max-queue") {
+                options.max_queue = static_cast<unsigned int>(parse_unsigned_option(name, value));
+            } else if (name == "--timeout-ms") {
+                options.timeout_ms = static_cast<unsigned int>(parse_unsigned_option(name, value));
+            } else if (name == "--batch-threads") {
+                options.batch_threads = static_cast<unsigned int>(parse_unsigned_option(name, value));
+            } else if (name == "--shard-threads") {
+                options.shard_threads = static_cast<unsigned int>(parse_unsigned_option(name, value));
+            } else if (name == "--load-threads") {
+                options.load_threads = static_cast<unsigned int>(parse_unsigned_option(name, value));
+            } else if (name == "--huge-pages") {
+                options.huge_pages = huge_pages_mode_from_string(value);
+            } else if (name == "--numa-replicas") {
+                options.numa_replicas = static_cast<unsigned int>(parse_unsigned_option(name, value));
+            } else if (name == "--prefetch-threads") {
+                options.prefetch_threads = static_cast<unsigned int>(parse_unsigned_option(name, value));
+            } else if (name == "--prefetch-ttl-s") {
+                options.prefetch_ttl_s = static_cast<unsigned int>(parse_unsigned_option(name, value));
+            } else if (name == "--lock-budget-mb") {
+                options.lock_budget_mb = static_cast<unsigned int>(parse_unsigned_option(name, value));
+            } else if (name == "--lock-refresh-s") {
+                options.lock_refresh_s = static_cast<unsigned int>(parse_unsigned_option(name, value));
+            } else if (name == "--lock-query-log") {
+                options.lock_query_log = value;
+            } else if (name == "--plan-cache-size") {
+                options.plan_cache_size = static_cast<unsigned int>(parse_unsigned_option(name, value));
+            } else if (name == "--result-cache-mb") {
+                options.result_cache_mb = static_cast<unsigned int>(parse_unsigned_option(name, value));
+            } else {
+                throw std::runtime_error("Unknown option " + name);
+            }
+        }
+
+        if (options.max_frame_mb == 0 || options.max_frame_mb >= 4096) {
+            throw std::runtime_error("The maximum frame size must be between 1 and 4095 MB");
+        }
+        if (options.batch_threads == 0) {
+            throw std::runtime_error("The number of batch threads must be greater than zero");
+        }
+        if (options.shard_threads == 0) {
+            throw std::runtime_error("The number of shard threads must be greater than zero");
+        }
+        if (options.load_threads == 0) {
+            throw std::runtime_error("The number of load threads must be greater than zero");
+        }
+        if (options.max_queue > 0 && options.max_in_flight == 0) {
+            throw std::runtime_error("The admission queue requires a limit on the requests in flight");
+        }
+        if (options.prefetch_threads > 0 && (options.huge_pages != HUGE_PAGES_NONE || options.numa_replicas > 0)) {
+            throw std::runtime_error("The prefetch serves the index from its file, it cannot be copied to memory");
+        }
+        if (options.lock_budget_mb > 0 && (options.huge_pages != HUGE_PAGES_NONE || options.numa_replicas > 0)) {
+            throw std::runtime_error("The locked posting lists are read from the index file, it cannot be copied to memory");
+        }
+        if (options.lock_budget_mb > 0 && options.lock_refresh_s == 0) {
+            throw std::runtime_error("The refresh period of the locked posting lists must be greater than zero");
+        }
+        if (options.num_threads > 0 && options.num_reactors == 0) {
+            throw std::runtime_error("The workers require at least one reactor reading the requests");
+        }
+
+        return options;
+    }
+}
+
+#endif //INDEX_PARTITIONING_QUERY_SERVER_OPTIONS_HPP
@@ -1,18 +1,19 @@
 #ifndef INDEX_PARTITIONING_QUERY_SERVER_UTILS_HPP
 #define INDEX_PARTITIONING_QUERY_SERVER_UTILS_HPP
 
-#include <boost/iostreams/device/mapped_file.hpp>
-#include <boost/iostreams/filtering_streambuf.hpp>
-#include <boost/iostreams/filter/gzip.hpp>
-#include <fstream>
-#include <iostream>
-#include <unordered_map>
-#include <unordered_set>
+#include <algorithm>
+#include <string>
 #include <vector>
 #include "ds2i/queries.hpp"
+#include "query_server/lexicon.hpp"
+#include "query_server/segment_filter.hpp"
+#include "query/query_bool_plan.hpp"
 #include "query/query_expr_and.hpp"
+#include "query/query_expr_bool.hpp"
 #include "query/query_expr_or.hpp"
 #include "query/query_expr_term.hpp"
+#include "query/query_expr_term_view.hpp"
+#include "query/query_static_parser.hpp"
 
 //#include "../queries.hpp"
 
@@ -21,153 +22,504 @@ namespace query_server {
     using term_id_type = ds2i::term_id_type;
     using term_id_vec = ds2i::term_id_vec;
 
-    std::unordered_map<std::size_t, uint64_t>
-    get_docid_to_new_docid_map(
-            std::string map_file_path
-    ) {
-        std::unordered_map<std::size_t, uint64_t> result;
+    /**
+     * Translates the segments of a query into term ids, recording the segments that are not in the lexicon: the
+     * missing ones, which the filter of .mterms reports as left out of the index, and the unknown ones, which are
+     * certainly not in the collection. Only the unknown segments can prove a conjunction empty.
+     */
+    class SegmentTranslator {
+    public:
+        enum SegmentOutcome {
+            SEGMENT_FOUND,
+            SEGMENT_MISSING,
+            SEGMENT_UNKNOWN
+        };
+
+        SegmentTranslator(const Lexicon & lexicon, const SegmentFilter & missing_filter)
+                : _lexicon(lexicon),
+                  _missing_filter(missing_filter) {}
 
-        // open the file
-        boost::iostreams::mapped_file_source map_file(map_file_path);
-        if ( !map_file.is_open() ) {
-            throw std::runtime_error("Error opening file");
+        /**
+         * @param term_id Filled with the term id of the segment, if it is found
+         */
+        SegmentOutcome translate(const char * segment, std::size_t size, term_id_type & term_id) {
+            if (this->_lexicon.find(segment, size, term_id)) {
+                return SEGMENT_FOUND;
+            }
+            if (this->_missing_filter.may_contain(segment, size)) {
+                add_once(this->_missing, segment, size);
+                return SEGMENT_MISSING;
+            }
+            add_once(this->_unknown, segment, size);
+            return SEGMENT_UNKNOWN;
         }
 
-        // check the file size
-        std::size_t map_file_size = map_file.size();
-        if (map_file_size % 12) {
-            map_file.close();
-            throw std::runtime_error("Incompatible size of the file");
+        SegmentOutcome translate(const std::string & segment, term_id_type & term_id) {
+            return this->translate(segment.data(), segment.size(), term_id);
         }
-        const char * map = map_file.data();
-        const std::size_t map_size = map_file_size;
 
-        for (std::size_t i=0; i < map_size; i += 12) {
-            result[*(std::size_t *)(map+i)] = *(unsigned int *)(map+i+8);
+        SegmentOutcome translate(const query::QueryLexeme & segment, term_id_type & term_id) {
+            return this->translate(segment.data(), segment.size(), term_id);
         }
 
-        std::cerr << " get_docid_to_new_docid_map: stored " << result.size() << " docid." << std::endl;
+        const std::vector<std::string> & missing() const {
+            return this->_missing;
+        }
 
-        return result;
+        const std::vector<std::string> & unknown() const {
+            return this->_unknown;
+        }
+
+    private:
+        static void add_once(std::vector<std::string> & segments, const char * segment, std::size_t size) {
+            for (const std::string & other: segments) {
+                if (other.size() == size && other.compare(0, size, segment, size) == 0) {
+                    return;
+                }
+            }
+            segments.emplace_back(segment, size);
+        }
+
+    private:
+        const Lexicon & _lexicon;
+        const SegmentFilter & _missing_filter;
+        std::vector<std::string> _missing;
+        std::vector<std::string> _unknown;
     };
 
-    std::unordered_map<std::string, term_id_type>
-    get_segment_to_termid_map(
-            std::string file_path
+    /**
+     * Translates one OR group, the missing segments are dropped
+     * @param certainly_empty Set to true if the group is made only of unknown segments
+     */
+    template <typename GetSegment>
+    term_id_vec
+    translate_or_group(
+            std::size_t num_segments,
+            GetSegment get_segment,
+            SegmentTranslator & translator,
+            bool & certainly_empty
     ) {
-        std::unordered_map<std::string, term_id_type> result;
-        term_id_type count = 0;
-
-        // open the file
-        std::ifstream file(file_path, std::ios_base::in | std::ios_base::binary);
-        boost::iostreams::filtering_streambuf<boost::iostreams::input> inbuf;
-        inbuf.push(boost::iostreams::gzip_decompressor());
-        inbuf.push(file);
-        std::istream instream(&inbuf); // convert streambuf to istream
+        term_id_vec result;
+        result.reserve(num_segments);
+        bool has_missing = false;
 
-        for (std::string segment; getline(instream, segment);) {
-            if (segment.size() == 0) {
-                continue;
+        // translate each segment into a term id
+        for (std::size_t j = 0; j < num_segments; ++j) {
+            term_id_type term_id;
+            switch (translator.translate(get_segment(j), term_id)) {
+                case SegmentTranslator::SEGMENT_FOUND:
+                    result.push_back(term_id);
+                    break;
+                case SegmentTranslator::SEGMENT_MISSING:
+                    has_missing = true;
+                    break;
+                case SegmentTranslator::SEGMENT_UNKNOWN:
+                    break;
             }
+        }
 
-            // put the pair segment - termid into the result map
-            auto result_it = result.find(segment);
-            if (result_it != result.end()) {
-                std::cerr << "The segment \"" << segment << "\" appeared two times into the map file";
-            } else {
-                result[segment] = count++;
-            }
+        // a group without term ids and with missing segments is dropped, it does not constrain the query
+        if (num_segments > 0 && result.empty() && !has_missing) {
+            certainly_empty = true;
         }
+        return result;
+    }
 
-        std::cerr << " get_segment_to_termid_map: stored " << count << " segments" << std::endl;
+    /**
+     * Translates the groups of a cnf query, removing the empty OR clauses
+     * @return No groups if the query is certainly empty, since one of its groups is made only of unknown segments
+     */
+    template <typename GetGroup>
+    std::vector<term_id_vec>
+    translate_cnf_groups(
+            std::size_t num_groups,
+            GetGroup get_group
+    ) {
+        std::vector<term_id_vec> result;
+        result.reserve(num_groups);
+        bool certainly_empty = false;
 
+        // all the groups are translated anyway, to report all the missing and unknown segments
+        for (std::size_t i = 0; i < num_groups; ++i) {
+            term_id_vec group = get_group(i, certainly_empty);
+            // remove empty OR clauses
+            if (group.size() > 0) {
+                result.push_back(std::move(group));
+            }
+        }
+
+        if (certainly_empty) {
+            result.clear();
+        }
         return result;
-    };
+    }
 
-    std::unordered_set<std::string>
-    get_segment_set(
-            std::string file_path
+    std::vector<term_id_vec>
+    translate_lexeme_groups(
+            const std::vector<std::vector<std::string>> & lexeme_groups,
+            SegmentTranslator & translator
     ) {
-        std::unordered_set<std::string> result;
-        std::size_t count = 0;
+        return translate_cnf_groups(
+                lexeme_groups.size(),
+                [&lexeme_groups, &translator](std::size_t i, bool & certainly_empty) {
+                    const std::vector<std::string> & lexemes = lexeme_groups[i];
+                    return translate_or_group(
+                            lexemes.size(),
+                            [&lexemes](std::size_t j) -> const std::string & { return lexemes[j]; },
+                            translator,
+                            certainly_empty
+                    );
+                }
+        );
+    }
 
-        // open the file
-        std::ifstream file(file_path, std::ios_base::in | std::ios_base::binary);
-        boost::iostreams::filtering_streambuf<boost::iostreams::input> inbuf;
-        inbuf.push(boost::iostreams::gzip_decompressor());
-        inbuf.push(file);
-        std::istream instream(&inbuf); // convert streambuf to istream
+    /**
+     * Translates the terms of a flat query, the missing segments are dropped
+     * @param conjunctive True for the AND queries, which are certainly empty, thus without terms, when one of their
+     *                    segments is unknown
+     */
+    template <typename GetSegment>
+    term_id_vec
+    translate_flat_segments(
+            std::size_t num_segments,
+            GetSegment get_segment,
+            SegmentTranslator & translator,
+            bool conjunctive
+    ) {
+        term_id_vec result;
+        result.reserve(num_segments);
+        bool certainly_empty = false;
 
-        for (std::string segment; getline(instream, segment);) {
-            if (segment.size() == 0) {
-                continue;
+        // translate each segment into a term id
+        for (std::size_t i = 0; i < num_segments; ++i) {
+            term_id_type term_id;
+            switch (translator.translate(get_segment(i), term_id)) {
+                case SegmentTranslator::SEGMENT_FOUND:
+                    result.push_back(term_id);
+                    break;
+                case SegmentTranslator::SEGMENT_MISSING:
+                    break;
+                case SegmentTranslator::SEGMENT_UNKNOWN:
+                    certainly_empty = conjunctive;
+                    break;
             }
+        }
 
-            // put the pair segment - termid into the result map
-            auto result_it = result.find(segment);
-            if (result_it != result.end()) {
-                std::cerr << "The segment \"" << segment << "\" appeared two times into the map file";
-            } else {
-                result.insert(segment);
-                ++count;
+        if (certainly_empty) {
+            result.clear();
+        }
+        return result;
+    }
+
+    /**
+     * Translates the terms of a query string while it is scanned, see query::QueryStaticParser::scan, with the same
+     * rules of translate_cnf_groups and translate_flat_segments, without building the expression of the query
+     */
+    class ScannedQueryTranslator {
+    public:
+        /**
+         * @param cnf True for a cnf query, whose OR groups made only of unknown segments make it certainly empty,
+         *            false for a flat query, which is certainly empty when it is conjunctive and has an unknown segment
+         * @param normalize True to sort the terms of every group and to remove their duplicates, and the duplicated
+         *                  groups, as the evaluation does with query_normalization
+         */
+        ScannedQueryTranslator(SegmentTranslator & translator, bool cnf, bool conjunctive, bool normalize)
+                : _translator(translator),
+                  _cnf(cnf),
+                  _conjunctive(conjunctive),
+                  _normalize(normalize),
+                  _certainly_empty(false),
+                  _num_segments(0),
+                  _has_missing(false) {}
+
+        void term(const query::QueryLexeme & lexeme) {
+            term_id_type term_id;
+            ++this->_num_segments;
+            switch (this->_translator.translate(lexeme, term_id)) {
+                case SegmentTranslator::SEGMENT_FOUND:
+                    this->_group.push_back(term_id);
+                    break;
+                case SegmentTranslator::SEGMENT_MISSING:
+                    this->_has_missing = true;
+                    break;
+                case SegmentTranslator::SEGMENT_UNKNOWN:
+                    this->_certainly_empty |= !this->_cnf && this->_conjunctive;
+                    break;
+            }
+        }
+
+        void end_group() {
+            if (this->_cnf && this->_num_segments > 0 && this->_group.empty() && !this->_has_missing) {
+                this->_certainly_empty = true;
             }
+            // the empty OR clauses are removed, a flat query keeps its only group
+            if (!this->_group.empty() || !this->_cnf) {
+                if (this->_normalize) {
+                    std::sort(this->_group.begin(), this->_group.end());
+                    this->_group.erase(std::unique(this->_group.begin(), this->_group.end()), this->_group.end());
+                }
+                this->_groups.push_back(std::move(this->_group));
+                this->_group.clear();
+            }
+            this->_num_segments = 0;
+            this->_has_missing = false;
         }
 
-        std::cerr << " get_segment_set: stored " << count << " segments" << std::endl;
+        /**
+         * @return The translated groups, none if the query is certainly empty
+         */
+        std::vector<term_id_vec> groups() {
+            if (this->_certainly_empty) {
+                this->_groups.clear();
+            } else if (this->_normalize) {
+                std::sort(this->_groups.begin(), this->_groups.end());
+                this->_groups.erase(std::unique(this->_groups.begin(), this->_groups.end()), this->_groups.end());
+            }
+            return std::move(this->_groups);
+        }
 
-        return result;
+        /**
+         * @return The terms of a flat query, none if it is certainly empty
+         */
+        term_id_vec terms() {
+            if (this->_certainly_empty || this->_groups.empty()) {
+                return term_id_vec();
+            }
+            return std::move(this->_groups.front());
+        }
+
+    private:
+        SegmentTranslator & _translator;
+        const bool _cnf;
+        const bool _conjunctive;
+        const bool _normalize;
+        bool _certainly_empty;
+        std::vector<term_id_vec> _groups;
+        term_id_vec _group; // being scanned
+        std::size_t _num_segments; // in the group being scanned
+        bool _has_missing; // in the group being scanned
     };
 
+    /**
+     * Parses a cnf query string and translates its groups in a single pass
+     * @return No groups if the query is certainly empty
+     * @throws query::QueryParserException If the string is not a cnf query
+     */
     std::vector<term_id_vec>
-    translate_cnf_expression(
-            const query::QueryExprAND<query::QueryExprOR<query::QueryExprTerm>> & cnf_expr,
-            const std::unordered_map<std::string, term_id_type> & segment_to_termid_map
+    translate_cnf_string(
+            const std::string & query,
+            SegmentTranslator & translator,
+            bool normalize
     ) {
-        std::vector<term_id_vec> result(cnf_expr.getSubExpressionsNumber());
+        query::QueryArena arena;
+        ScannedQueryTranslator handler(translator, true, true, normalize);
+        query::QueryStaticParser::scan<query::QueryExprAND<query::QueryExprOR<query::QueryExprTermView>>>(query.c_str(), arena, handler);
+        return handler.groups();
+    }
 
-        // translate each segment into a term id
-        for (std::size_t i=0, i_max = cnf_expr.getSubExpressionsNumber(); i < i_max; ++i) {
-            result[i].reserve(cnf_expr[i].getSubExpressionsNumber());
+    /**
+     * Parses a flat query string and translates its terms in a single pass
+     * @param conjunctive True for an AND query, whose terms are separated by spaces instead of TOK_OR
+     * @return No terms if the AND query is certainly empty
+     * @throws query::QueryParserException If the string is not a flat query of the given kind
+     */
+    term_id_vec
+    translate_flat_string(
+            const std::string & query,
+            SegmentTranslator & translator,
+            bool conjunctive,
+            bool normalize
+    ) {
+        query::QueryArena arena;
+        ScannedQueryTranslator handler(translator, false, conjunctive, normalize);
+        if (conjunctive) {
+            query::QueryStaticParser::scan<query::QueryExprAND<query::QueryExprTermView>>(query.c_str(), arena, handler);
+        } else {
+            query::QueryStaticParser::scan<query::QueryExprOR<query::QueryExprTermView>>(query.c_str(), arena, handler);
+        }
+        return handler.terms();
+    }
 
-            for (std::size_t j=0, j_max=cnf_expr[i].getSubExpressionsNumber(); j < j_max; ++j) {
-                auto find_it = segment_to_termid_map.find(cnf_expr[i][j].lexeme);
-                if (find_it != segment_to_termid_map.end()) {
-                    result[i].push_back(find_it->second);
-                }
+    /**
+     * Translates a boolean expression into a plan with the rules of the cnf queries: a missing segment is dropped, it
+     * does not constrain the query, while an unknown one matches no documents. Thus an AND having an unknown operand
+     * is certainly empty, an OR is dropped when one of its operands is dropped and the others are empty, and an
+     * excluded operand certainly empty, or dropped, excludes nothing.
+     * The nested operators of the same kind are merged, as the operands of an OR excluded from an AND, which are
+     * excluded one by one, and the duplicated terms of an operator are removed.
+     */
+    class BoolPlanTranslator {
+    public:
+        BoolPlanTranslator(SegmentTranslator & translator)
+                : _translator(translator) {}
+
+        /**
+         * @return The plan of the expression, empty if the query is certainly empty or made only of dropped segments
+         */
+        query::BoolPlan translate(const query::QueryExprBool & expr) {
+            query::BoolPlan plan;
+            if (expr.size() == 0) {
+                return plan;
+            }
+            bool negated = false;
+            const uint32_t root = this->translate_node(expr, skip_negations(expr, 0, negated), plan);
+            if (negated || root == certainly_empty || root == dropped) {
+                plan.nodes.clear();
+                plan.children.clear();
             }
+            return plan;
         }
 
-        // remove empty OR clauses
-        result.erase(
-                std::remove_if(
-                        result.begin(),
-                        result.end(),
-                        [](const term_id_vec & v) { return v.size() == 0; }
-                ),
-                result.end()
-        );
+    private:
+        static const uint32_t certainly_empty = static_cast<uint32_t>(-1);
+        static const uint32_t dropped = static_cast<uint32_t>(-2);
 
-        return result;
-    }
+        /**
+         * @return The position of the first node of expr, from pos, that is not a NOT
+         * @param negated Flipped for every NOT skipped
+         */
+        static std::size_t skip_negations(const query::QueryExprBool & expr, std::size_t pos, bool & negated) {
+            while (expr[pos].op == query::QueryExprBool::EXPR_NOT) {
+                negated = !negated;
+                ++pos;
+            }
+            return pos;
+        }
 
-    template <typename FLATQUERYEXPR>
-    term_id_vec
-    translate_flat_expression(
-            const FLATQUERYEXPR & flat_expr,
-            const std::unordered_map<std::string, term_id_type> & segment_to_termid_map
-    ) {
-        term_id_vec result;
-        result.reserve(flat_expr.getSubExpressionsNumber());
+        /**
+         * Appends to plan the nodes of the sub-expression of expr rooted in pos
+         * @return The position of its root in plan, certainly_empty or dropped
+         */
+        uint32_t translate_node(const query::QueryExprBool & expr, std::size_t pos, query::BoolPlan & plan) {
+            const query::QueryExprBool::node & n = expr[pos];
+            if (n.op == query::QueryExprBool::EXPR_TERM) {
+                term_id_type term_id;
+                switch (this->_translator.translate(n.term.lexeme, term_id)) {
+                    case SegmentTranslator::SEGMENT_FOUND:
+                        plan.nodes.push_back(query::BoolPlan::node {query::BoolPlan::PLAN_TERM, term_id, 0, 0, 0});
+                        return static_cast<uint32_t>(plan.nodes.size() - 1);
+                    case SegmentTranslator::SEGMENT_MISSING:
+                        return dropped;
+                    default:
+                        return certainly_empty;
+                }
+            }
 
-        // translate each segment into a term id
-        for (std::size_t i=0, i_max = flat_expr.getSubExpressionsNumber(); i < i_max; ++i) {
-            auto find_it = segment_to_termid_map.find(flat_expr[i].lexeme);
-            if (find_it != segment_to_termid_map.end()) {
-                result.push_back(find_it->second);
+            // the operands are collected in _operands, and the excluded ones in _excluded, above the ones of the
+            // enclosing operators
+            const std::size_t nodes_begin = plan.nodes.size();
+            const std::size_t children_begin = plan.children.size();
+            const std::size_t operands_begin = this->_operands.size();
+            const std::size_t excluded_begin = this->_excluded.size();
+            const bool conjunctive = n.op == query::QueryExprBool::EXPR_AND;
+            const query::BoolPlan::Operator op = conjunctive ? query::BoolPlan::PLAN_AND : query::BoolPlan::PLAN_OR;
+            bool is_empty = false;
+            bool has_dropped = false;
+
+            // all the operands are translated anyway, to report all the missing and unknown segments
+            for (std::size_t i = 0, child = pos + 1; i < n.num_children; ++i, child += expr[child].size) {
+                bool negated = false;
+                const uint32_t operand = this->translate_node(expr, skip_negations(expr, child, negated), plan);
+                if (operand == certainly_empty) {
+                    is_empty |= conjunctive && !negated;
+                } else if (operand == dropped) {
+                    has_dropped = true;
+                } else if (!negated) {
+                    this->add_operand(plan, operand, this->_operands, operands_begin, op);
+                } else {
+                    // the parser allows the negations only as operands of an AND
+                    this->add_operand(plan, operand, this->_excluded, excluded_begin, query::BoolPlan::PLAN_OR);
+                }
             }
+
+            const std::size_t num_operands = this->_operands.size() - operands_begin;
+            const std::size_t num_excluded = this->_excluded.size() - excluded_begin;
+            uint32_t result;
+            if (is_empty || num_operands == 0) {
+                plan.nodes.resize(nodes_begin);
+                plan.children.resize(children_begin);
+                result = !is_empty && (conjunctive || has_dropped) ? dropped : certainly_empty;
+            } else if (num_operands == 1 && num_excluded == 0) {
+                result = this->_operands.back();
+            } else {
+                const uint32_t first_child = static_cast<uint32_t>(plan.children.size());
+                plan.children.insert(plan.children.end(), this->_operands.begin() + operands_begin, this->_operands.end());
+                plan.children.insert(plan.children.end(), this->_excluded.begin() + excluded_begin, this->_excluded.end());
+                plan.nodes.push_back(query::BoolPlan::node {
+                        op,
+                        0,
+                        first_child,
+                        static_cast<uint32_t>(num_operands + num_excluded),
+                        static_cast<uint32_t>(num_excluded)
+                });
+                result = static_cast<uint32_t>(plan.nodes.size() - 1);
+            }
+            this->_operands.resize(operands_begin);
+            this->_excluded.resize(excluded_begin);
+            return result;
         }
 
-        return result;
+        /**
+         * Adds the operand, the last node of plan, to operands: the operands of an operand of kind merged_op are added
+         * in its place, since they are the last children of plan, and a duplicated term is removed
+         * @param begin The first operand of the operator in operands
+         */
+        void add_operand(query::BoolPlan & plan, uint32_t operand, std::vector<uint32_t> & operands, std::size_t begin, query::BoolPlan::Operator merged_op) {
+            const query::BoolPlan::node n = plan.nodes[operand];
+            if (n.op == query::BoolPlan::PLAN_TERM) {
+                for (std::size_t i = begin; i < operands.size(); ++i) {
+                    const query::BoolPlan::node & other = plan.nodes[operands[i]];
+                    if (other.op == query::BoolPlan::PLAN_TERM && other.term_id == n.term_id) {
+                        plan.nodes.pop_back();
+                        return;
+                    }
+                }
+                operands.push_back(operand);
+            } else if (n.op == merged_op) {
+                // the excluded operands of a merged AND are excluded by the enclosing one
+                const uint32_t num_operands = n.num_children - n.num_excluded;
+                operands.insert(operands.end(), plan.children.begin() + n.first_child, plan.children.begin() + n.first_child + num_operands);
+                this->_excluded.insert(this->_excluded.end(), plan.children.begin() + n.first_child + num_operands, plan.children.end());
+                plan.children.resize(n.first_child);
+                plan.nodes.pop_back();
+            } else {
+                operands.push_back(operand);
+            }
+        }
+
+    private:
+        SegmentTranslator & _translator;
+        std::vector<uint32_t> _operands; // positions in plan of the operands of the operators being translated
+        std::vector<uint32_t> _excluded;
+    };
+
+    /**
+     * Parses a boolean query string and translates it into a plan
+     * @return An empty plan if the query is certainly empty
+     * @throws query::QueryParserException If the string is not a boolean query
+     */
+    query::BoolPlan
+    translate_bool_string(
+            const std::string & query,
+            SegmentTranslator & translator
+    ) {
+        query::QueryArena arena;
+        const query::QueryExprBool expr = query::QueryStaticParser::parse<query::QueryExprBool>(query, arena);
+        return BoolPlanTranslator(translator).translate(expr);
+    }
+
+    term_id_vec
+    translate_lexemes(
+            const std::vector<std::string> & lexemes,
+            SegmentTranslator & translator,
+            bool conjunctive
+    ) {
+        return translate_flat_segments(
+                lexemes.size(),
+                [&lexemes](std::size_t i) -> const std::string & { return lexemes[i]; },
+                translator,
+                conjunctive
+        );
     }
 }
 
@@ -0,0 +1,129 @@
+#ifndef INDEX_PARTITIONING_REPLY_MERGE_HPP
+#define INDEX_PARTITIONING_REPLY_MERGE_HPP
+
+#include <algorithm>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "query_request.hpp"
+
+
+namespace query_server {
+    /**
+     * @return True if lhs ranks before rhs: higher score first, then lower docid
+     */
+    inline bool
+    result_ranks_before(
+            const result_document & lhs,
+            const result_document & rhs
+    ) {
+        return lhs.score > rhs.score || (lhs.score == rhs.score && lhs.docid < rhs.docid);
+    }
+
+    /**
+     * Merges the replies of the shards of a docid-partitioned index, given in the order of the shards.
+     * The counts are summed and the top-k lists are merged with a heap of size ranked_at into the global top-k.
+     * The shards are evaluated in parallel, thus the execution time is the one of the slowest shard.
+     * A segment is missing if it is missing from any shard, and unknown only if it is unknown to every shard answered.
+     * The prefetch counts are summed, the prefetch wait is the one of the slowest shard.
+     * The reply is cached only if the replies of all the shards answered are.
+     * @param shard_replies The replies of the shards, nullptr for the shards missing from the result
+     */
+    void
+    merge_shard_replies(
+            const query_request & request,
+            const std::vector<const query_reply *> & shard_replies,
+            query_reply & reply
+    ) {
+        reply.has_rel = request.has_rel;
+        reply.has_results = request.ranked_at > 0;
+        reply.num_hits_exact = true;
+        reply.shards.reserve(shard_replies.size());
+        bool first_answer = true;
+        for (const query_reply * shard_reply: shard_replies) {
+            if (shard_reply == nullptr) {
+                reply.partial = true;
+                reply.shards.push_back(shard_stats {0, 0, true, false});
+                continue;
+            }
+            reply.num_ret += shard_reply->num_ret;
+            reply.num_rel_ret += shard_reply->num_rel_ret;
+            reply.num_rel += shard_reply->num_rel;
+            reply.exe_time = std::max(reply.exe_time, shard_reply->exe_time);
+            reply.has_deadline = reply.has_deadline || shard_reply->has_deadline;
+            reply.timed_out = reply.timed_out || shard_reply->timed_out;
+            reply.num_hits += shard_reply->num_hits;
+            reply.num_hits_exact = reply.num_hits_exact && shard_reply->num_hits_exact;
+            reply.partial = reply.partial || shard_reply->partial;
+            reply.cached = (first_answer || reply.cached) && shard_reply->cached;
+            reply.shards.push_back(shard_stats {shard_reply->exe_time, shard_reply->num_ret, false, false});
+            if (shard_reply->has_prefetch) {
+                reply.has_prefetch = true;
+                reply.prefetched_lists += shard_reply->prefetched_lists;
+                reply.prefetch_faults += shard_reply->prefetch_faults;
+                reply.prefetch_wait = std::max(reply.prefetch_wait, shard_reply->prefetch_wait);
+                reply.major_faults += shard_reply->major_faults;
+            }
+
+            for (const auto & segment: shard_reply->missing_segments) {
+                if (std::find(reply.missing_segments.begin(), reply.missing_segments.end(), segment) == reply.missing_segments.end()) {
+                    reply.missing_segments.push_back(segment);
+                }
+            }
+            if (first_answer) {
+                reply.unknown_segments = shard_reply->unknown_segments;
+                first_answer = false;
+            } else {
+                const auto & shard_unknown = shard_reply->unknown_segments;
+                reply.unknown_segments.erase(
+                        std::remove_if(
+                                reply.unknown_segments.begin(),
+                                reply.unknown_segments.end(),
+                                [&shard_unknown](const std::string & segment) {
+                                    return std::find(shard_unknown.begin(), shard_unknown.end(), segment) == shard_unknown.end();
+                                }
+                        ),
+                        reply.unknown_segments.end()
+                );
+            }
+        }
+
+        if (request.ranked_at > 0) {
+            // the shards are docid-partitioned, thus the merged list has no duplicates.
+            // the heap keeps the worst of the best ranked_at results on top
+            std::vector<result_document> & heap = reply.results;
+            heap.clear();
+            for (const query_reply * shard_reply: shard_replies) {
+                if (shard_reply == nullptr) {
+                    continue;
+                }
+                for (const auto & result: shard_reply->results) {
+                    if (heap.size() < request.ranked_at) {
+                        heap.push_back(result);
+                        std::push_heap(heap.begin(), heap.end(), result_ranks_before);
+                    } else if (result_ranks_before(result, heap.front())) {
+                        std::pop_heap(heap.begin(), heap.end(), result_ranks_before);
+                        heap.back() = result;
+                        std::push_heap(heap.begin(), heap.end(), result_ranks_before);
+                    }
+                }
+            }
+            std::sort_heap(heap.begin(), heap.end(), result_ranks_before);
+            reply.num_ret = heap.size();
+
+            // the relevant documents retrieved by a shard can fall out of the global top-k
+            if (request.has_rel) {
+                const std::unordered_set<uint64_t> rel_set(request.rel.begin(), request.rel.end());
+                reply.num_rel_ret = 0;
+                for (const auto & result: reply.results) {
+                    if (rel_set.find(result.docid) != rel_set.end()) {
+                        ++reply.num_rel_ret;
+                    }
+                }
+            }
+        }
+    }
+}
+
+#endif //INDEX_PARTITIONING_REPLY_MERGE_HPP
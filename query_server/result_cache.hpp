@@ -0,0 +1,289 @@
+#ifndef INDEX_PARTITIONING_RESULT_CACHE_HPP
+#define INDEX_PARTITIONING_RESULT_CACHE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <cstdint>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "query_server/cache_sharding.hpp"
+#include "query_server/query_request.hpp"
+
+
+namespace query_server {
+    /**
+     * @return The key of the results of a query string in a ResultCache, the key of its plan, see plan_cache_key,
+     * followed by the number of documents ranked
+     */
+    std::string
+    result_cache_key(const std::string & plan_key, unsigned int ranked_at) {
+        return plan_key + '#' + std::to_string(ranked_at);
+    }
+
+    /**
+     * Copies the results of a reply, i.e., the fields stored by a ResultCache: the counts, the top-k list, the
+     * outcome on the shards and the segments
+     */
+    void
+    copy_cached_results(const query_reply & from, query_reply & to) {
+        to.num_ret = from.num_ret;
+        to.exe_time = from.exe_time;
+        to.has_results = from.has_results;
+        to.num_hits = from.num_hits;
+        to.num_hits_exact = from.num_hits_exact;
+        to.results = from.results;
+        to.shards = from.shards;
+        to.missing_segments = from.missing_segments;
+        to.unknown_segments = from.unknown_segments;
+    }
+
+    /**
+     * Concurrent cache of the replies of the repeated requests: their counts, their top-k lists and their segments.
+     * The entries are split among shards by the hash of their key, every one with its own lock and its own part of the
+     * memory budget.
+     * The policy is GreedyDual-Size: the priority of an entry is its evaluation cost per byte plus the inflation of its
+     * shard, which is raised to the priority of every entry evicted, thus the entries not used lose their value over
+     * time. The expensive results, e.g., the cnf ones, are kept over the cheap ones, e.g., the and ones: a result is
+     * admitted only if it fits by evicting entries of lower priority, otherwise it would be the first one evicted,
+     * thus it is rejected but it raises the inflation as its eviction would.
+     */
+    class ResultCache {
+    public:
+        typedef std::shared_ptr<const query_reply> reply_ptr;
+
+        ResultCache()
+                : _budget(0),
+                  _num_shards(0),
+                  _hits(0),
+                  _misses(0),
+                  _admissions(0),
+                  _rejections(0),
+                  _evictions(0) {}
+
+        ResultCache(const ResultCache &) = delete;
+        ResultCache & operator=(const ResultCache &) = delete;
+
+        /**
+         * Empties the cache and sets its budget, to be called before it is shared by the evaluation threads
+         * @param budget The bytes of the cached results, 0 disables the cache
+         */
+        void
+        reset(uint64_t budget) {
+            this->_budget = budget;
+            this->_num_shards = 0;
+            if (budget > 0) {
+                this->_num_shards = num_shards;
+            }
+            this->_shards.reset(this->_num_shards > 0 ? new shard[this->_num_shards] : nullptr);
+            for (std::size_t s = 0; s < this->_num_shards; ++s) {
+                this->_shards[s].budget = budget / this->_num_shards;
+            }
+            this->_hits = 0;
+            this->_misses = 0;
+            this->_admissions = 0;
+            this->_rejections = 0;
+            this->_evictions = 0;
+        }
+
+        bool
+        enabled() const {
+            return this->_num_shards > 0;
+        }
+
+        /**
+         * @return The results stored with key, whose priority is renewed, or nullptr, counted as a miss
+         */
+        reply_ptr
+        find(const std::string & key) {
+            shard & s = this->get_shard(key);
+            {
+                boost::lock_guard<boost::mutex> lock(s.mutex);
+                const auto it = s.entries.find(key);
+                if (it != s.entries.end()) {
+                    entry & e = it->second;
+                    s.by_priority.erase(e.rank);
+                    e.rank = s.by_priority.emplace(s.inflation + e.cost / e.bytes, &it->first);
+                    ++this->_hits;
+                    return e.reply;
+                }
+            }
+            ++this->_misses;
+            return nullptr;
+        }
+
+        /**
+         * Stores the results of reply with key, evicting the entries of its shard of lower priority when it is full
+         * @param cost The milliseconds spent evaluating the request
+         * @return False if the results are not admitted
+         */
+        bool
+        insert(const std::string & key, const query_reply & reply, double cost) {
+            std::shared_ptr<query_reply> stored(new query_reply());
+            copy_cached_results(reply, *stored);
+            const uint64_t bytes = entry_bytes(key, *stored);
+            // the results evaluated faster than the clock resolution still have a cost
+            cost = std::max(cost, 0.001);
+
+            shard & s = this->get_shard(key);
+            boost::lock_guard<boost::mutex> lock(s.mutex);
+            // the entry stored by a concurrent miss on the same key is replaced
+            const auto it = s.entries.find(key);
+            if (it != s.entries.end()) {
+                s.bytes -= it->second.bytes;
+                s.by_priority.erase(it->second.rank);
+                s.entries.erase(it);
+            }
+
+            if (bytes > s.budget) {
+                ++this->_rejections;
+                return false;
+            }
+
+            // the victims are the entries of lowest priority, as long as it is not higher than the one of the result
+            const double priority = s.inflation + cost / bytes;
+            uint64_t freed = 0;
+            auto victims_end = s.by_priority.begin();
+            while (s.bytes - freed + bytes > s.budget) {
+                if (victims_end->first > priority) {
+                    s.inflation = priority;
+                    ++this->_rejections;
+                    return false;
+                }
+                freed += s.entries.find(*victims_end->second)->second.bytes;
+                ++victims_end;
+            }
+            for (auto victim = s.by_priority.begin(); victim != victims_end; ++this->_evictions) {
+                s.inflation = victim->first;
+                s.entries.erase(s.entries.find(*victim->second));
+                victim = s.by_priority.erase(victim);
+            }
+            s.bytes = s.bytes - freed + bytes;
+
+            const auto inserted = s.entries.emplace(key, entry {stored, bytes, cost, s.by_priority.end()});
+            inserted.first->second.rank = s.by_priority.emplace(priority, &inserted.first->first);
+            ++this->_admissions;
+            return true;
+        }
+
+        uint64_t
+        budget() const {
+            return this->_budget;
+        }
+
+        /**
+         * @return The estimated bytes of the results stored
+         */
+        uint64_t
+        bytes() const {
+            uint64_t result = 0;
+            for (std::size_t s = 0; s < this->_num_shards; ++s) {
+                boost::lock_guard<boost::mutex> lock(this->_shards[s].mutex);
+                result += this->_shards[s].bytes;
+            }
+            return result;
+        }
+
+        /**
+         * @return The number of results stored
+         */
+        std::size_t
+        size() const {
+            std::size_t result = 0;
+            for (std::size_t s = 0; s < this->_num_shards; ++s) {
+                boost::lock_guard<boost::mutex> lock(this->_shards[s].mutex);
+                result += this->_shards[s].entries.size();
+            }
+            return result;
+        }
+
+        uint64_t
+        hits() const {
+            return this->_hits.load();
+        }
+
+        uint64_t
+        misses() const {
+            return this->_misses.load();
+        }
+
+        uint64_t
+        admissions() const {
+            return this->_admissions.load();
+        }
+
+        uint64_t
+        rejections() const {
+            return this->_rejections.load();
+        }
+
+        uint64_t
+        evictions() const {
+            return this->_evictions.load();
+        }
+
+    private:
+        typedef std::multimap<double, const std::string *> priority_map; // the key of every entry, lowest priority first
+
+        struct entry {
+            reply_ptr reply;
+            uint64_t bytes;
+            double cost; // milliseconds
+            priority_map::iterator rank;
+        };
+
+        struct shard {
+            mutable boost::mutex mutex;
+            uint64_t budget;
+            uint64_t bytes;
+            double inflation;
+            std::unordered_map<std::string, entry> entries;
+            priority_map by_priority;
+
+            shard()
+                    : budget(0),
+                      bytes(0),
+                      inflation(0) {}
+        };
+
+        static const std::size_t num_shards = 16;
+
+        /**
+         * @return The memory taken by an entry: the reply, its vectors and the nodes of the maps holding it
+         */
+        static uint64_t
+        entry_bytes(const std::string & key, const query_reply & reply) {
+            uint64_t bytes = 2 * key.size() + sizeof(entry) + sizeof(query_reply) + 4 * sizeof(void *)
+                             + reply.results.size() * sizeof(result_document)
+                             + reply.shards.size() * sizeof(shard_stats);
+            for (const auto * segments: {&reply.missing_segments, &reply.unknown_segments}) {
+                for (const std::string & segment: *segments) {
+                    bytes += sizeof(std::string) + segment.size();
+                }
+            }
+            return bytes;
+        }
+
+        shard &
+        get_shard(const std::string & key) {
+            return this->_shards[cache_shard(key, this->_num_shards)];
+        }
+
+    private:
+        uint64_t _budget;
+        std::size_t _num_shards;
+        std::unique_ptr<shard[]> _shards;
+        std::atomic<uint64_t> _hits;
+        std::atomic<uint64_t> _misses;
+        std::atomic<uint64_t> _admissions;
+        std::atomic<uint64_t> _rejections;
+        std::atomic<uint64_t> _evictions;
+    };
+}
+
+#endif //INDEX_PARTITIONING_RESULT_CACHE_HPP
@@ -0,0 +1,182 @@
+#ifndef INDEX_PARTITIONING_SEGMENT_FILTER_HPP
+#define INDEX_PARTITIONING_SEGMENT_FILTER_HPP
+
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "aux_cache.hpp"
+#include "lexicon.hpp"
+
+
+/**
+ * Bloom filter of a gzipped list of segments, e.g., the segments left out of the index listed in .mterms.
+ * It answers whether a segment may be in the list, without false negatives and with about 1% of false positives,
+ * using 10 bits per segment instead of the segments themselves. It is compiled once and memory-mapped from its
+ * snapshot (see aux_cache.hpp), whose payload is:
+ *
+ *   offset  size  field
+ *        0     8  num_segments
+ *        8     8  num_bits, a power of two
+ *       16     4  num_hashes
+ *       20     4  reserved, 0
+ *       24        num_bits / 64 u64 words
+ */
+namespace query_server {
+    class SegmentFilter {
+    public:
+        static const uint32_t version = 1;
+        static const std::size_t header_size = 24;
+
+        SegmentFilter()
+                : _num_segments(0),
+                  _mask(0),
+                  _num_hashes(0),
+                  _words(nullptr) {}
+
+        SegmentFilter(const SegmentFilter &) = delete;
+        SegmentFilter & operator=(const SegmentFilter &) = delete;
+
+        /**
+         * Maps the snapshot of the filter of a gzipped list of segments if it is still valid, otherwise builds the
+         * filter and writes its snapshot for the following loads
+         * @return True if the snapshot has been mapped
+         */
+        bool load(const std::string & source_path) {
+            const char * payload;
+            std::size_t payload_size;
+            if (aux_cache::open(source_path, "BLOM", version, this->_file, payload, payload_size)) {
+                this->_buffer.clear();
+                this->attach(payload, payload_size);
+                std::cerr << " SegmentFilter::load: stored " << this->_num_segments << " segments (snapshot)" << std::endl;
+                return true;
+            }
+
+            aux_cache::source_stamp stamp;
+            const bool has_stamp = aux_cache::stat_source(source_path, stamp);
+            SegmentFilter::compile(source_path, this->_buffer);
+            this->attach(this->_buffer.data(), this->_buffer.size());
+            if (has_stamp) {
+                aux_cache::write(source_path, stamp, "BLOM", version, this->_buffer);
+            }
+            return false;
+        }
+
+        /**
+         * @return False if the segment is certainly not in the list
+         */
+        bool may_contain(const char * segment, std::size_t size) const {
+            if (this->_num_segments == 0) {
+                return false;
+            }
+            uint64_t h1, h2;
+            SegmentFilter::hashes(segment, size, h1, h2);
+            for (uint32_t i = 0; i < this->_num_hashes; ++i) {
+                const uint64_t bit = (h1 + i * h2) & this->_mask;
+                if ((this->_words[bit >> 6] & (uint64_t(1) << (bit & 63))) == 0) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        bool may_contain(const std::string & segment) const {
+            return this->may_contain(segment.data(), segment.size());
+        }
+
+        /**
+         * @return The number of segments added to the filter
+         */
+        std::size_t size() const {
+            return this->_num_segments;
+        }
+
+    private:
+        /**
+         * Two hash values combined as h1 + i * h2 (Kirsch and Mitzenmacher), h2 is odd to cover all the bits
+         */
+        static void hashes(const char * segment, std::size_t size, uint64_t & h1, uint64_t & h2) {
+            h1 = mix(Lexicon::hash(segment, size));
+            h2 = mix(h1 ^ 0x9E3779B97F4A7C15ull) | 1;
+        }
+
+        /**
+         * The finalizer of MurmurHash3, spreading the entropy to the low bits used by the mask
+         */
+        static uint64_t mix(uint64_t h) {
+            h ^= h >> 33;
+            h *= 0xFF51AFD7ED558CCDull;
+            h ^= h >> 33;
+            h *= 0xC4CEB9FE1A85EC53ull;
+            h ^= h >> 33;
+            return h;
+        }
+
+        void attach(const char * data, std::size_t size) {
+            uint64_t num_bits;
+            if (size < header_size) {
+                throw std::runtime_error("Corrupted segment filter");
+            }
+            std::memcpy(&this->_num_segments, data, 8);
+            std::memcpy(&num_bits, data + 8, 8);
+            std::memcpy(&this->_num_hashes, data + 16, 4);
+            if (num_bits < 64 || (num_bits & (num_bits - 1)) != 0 || size != header_size + num_bits / 8) {
+                throw std::runtime_error("Corrupted segment filter");
+            }
+            this->_mask = num_bits - 1;
+            this->_words = reinterpret_cast<const uint64_t *>(data + header_size);
+        }
+
+        /**
+         * Reads the segments of a gzipped list and lays out the filter in buffer
+         */
+        static void compile(const std::string & source_path, std::string & buffer) {
+            std::vector<std::string> segments;
+            read_segment_list(source_path, [&segments](const std::string & segment) {
+                segments.push_back(segment);
+            });
+
+            // 10 bits per segment and 7 hashes give about 1% of false positives
+            uint64_t num_bits = 64;
+            while (num_bits < 10 * segments.size()) {
+                num_bits *= 2;
+            }
+            const uint32_t num_hashes = 7;
+            std::vector<uint64_t> words(num_bits / 64, 0);
+            for (const std::string & segment: segments) {
+                uint64_t h1, h2;
+                SegmentFilter::hashes(segment.data(), segment.size(), h1, h2);
+                for (uint32_t i = 0; i < num_hashes; ++i) {
+                    const uint64_t bit = (h1 + i * h2) & (num_bits - 1);
+                    words[bit >> 6] |= uint64_t(1) << (bit & 63);
+                }
+            }
+
+            const uint64_t num_segments = segments.size();
+            const uint32_t reserved = 0;
+            buffer.clear();
+            buffer.reserve(header_size + num_bits / 8);
+            buffer.append(reinterpret_cast<const char *>(&num_segments), 8);
+            buffer.append(reinterpret_cast<const char *>(&num_bits), 8);
+            buffer.append(reinterpret_cast<const char *>(&num_hashes), 4);
+            buffer.append(reinterpret_cast<const char *>(&reserved), 4);
+            buffer.append(reinterpret_cast<const char *>(words.data()), num_bits / 8);
+
+            std::cerr << " SegmentFilter::compile: stored " << num_segments << " segments" << std::endl;
+        }
+
+    private:
+        boost::iostreams::mapped_file_source _file;
+        std::string _buffer; // the filter built in memory, when it is not mapped
+        uint64_t _num_segments;
+        uint64_t _mask;
+        uint32_t _num_hashes;
+        const uint64_t * _words;
+    };
+}
+
+#endif //INDEX_PARTITIONING_SEGMENT_FILTER_HPP
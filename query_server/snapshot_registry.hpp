@@ -0,0 +1,97 @@
+#ifndef INDEX_PARTITIONING_SNAPSHOT_REGISTRY_HPP
+#define INDEX_PARTITIONING_SNAPSHOT_REGISTRY_HPP
+
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <cstdint>
+#include <memory>
+
+
+namespace query_server {
+    /**
+     * Holds the current snapshot of an immutable object (e.g., the index with its maps) and replaces it atomically.
+     * The readers take a reference-counted pointer to the current snapshot and keep using it until they release it,
+     * thus a replaced snapshot is destroyed only when the last request using it ends.
+     * At most one reload can be in progress at the same time.
+     * The registry can be created empty, with a nullptr snapshot, and receive the initial snapshot once loaded.
+     */
+    template <typename T>
+    class SnapshotRegistry {
+    public:
+        typedef std::shared_ptr<const T> snapshot_ptr;
+
+        SnapshotRegistry(snapshot_ptr initial)
+                : _current(initial),
+                  _generation(0),
+                  _reloading(false) {
+        }
+
+        SnapshotRegistry(const SnapshotRegistry &) = delete;
+        SnapshotRegistry & operator=(const SnapshotRegistry &) = delete;
+
+        /**
+         * @return The current snapshot, valid as long as the returned pointer is alive
+         */
+        snapshot_ptr current() const {
+            boost::lock_guard<boost::mutex> lock(this->_mutex);
+            return this->_current;
+        }
+
+        /**
+         * Replaces the current snapshot, the requests already using the old one go on with it
+         * @return The generation of the new snapshot
+         */
+        uint64_t publish(snapshot_ptr next) {
+            snapshot_ptr old;
+            uint64_t generation;
+            {
+                boost::lock_guard<boost::mutex> lock(this->_mutex);
+                old.swap(this->_current);
+                this->_current = next;
+                // the first snapshot of a registry created empty is the initial one
+                generation = old ? ++this->_generation : this->_generation;
+            }
+            // old is released here, outside the lock
+            return generation;
+        }
+
+        /**
+         * @return The number of snapshots published after the initial one
+         */
+        uint64_t generation() const {
+            boost::lock_guard<boost::mutex> lock(this->_mutex);
+            return this->_generation;
+        }
+
+        /**
+         * Marks the beginning of a reload
+         * @return False if another reload is already in progress
+         */
+        bool begin_reload() {
+            boost::lock_guard<boost::mutex> lock(this->_mutex);
+            if (this->_reloading) {
+                return false;
+            }
+            this->_reloading = true;
+            return true;
+        }
+
+        void end_reload() {
+            boost::lock_guard<boost::mutex> lock(this->_mutex);
+            this->_reloading = false;
+        }
+
+        bool is_reloading() const {
+            boost::lock_guard<boost::mutex> lock(this->_mutex);
+            return this->_reloading;
+        }
+
+    private:
+        mutable boost::mutex _mutex;
+        snapshot_ptr _current;
+        uint64_t _generation;
+        bool _reloading;
+    };
+}
+
+#endif //INDEX_PARTITIONING_SNAPSHOT_REGISTRY_HPP
@@ -2,9 +2,18 @@
 #define INDEX_PARTITIONING_SOCKET_HPP
 
 #include <boost/asio.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <boost/bind.hpp>
+#include <boost/chrono.hpp>
+#include <cerrno>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
 
 #include "socket_exception.hpp"
 
@@ -30,17 +39,43 @@ namespace query_server {
         }
 
         void send_message(const void *data, unsigned int size_in_bytes) {
-            this->write_n_bytes(&size_in_bytes, sizeof(unsigned int));
-            this->write_n_bytes(data, size_in_bytes);
+            // the size and the message are sent with a single gather write
+            std::array<boost::asio::const_buffer, 2> buffers = {
+                    boost::asio::buffer(&size_in_bytes, sizeof(unsigned int)),
+                    boost::asio::buffer(data, size_in_bytes)
+            };
+            this->write_n_bytes(buffers);
         }
 
 
         unsigned int receive_message(std::stringstream &ss) {
+            std::size_t message_size;
+            const char *message = this->receive_message(message_size);
+            ss.write(message, static_cast<std::streamsize>(message_size));
+            return static_cast<unsigned int>(message_size);
+        }
+
+        /**
+         * Receives a message in the buffer of this socket, which is reused by all the messages
+         * @param size_in_bytes Filled with the size of the message
+         * @return A pointer to the message, valid until the next receive
+         * @throws SocketMessageSizeException If the message is larger than the maximum message size, before the buffer
+         * grows
+         */
+        const char *receive_message(std::size_t &size_in_bytes) {
             unsigned int message_size;
 
             this->read_n_bytes(&message_size, sizeof(unsigned int));
-            this->read_n_bytes(ss, message_size);
-            return message_size;
+            if (message_size > this->_max_message_size) {
+                throw SocketMessageSizeException();
+            }
+            if (this->_buffer.size() < message_size) {
+                this->_buffer.resize(message_size);
+            }
+            this->read_n_bytes(this->_buffer.data(), message_size);
+
+            size_in_bytes = message_size;
+            return this->_buffer.data();
         }
 
         void send_message(const std::string &str) {
@@ -51,6 +86,13 @@ namespace query_server {
             this->send_message(str.c_str(), static_cast<unsigned int>(message_size));
         }
 
+        /**
+         * Limits the size of the messages received in the buffer of this socket, thus the memory it keeps
+         */
+        void set_max_message_size(unsigned int max_message_size) {
+            this->_max_message_size = max_message_size;
+        }
+
         void close() {
             this->_sock.close();
         }
@@ -59,17 +101,91 @@ namespace query_server {
             this->_sock.shutdown(tcp::socket::shutdown_both);
         }
 
+        /**
+         * Shuts the connection down without going through asio, thus it can be called by a thread while another one is
+         * blocked on a connect, a send or a receive, which then fails. The socket cannot be used anymore.
+         */
+        void abort() {
+            this->_aborted.store(true);
+            ::shutdown(this->_sock.native_handle(), SHUT_RDWR);
+        }
+
     protected:
-        Socket(boost::asio::io_service *io_service, const char *ip, unsigned short port) : _sock(*io_service) {
+        Socket(boost::asio::io_service *io_service, const char *ip, unsigned short port)
+                : _sock(*io_service),
+                  _max_message_size(static_cast<unsigned int>(-1)),
+                  _aborted(false) {
             tcp::endpoint endpoint = Socket::get_endpoint(ip, port);
             tcp::resolver resolver(*io_service);
             boost::asio::connect(this->_sock, resolver.resolve(endpoint));
         }
 
-        Socket(boost::asio::io_service *io_service, tcp::acceptor &acceptor) : _sock(*io_service) {
+        Socket(boost::asio::io_service *io_service)
+                : _sock(*io_service),
+                  _max_message_size(static_cast<unsigned int>(-1)),
+                  _aborted(false) {}
+
+        Socket(boost::asio::io_service *io_service, tcp::acceptor &acceptor, unsigned int max_message_size)
+                : _sock(*io_service),
+                  _max_message_size(max_message_size),
+                  _aborted(false) {
             acceptor.accept(this->_sock);
         }
 
+        /**
+         * Connects the socket without waiting past the deadline: the connect is non-blocking and its end is polled in
+         * short steps, thus an abort from another thread is noticed meanwhile
+         * @throws SocketException If the connection fails, the deadline passes or the socket is aborted
+         */
+        void connect(const char *ip, unsigned short port, boost::chrono::steady_clock::time_point deadline) {
+            typedef boost::chrono::steady_clock clock;
+            static const int poll_step_ms = 10;
+
+            const tcp::endpoint endpoint = Socket::get_endpoint(ip, port);
+            boost::system::error_code error;
+            this->_sock.open(endpoint.protocol(), error);
+            if (!error) {
+                this->_sock.non_blocking(true, error);
+            }
+            if (error) {
+                throw SocketException(error.message().c_str());
+            }
+            // asio waits for the end of a connect even on a non-blocking socket, thus the system call is used
+            int result = ::connect(this->_sock.native_handle(), endpoint.data(), static_cast<socklen_t>(endpoint.size()));
+            int connect_error = result == 0 ? 0 : errno;
+            while (connect_error == EINPROGRESS || connect_error == EINTR) {
+                if (this->_aborted.load()) {
+                    throw SocketException("Connection aborted");
+                }
+                const clock::time_point now = clock::now();
+                if (now >= deadline) {
+                    throw SocketException("Connection timed out");
+                }
+                const int wait_ms = static_cast<int>(std::min<int64_t>(
+                        poll_step_ms, boost::chrono::duration_cast<boost::chrono::milliseconds>(deadline - now).count() + 1));
+                struct pollfd fd = {this->_sock.native_handle(), POLLOUT, 0};
+                result = ::poll(&fd, 1, wait_ms);
+                if (result < 0 && errno != EINTR) {
+                    connect_error = errno;
+                } else if (result > 0) {
+                    socklen_t length = sizeof(connect_error);
+                    if (::getsockopt(this->_sock.native_handle(), SOL_SOCKET, SO_ERROR, &connect_error, &length) != 0) {
+                        connect_error = errno;
+                    }
+                }
+            }
+            if (connect_error != 0) {
+                throw SocketException(std::strerror(connect_error));
+            }
+            if (this->_aborted.load()) {
+                throw SocketException("Connection aborted");
+            }
+            this->_sock.non_blocking(false, error);
+            if (error) {
+                throw SocketException(error.message().c_str());
+            }
+        }
+
         static
         tcp::endpoint get_endpoint(const char *ip, unsigned short port) {
             return tcp::endpoint(boost::asio::ip::address::from_string(ip), port);
@@ -104,30 +220,13 @@ namespace query_server {
             }
         }
 
-        void
-        read_n_bytes(
-                std::stringstream &ss,
-                std::size_t size_in_bytes
-        ) {
-            try {
-                boost::asio::streambuf streambuf;
-                boost::asio::read(this->_sock, streambuf, boost::asio::transfer_exactly(size_in_bytes));
-
-                ss << &streambuf;
-            } catch (boost::system::system_error const& e) {
-                custom_throw_error(e);
-            } catch ( ... ) {
-                throw SocketException("Unhandled exception in boost::asio::read");
-            }
-        }
-
+        template <typename ConstBufferSequence>
         void
         write_n_bytes(
-                const void *data,
-                std::size_t size_in_bytes
+                const ConstBufferSequence &buffers
         ) {
             try {
-                boost::asio::write(this->_sock, boost::asio::buffer(data, size_in_bytes));
+                boost::asio::write(this->_sock, buffers);
             } catch (boost::system::system_error const& e) {
                 custom_throw_error(e);
             } catch ( ... ) {
@@ -137,17 +236,25 @@ namespace query_server {
 
     private:
         tcp::socket _sock;
+        std::vector<char> _buffer; // reused by the received messages
+        unsigned int _max_message_size;
+        std::atomic<bool> _aborted;
     };
 
 
     class SocketServer {
     public:
-        SocketServer(boost::asio::io_service *io_service, const char *ip, unsigned short port)
+        /**
+         * @param max_message_size The maximum size of the messages received by the accepted sockets
+         */
+        SocketServer(boost::asio::io_service *io_service, const char *ip, unsigned short port,
+                     unsigned int max_message_size = static_cast<unsigned int>(-1))
                 : _io_service(io_service),
-                  _acceptor(tcp::acceptor(*this->_io_service, Socket::get_endpoint(ip, port))) {}
+                  _acceptor(tcp::acceptor(*this->_io_service, Socket::get_endpoint(ip, port))),
+                  _max_message_size(max_message_size) {}
 
         Socket *acceptConnection() {
-            return new Socket(this->_io_service, this->_acceptor);
+            return new Socket(this->_io_service, this->_acceptor, this->_max_message_size);
         }
 
         void close() {
@@ -157,6 +264,7 @@ namespace query_server {
     private:
         boost::asio::io_service *_io_service;
         tcp::acceptor _acceptor;
+        const unsigned int _max_message_size;
     };
 
 
@@ -164,6 +272,14 @@ namespace query_server {
     public:
         SocketClient(boost::asio::io_service *io_service, const char *ip, unsigned short port)
                 : Socket(io_service, ip, port) {}
+
+        /**
+         * A client not connected yet, see connect
+         */
+        explicit SocketClient(boost::asio::io_service *io_service)
+                : Socket(io_service) {}
+
+        using Socket::connect;
     };
 }
 
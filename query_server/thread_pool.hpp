@@ -0,0 +1,124 @@
+#ifndef INDEX_PARTITIONING_THREAD_POOL_HPP
+#define INDEX_PARTITIONING_THREAD_POOL_HPP
+
+#include <boost/bind.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <deque>
+#include <functional>
+#include <iostream>
+
+
+namespace query_server {
+    /**
+     * Fixed-size pool of worker threads consuming tasks from a shared FIFO queue
+     */
+    class ThreadPool {
+    public:
+        typedef std::function<void()> task_type;
+        typedef std::function<void(std::size_t)> worker_init_type;
+
+        /**
+         * Creates the pool and starts its workers
+         * @param num_threads The number of workers, it must be greater than zero
+         * @param worker_init Optional, run by every worker with its id before its first task, e.g., to pin it
+         */
+        ThreadPool(std::size_t num_threads, worker_init_type worker_init = worker_init_type())
+                : _stopped(false),
+                  _worker_init(worker_init) {
+            if (num_threads == 0) {
+                throw std::runtime_error("The number of threads must be greater than zero");
+            }
+            for (std::size_t i = 0; i < num_threads; ++i) {
+                this->_workers.create_thread(boost::bind(&ThreadPool::worker_loop, this, i));
+            }
+        }
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool & operator=(const ThreadPool &) = delete;
+
+        /**
+         * Stops the pool waiting for the completion of the queued tasks
+         */
+        ~ThreadPool() {
+            this->join();
+        }
+
+        /**
+         * Enqueues a task that will be executed by the first available worker
+         * @param task The task to execute
+         */
+        void submit(task_type task) {
+            {
+                boost::unique_lock<boost::mutex> lock(this->_mutex);
+                if (this->_stopped) {
+                    throw std::runtime_error("Unable to submit a task to a stopped pool");
+                }
+                this->_tasks.push_back(std::move(task));
+            }
+            this->_cond.notify_one();
+        }
+
+        /**
+         * Stops accepting new tasks, executes the queued ones and joins the workers
+         */
+        void join() {
+            {
+                boost::unique_lock<boost::mutex> lock(this->_mutex);
+                if (this->_stopped) {
+                    return;
+                }
+                this->_stopped = true;
+            }
+            this->_cond.notify_all();
+            this->_workers.join_all();
+        }
+
+        /**
+         * @return The number of workers
+         */
+        std::size_t size() const {
+            return this->_workers.size();
+        }
+
+    private:
+        void worker_loop(std::size_t worker_id) {
+            if (this->_worker_init) {
+                this->_worker_init(worker_id);
+            }
+            for (;;) {
+                task_type task;
+                {
+                    boost::unique_lock<boost::mutex> lock(this->_mutex);
+                    while (!this->_stopped && this->_tasks.empty()) {
+                        this->_cond.wait(lock);
+                    }
+                    if (this->_tasks.empty()) { // stopped and nothing left to do
+                        return;
+                    }
+                    task = std::move(this->_tasks.front());
+                    this->_tasks.pop_front();
+                }
+
+                try {
+                    task();
+                } catch (const std::exception &e) {
+                    std::cerr << "Exception in pool task: " << e.what() << std::endl;
+                } catch (...) {
+                    std::cerr << "Exception in pool task: unrecognized" << std::endl;
+                }
+            }
+        }
+
+    private:
+        boost::thread_group _workers;
+        std::deque<task_type> _tasks;
+        boost::mutex _mutex;
+        boost::condition_variable _cond;
+        bool _stopped;
+        const worker_init_type _worker_init;
+    };
+}
+
+#endif //INDEX_PARTITIONING_THREAD_POOL_HPP